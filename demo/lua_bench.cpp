@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <iostream>
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include "spdlog/spdlog.h"
+// like scripts.cpp, where the engine's bindings are made. the plain usertypes
+// below are made here, so without it they'd skip the checks the engine's pay for
+#define SOL_ALL_SAFETIES_ON 1
+#include <sol/sol.hpp>
+
+#include <types.h>
+#include <ecs.h>
+#include <components.h>
+#include <lua_query.h>
+#include <scripts.h>
+#include <lua_gc.h>
+#include <lua_alloc.h>
+
+using namespace motorcar;
+
+namespace {
+    const size_t NUM_ENTITIES = 1000;
+    const size_t TICKS = 1000;
+
+    struct Result {
+        f64 run_secs;
+        f64 gc_secs;
+        f64 allocated_kib;
+    };
+
+    f64 lua_kib(lua_State* L) {
+        return lua_gc(L, LUA_GCCOUNT, 0) + lua_gc(L, LUA_GCCOUNTB, 0) / 1024.;
+    }
+
+    template <typename Func>
+    f64 time_secs(const Func func) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+
+        return std::chrono::duration<f64>(end - start).count();
+    }
+
+    // runs `func` with the collector stopped, then times collecting whatever it left behind
+    template <typename Func>
+    Result measure(sol::state& lua, const Func func) {
+        lua_State* L = lua.lua_state();
+
+        lua.collect_garbage();
+        lua_gc(L, LUA_GCSTOP, 0);
+
+        f64 kib_before = lua_kib(L);
+        f64 run_secs = time_secs(func);
+        f64 kib_after = lua_kib(L);
+        f64 gc_secs = time_secs([&]() { lua_gc(L, LUA_GCCOLLECT, 0); });
+
+        lua_gc(L, LUA_GCRESTART, 0);
+        return Result { .run_secs = run_secs, .gc_secs = gc_secs, .allocated_kib = kib_after - kib_before };
+    }
+
+    void report(std::string_view name, const Result& result) {
+        std::cout << name << ": "
+            << result.run_secs * 1000. << "ms running, "
+            << result.gc_secs * 1000. << "ms collecting, "
+            << result.allocated_kib / TICKS << " KiB garbage per tick"
+            << std::endl;
+    }
+
+    void report_rate(std::string_view name, size_t accesses, f64 secs) {
+        std::cout << name << ": " << accesses / secs / 1e6 << "M per second" << std::endl;
+    }
+
+    // field reads and writes on native components, through plain sol usertypes
+    // and through bind_native_fields
+    void bench_field_access(sol::state& lua) {
+        const size_t ACCESSES = 10'000'000;
+
+        sol::state plain;
+        plain.open_libraries(sol::lib::base);
+        plain.new_usertype<vec3>("vec3", "x", &vec3::x, "y", &vec3::y, "z", &vec3::z);
+        plain.new_usertype<Transform>("Transform",
+            "position", &Transform::position,
+            "rotation", &Transform::rotation,
+            "scale", &Transform::scale
+        );
+        plain.new_usertype<Light>("Light",
+            "ambient", &Light::ambient,
+            "diffuse", &Light::diffuse,
+            "specular", &Light::specular,
+            "distance", &Light::distance
+        );
+
+        const char* code = R"(
+            return function(t, l, n)
+                local start = clock()
+                for i = 1, n do local d = l.distance end
+                local reads = clock() - start
+
+                start = clock()
+                for i = 1, n do l.distance = i end
+                local writes = clock() - start
+
+                start = clock()
+                for i = 1, n do local p = t.position end
+                local vector_reads = clock() - start
+
+                return reads, writes, vector_reads
+            end
+        )";
+
+        Transform transform;
+        Light light = Light(vec3(1), 10);
+
+        for (sol::state* state : { &plain, &lua }) {
+            std::string_view bindings = state == &plain ? "sol usertype" : "native fields";
+            (*state)["clock"] = [] {
+                return std::chrono::duration<f64>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            };
+
+            sol::protected_function bench = state->script(code);
+            auto [reads, writes, vector_reads] = bench(std::ref(transform), std::ref(light), ACCESSES).get<std::tuple<f64, f64, f64>>();
+            report_rate(std::format("{}, f32 reads", bindings), ACCESSES, reads);
+            report_rate(std::format("{}, f32 writes", bindings), ACCESSES, writes);
+            report_rate(std::format("{}, vec3 reads", bindings), ACCESSES, vector_reads);
+        }
+    }
+
+    // a lua system over a native and a lua component, through LuaQuery
+    void bench_query_iteration(sol::state& lua, ECSWorld& ecs) {
+        sol::protected_function system = lua.script(R"(
+            return function(e)
+                e.enemy.speed = e.enemy.speed + 1
+                local t = e.transform
+            end
+        )");
+
+        sol::table components = lua.create_table_with(1, "transform", 2, "enemy", 3, "entity");
+
+        for (bool reuse_arguments : { false, true }) {
+            LuaQuery query(components);
+            query.reuse_arguments = reuse_arguments;
+
+            Result result = measure(lua, [&]() {
+                for (size_t tick = 0; tick < TICKS; tick++) {
+                    query.for_each(lua, ecs, false, [&](sol::table& argument) { system(argument); });
+                }
+            });
+            report(reuse_arguments ? "query, pooled table" : "query, fresh tables", result);
+        }
+
+        // the same system, called once per tick with every match
+        sol::protected_function batched_system = lua.script(R"(
+            return function(b)
+                local enemies, transforms = b.enemy, b.transform
+                for i = 1, b.n do
+                    local enemy = enemies[i]
+                    enemy.speed = enemy.speed + 1
+                    local t = transforms[i]
+                end
+            end
+        )");
+
+        LuaQuery query(components);
+        Result result = measure(lua, [&]() {
+            for (size_t tick = 0; tick < TICKS; tick++) {
+                query.for_each_batch(lua, ecs, false, LuaQuery::Batch::Columns, [&](sol::object batch) { batched_system(batch); });
+            }
+        });
+        report("query, batched columns", result);
+    }
+
+    // the same system again, with enemy defined from a schema and stored natively
+    void bench_schema_component(sol::state& lua, ECSWorld& ecs) {
+        ecs.define_component("typed_enemy", lua.create_table_with("speed", "f32"));
+        for (Entity e : ecs.get_entities_from_native_component_name("transform")) {
+            ecs.insert_native_component_from_lua(e, "typed_enemy", lua.create_table_with("speed", 1.));
+        }
+        ecs.flush_command_queue();
+
+        sol::protected_function system = lua.script(R"(
+            return function(e)
+                e.typed_enemy.speed = e.typed_enemy.speed + 1
+                local t = e.transform
+            end
+        )");
+
+        LuaQuery query(lua.create_table_with(1, "transform", 2, "typed_enemy", 3, "entity"));
+        Result result = measure(lua, [&]() {
+            for (size_t tick = 0; tick < TICKS; tick++) {
+                query.for_each(lua, ecs, false, [&](sol::table& argument) { system(argument); });
+            }
+        });
+        report("query, schema component", result);
+    }
+
+    // a synthetic lua movement system (a copy of what enemy_process.lua did before
+    // enemies moved with the patrol kernel), written with vector operators and
+    // with the in-place/raw number api. the operators make a userdata per temporary.
+    // it measures the two apis, not anything the game runs anymore
+    void bench_vector_math(sol::state& lua, ECSWorld& ecs) {
+        ecs.define_component("walker", lua.create_table_with("direction", "vec3"));
+        for (Entity e : ecs.get_entities_from_native_component_name("transform")) {
+            ecs.insert_native_component_from_lua(e, "walker", lua.create_table());
+        }
+        ecs.flush_command_queue();
+
+        lua["delta"] = [] { return 1. / 60.; };
+
+        sol::protected_function operators = lua.script(R"(
+            local speed = 3.0
+            return function(e)
+                local pos = e.transform.position
+                if e.walker.direction.z == 0 then
+                    e.walker.direction = vec3.new(0, 0, 1)
+                    e.transform:set_rotation_euler(vec3.new(0, -3.14 / 2, 0))
+                end
+                if pos.z >= 20 then
+                    e.walker.direction = vec3.new(0, 0, -1)
+                    e.transform:set_rotation_euler(vec3.new(0, 3.14 / 2, 0))
+                elseif pos.z <= -20 then
+                    e.walker.direction = vec3.new(0, 0, 1)
+                    e.transform:set_rotation_euler(vec3.new(0, -3.14 / 2, 0))
+                end
+                e.transform:translate_by(e.walker.direction * delta() * speed)
+            end
+        )");
+
+        sol::protected_function in_place = lua.script(R"(
+            local speed = 3.0
+            return function(e)
+                local _, _, z = e.transform:position_xyz()
+                local direction = e.walker.direction
+                if direction.z == 0 then
+                    direction:set(0, 0, 1)
+                    e.transform:set_rotation_euler_xyz(0, -3.14 / 2, 0)
+                end
+                if z >= 20 then
+                    direction:set(0, 0, -1)
+                    e.transform:set_rotation_euler_xyz(0, 3.14 / 2, 0)
+                elseif z <= -20 then
+                    direction:set(0, 0, 1)
+                    e.transform:set_rotation_euler_xyz(0, -3.14 / 2, 0)
+                end
+                e.transform:translate_along(direction, delta() * speed)
+            end
+        )");
+
+        LuaQuery query(lua.create_table_with(1, "transform", 2, "walker"));
+        for (auto [name, system] : { std::pair { "synthetic movement, vector operators", operators }, std::pair { "synthetic movement, in place", in_place } }) {
+            Result result = measure(lua, [&]() {
+                for (size_t tick = 0; tick < TICKS; tick++) {
+                    query.for_each(lua, ecs, false, [&](sol::table& argument) { system(argument); });
+                }
+            });
+            report(name, result);
+        }
+    }
+
+    // the worst frames of a script that makes garbage every frame, with lua
+    // collecting whenever it wants and with LuaGc stepping it after each frame
+    void bench_gc_pauses() {
+        const size_t FRAMES = 2000;
+        const char* FRAME = R"(
+            return function()
+                local garbage = {}
+                for i = 1, 2000 do
+                    garbage[i] = { x = i, y = i * 2, name = "entity" .. i }
+                end
+                return #garbage
+            end
+        )";
+
+        for (bool scheduled : { false, true }) {
+            sol::state lua;
+            lua.open_libraries(sol::lib::base);
+            std::optional<LuaGc> gc;
+            if (scheduled) gc.emplace(lua);
+
+            sol::protected_function frame = lua.script(FRAME);
+            std::vector<f64> frame_secs;
+            f64 gc_secs = 0.;
+            for (size_t idx = 0; idx < FRAMES; idx++) {
+                frame_secs.push_back(time_secs([&]() { frame(); }));
+                if (gc.has_value()) gc_secs += time_secs([&]() { gc->step(); });
+            }
+
+            std::sort(frame_secs.begin(), frame_secs.end());
+            std::cout << (scheduled ? "gc, stepped between frames: " : "gc, stock: ")
+                << frame_secs[FRAMES / 2] * 1000. << "ms median frame, "
+                << frame_secs[FRAMES * 99 / 100] * 1000. << "ms p99, "
+                << frame_secs.back() * 1000. << "ms worst, "
+                << gc_secs / FRAMES * 1000. << "ms stepping per frame"
+                << std::endl;
+        }
+    }
+
+    // small table churn through lua's default allocator and through LuaAllocator
+    void bench_allocator() {
+        const size_t ROUNDS = 200;
+        const char* CHURN = R"(
+            return function()
+                for i = 1, 10000 do
+                    local t = { x = i, y = i, z = i }
+                    local f = function() return t end
+                end
+            end
+        )";
+
+        for (bool pooled : { false, true }) {
+            LuaAllocator allocator;
+            sol::state lua = pooled
+                ? sol::state(sol::default_at_panic, &LuaAllocator::allocate, &allocator)
+                : sol::state();
+            lua.open_libraries(sol::lib::base);
+
+            sol::protected_function churn = lua.script(CHURN);
+            f64 secs = time_secs([&]() {
+                for (size_t idx = 0; idx < ROUNDS; idx++) churn();
+            });
+            std::cout << (pooled ? "allocation, pooled: " : "allocation, realloc: ")
+                << secs * 1000. << "ms";
+            if (pooled) std::cout << ", " << allocator.get_stats().arena_bytes / 1024 << " KiB of pages";
+            std::cout << std::endl;
+        }
+    }
+}
+
+int main(void) {
+    spdlog::set_level(spdlog::level::warn);
+
+    sol::state lua;
+    lua.open_libraries(sol::lib::base, sol::lib::math, sol::lib::table, sol::lib::string);
+    register_math_to_lua(lua);
+    register_components_to_lua(lua);
+
+    ECSWorld ecs;
+    register_components_to_ecs(ecs);
+    ecs.lua_storage = lua.create_table();
+
+    sol::table enemies = lua.create_table();
+    ecs.lua_storage["enemy"] = enemies;
+
+    for (size_t idx = 0; idx < NUM_ENTITIES; idx++) {
+        Entity e = ecs.new_entity();
+        ecs.emplace_native_component<Transform>(e);
+        enemies[e] = lua.create_table_with("speed", 1.);
+    }
+    ecs.flush_command_queue();
+
+    std::cout << NUM_ENTITIES << " entities, " << TICKS << " ticks" << std::endl;
+    bench_query_iteration(lua, ecs);
+    bench_schema_component(lua, ecs);
+    bench_vector_math(lua, ecs);
+    bench_field_access(lua);
+    bench_gc_pauses();
+    bench_allocator();
+}
@@ -0,0 +1,310 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+
+#include "bytecode.h"
+#include "engine.h"
+#include "snapshot.h"
+
+using namespace motorcar;
+
+namespace {
+    const char ENTRY_MAGIC[8] = { 'M', 'C', 'L', 'U', 'A', 'C', 0, 0 };
+    const char BUNDLE_MAGIC[8] = { 'M', 'C', 'L', 'U', 'A', 'B', 0, 0 };
+
+    // fnv-1a. std::hash isn't guaranteed to be the same between builds
+    u64 hash_bytes(std::string_view bytes, u64 hash = 0xcbf29ce484222325) {
+        for (char c : bytes) {
+            hash ^= (u8)c;
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    f64 secs_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    int write_chunk(lua_State*, const void* p, size_t size, void* user_data) {
+        ((std::string*)user_data)->append((const char*)p, size);
+        return 0;
+    }
+
+    std::optional<std::string> dump(sol::state& lua, sol::load_result& result) {
+        if (!result.valid()) return {};
+
+        lua_State* L = lua.lua_state();
+        std::string bytecode;
+        sol::protected_function chunk = result;
+        chunk.push();
+        // keep debug info, errors and BoundToScript need the chunk name and line numbers
+        int status = lua_dump(L, write_chunk, &bytecode, 0);
+        lua_pop(L, 1);
+
+        if (status != 0) return {};
+        return bytecode;
+    }
+
+    std::optional<std::string> read_file(const std::filesystem::path& path) {
+        std::ifstream file_stream(path, std::ios::binary);
+        if (file_stream.fail()) return {};
+        return std::string { std::istreambuf_iterator<char>(file_stream), std::istreambuf_iterator<char>() };
+    }
+
+    void write_header(SnapshotWriter& writer, const char (&magic)[8], u32 format) {
+        writer.write_bytes(magic, sizeof(magic));
+        writer.write<u32>(format);
+        writer.write_string(ENGINE_VERSION);
+        writer.write_string(LUA_RELEASE);
+    }
+
+    bool read_header(SnapshotReader& reader, const char (&magic)[8], u32 format) {
+        char file_magic[8];
+        reader.read_bytes(file_magic, sizeof(file_magic));
+        if (memcmp(file_magic, magic, sizeof(file_magic)) != 0) return false;
+        if (reader.read<u32>() != format) return false;
+        if (reader.read_string() != ENGINE_VERSION) return false;
+        if (reader.read_string() != LUA_RELEASE) return false;
+        return reader.ok();
+    }
+}
+
+std::filesystem::path BytecodeCache::entry_path(u64 key) const {
+    return directory / std::format("{:016x}.luac", key);
+}
+
+std::optional<BytecodeCache::Entry> BytecodeCache::read_entry(u64 key, u64 source_hash) const {
+    auto file = read_file(entry_path(key));
+    if (!file.has_value()) return {};
+
+    SnapshotReader reader(std::span((const u8*)file->data(), file->size()));
+    if (!read_header(reader, ENTRY_MAGIC, FORMAT)) return {};
+
+    Entry entry;
+    entry.source_hash = reader.read<u64>();
+    entry.parse_secs = reader.read<f64>();
+    u64 checksum = reader.read<u64>();
+    entry.bytecode = reader.read_string();
+
+    if (!reader.ok() || entry.source_hash != source_hash || hash_bytes(entry.bytecode) != checksum) return {};
+    return entry;
+}
+
+void BytecodeCache::write_entry(u64 key, const Entry& entry) const {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    SnapshotWriter writer;
+    write_header(writer, ENTRY_MAGIC, FORMAT);
+    writer.write<u64>(entry.source_hash);
+    writer.write<f64>(entry.parse_secs);
+    writer.write<u64>(hash_bytes(entry.bytecode));
+    writer.write_string(entry.bytecode);
+
+    // written next to it and renamed over, so a crash never leaves half an entry
+    auto path = entry_path(key);
+    auto temp_path = path;
+    temp_path += ".tmp";
+
+    std::ofstream file_stream(temp_path, std::ios::binary | std::ios::trunc);
+    if (file_stream.fail()) {
+        SPDLOG_WARN("couldn't write bytecode cache entry {}.", path.string());
+        return;
+    }
+    file_stream.write((const char*)writer.view().data(), writer.size());
+    file_stream.close();
+
+    if (file_stream.good()) {
+        std::filesystem::rename(temp_path, path, error);
+    } else {
+        std::filesystem::remove(temp_path, error);
+    }
+}
+
+std::optional<sol::load_result> BytecodeCache::load_bytecode(sol::state& lua, const Entry& entry, const std::string& chunk_name) {
+    auto start = std::chrono::steady_clock::now();
+    sol::load_result result = lua.load(std::string_view(entry.bytecode), chunk_name, sol::load_mode::binary);
+    f64 load_secs = secs_since(start);
+
+    if (!result.valid()) {
+        sol::error error = result;
+        SPDLOG_WARN("cached bytecode for {} didn't load, using the source. what(): {}", chunk_name, error.what());
+        stats.rejected++;
+        return {};
+    }
+
+    stats.hits++;
+    stats.load_secs += load_secs;
+    stats.parse_secs_saved += entry.parse_secs - load_secs;
+    return result;
+}
+
+sol::load_result BytecodeCache::load(sol::state& lua, const std::string& code, const std::string& chunk_name) {
+    stats.loaded++;
+
+    u64 source_hash = hash_bytes(code);
+    u64 key = hash_bytes(chunk_name, source_hash);
+
+    if (enabled) {
+        auto bundled = bundle.find(chunk_name);
+        if (bundled != bundle.end() && bundled->second.source_hash == source_hash) {
+            if (auto result = load_bytecode(lua, bundled->second, chunk_name)) return std::move(*result);
+        }
+
+        auto primed_entry = primed.find(chunk_name);
+        if (primed_entry != primed.end()) {
+            Entry entry = std::move(primed_entry->second);
+            primed.erase(primed_entry);
+            if (entry.source_hash == source_hash) {
+                if (auto result = load_bytecode(lua, entry, chunk_name)) return std::move(*result);
+            }
+        }
+
+        if (auto entry = read_entry(key, source_hash)) {
+            if (auto result = load_bytecode(lua, *entry, chunk_name)) return std::move(*result);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    sol::load_result result = lua.load(code, chunk_name, sol::load_mode::text);
+    f64 parse_secs = secs_since(start);
+    stats.parse_secs += parse_secs;
+
+    if (enabled) {
+        if (auto bytecode = dump(lua, result)) {
+            write_entry(key, Entry { .source_hash = source_hash, .parse_secs = parse_secs, .bytecode = std::move(*bytecode) });
+        }
+    }
+    return result;
+}
+
+std::optional<sol::load_result> BytecodeCache::load_bundled(sol::state& lua, const std::string& chunk_name) {
+    auto bundled = bundle.find(chunk_name);
+    if (bundled == bundle.end()) return {};
+
+    stats.loaded++;
+    return load_bytecode(lua, bundled->second, chunk_name);
+}
+
+std::optional<BytecodeCache::Precompiled> BytecodeCache::precompile(const std::string& code, const std::string& chunk_name) const {
+    if (!enabled) return {};
+
+    u64 source_hash = hash_bytes(code);
+    u64 key = hash_bytes(chunk_name, source_hash);
+
+    auto bundled = bundle.find(chunk_name);
+    if (bundled != bundle.end() && bundled->second.source_hash == source_hash) return {};
+
+    if (auto entry = read_entry(key, source_hash)) {
+        return Precompiled { .chunk_name = chunk_name, .source_hash = source_hash, .parse_secs = entry->parse_secs, .bytecode = std::move(entry->bytecode) };
+    }
+
+    sol::state lua;
+    auto start = std::chrono::steady_clock::now();
+    sol::load_result result = lua.load(code, chunk_name, sol::load_mode::text);
+    f64 parse_secs = secs_since(start);
+
+    auto bytecode = dump(lua, result);
+    if (!bytecode.has_value()) return {};
+
+    Entry entry { .source_hash = source_hash, .parse_secs = parse_secs, .bytecode = std::move(*bytecode) };
+    write_entry(key, entry);
+    return Precompiled { .chunk_name = chunk_name, .source_hash = source_hash, .parse_secs = parse_secs, .bytecode = std::move(entry.bytecode) };
+}
+
+void BytecodeCache::prime(Precompiled precompiled) {
+    primed[std::move(precompiled.chunk_name)] = Entry {
+        .source_hash = precompiled.source_hash,
+        .parse_secs = precompiled.parse_secs,
+        .bytecode = std::move(precompiled.bytecode),
+    };
+}
+
+bool BytecodeCache::read_bundle(const std::filesystem::path& path) {
+    auto file = read_file(path);
+    if (!file.has_value()) return false;
+
+    SnapshotReader reader(std::span((const u8*)file->data(), file->size()));
+    if (!read_header(reader, BUNDLE_MAGIC, FORMAT)) {
+        SPDLOG_ERROR("script bundle {} is from a different engine or lua version, ignoring it.", path.string());
+        return false;
+    }
+
+    std::unordered_map<std::string, Entry> entries;
+    u32 count = reader.read<u32>();
+    for (u32 idx = 0; idx < count && reader.ok(); idx++) {
+        std::string chunk_name = reader.read_string();
+        Entry entry;
+        entry.source_hash = reader.read<u64>();
+        entry.parse_secs = reader.read<f64>();
+        u64 checksum = reader.read<u64>();
+        entry.bytecode = reader.read_string();
+
+        if (hash_bytes(entry.bytecode) != checksum) {
+            SPDLOG_ERROR("script bundle {} is corrupt, ignoring it.", path.string());
+            return false;
+        }
+        entries.emplace(std::move(chunk_name), std::move(entry));
+    }
+
+    if (!reader.ok()) {
+        SPDLOG_ERROR("script bundle {} is cut short, ignoring it.", path.string());
+        return false;
+    }
+
+    bundle = std::move(entries);
+    SPDLOG_INFO("read {} scripts from bundle {}.", bundle.size(), path.string());
+    return true;
+}
+
+bool BytecodeCache::write_bundle(sol::state& lua, const std::vector<std::pair<std::string, std::filesystem::path>>& scripts, const std::filesystem::path& path) {
+    SnapshotWriter writer;
+    write_header(writer, BUNDLE_MAGIC, FORMAT);
+    writer.write<u32>(scripts.size());
+
+    for (auto& [chunk_name, script_path] : scripts) {
+        auto code = read_file(script_path);
+        if (!code.has_value()) {
+            SPDLOG_ERROR("couldn't read {} to bundle it.", script_path.string());
+            return false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        sol::load_result result = lua.load(*code, chunk_name, sol::load_mode::text);
+        f64 parse_secs = secs_since(start);
+
+        auto bytecode = dump(lua, result);
+        if (!bytecode.has_value()) {
+            SPDLOG_ERROR("couldn't compile {} to bundle it.", script_path.string());
+            return false;
+        }
+
+        writer.write_string(chunk_name);
+        writer.write<u64>(hash_bytes(*code));
+        writer.write<f64>(parse_secs);
+        writer.write<u64>(hash_bytes(*bytecode));
+        writer.write_string(*bytecode);
+    }
+
+    std::ofstream file_stream(path, std::ios::binary | std::ios::trunc);
+    if (file_stream.fail()) {
+        SPDLOG_ERROR("couldn't open {} to write a script bundle.", path.string());
+        return false;
+    }
+    file_stream.write((const char*)writer.view().data(), writer.size());
+    return file_stream.good();
+}
+
+std::vector<std::string> BytecodeCache::bundled_under(std::string_view prefix) const {
+    std::vector<std::string> ret;
+    for (auto& [chunk_name, _] : bundle) {
+        if (chunk_name.starts_with(prefix)) ret.push_back(chunk_name);
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
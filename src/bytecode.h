@@ -0,0 +1,100 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include "types.h"
+
+// compiled lua chunks, so scripts don't get parsed again on every launch and
+// every stage change.
+//
+// each script's bytecode goes in its own file in the cache directory, named by
+// a hash of its chunk name and source. entries are tagged with the engine
+// version and lua's version, and carry a checksum of the bytecode. an entry
+// that doesn't match all of those, or that lua won't load, is thrown away and
+// the script is parsed from source like it would've been anyway.
+//
+// a bundle is every script's bytecode in one file, for shipping. scripts that
+// match their bundled source hash load from it, and scripts that aren't on disk
+// at all load from it as is.
+//
+// file layouts (see SnapshotWriter):
+//   entry:  "MCLUAC\0\0" | u32 format | string engine version | string lua version
+//           | u64 source hash | f64 parse secs | u64 checksum | string bytecode
+//   bundle: "MCLUAB\0\0" | u32 format | string engine version | string lua version
+//           | u32 count | per script: string chunk name | u64 source hash | f64 parse secs | u64 checksum | string bytecode
+
+namespace motorcar {
+    class BytecodeCache {
+        static const u32 FORMAT = 1;
+
+        struct Entry {
+            u64 source_hash = 0;
+            f64 parse_secs = 0.; // how long the source took to parse, for the stats
+            std::string bytecode;
+        };
+
+        std::filesystem::path directory;
+        std::unordered_map<std::string, Entry> bundle;
+        std::unordered_map<std::string, Entry> primed; // chunk name -> bytecode from prime()
+
+        std::filesystem::path entry_path(u64 key) const;
+        std::optional<Entry> read_entry(u64 key, u64 source_hash) const;
+        void write_entry(u64 key, const Entry& entry) const;
+        std::optional<sol::load_result> load_bytecode(sol::state& lua, const Entry& entry, const std::string& chunk_name);
+
+        public:
+            // a script compiled ahead of time, see precompile
+            struct Precompiled {
+                std::string chunk_name;
+                u64 source_hash = 0;
+                f64 parse_secs = 0.;
+                std::string bytecode;
+            };
+
+            struct Stats {
+                size_t loaded = 0;         // scripts loaded through the cache
+                size_t hits = 0;           // of those, how many came from bytecode
+                size_t rejected = 0;       // stale or broken entries that fell back to source
+                f64 parse_secs = 0.;       // spent parsing scripts that weren't cached
+                f64 load_secs = 0.;        // spent loading bytecode
+                f64 parse_secs_saved = 0.; // what the hits took to parse when they were cached, minus load_secs
+            };
+
+            // turn it off to always parse from source. bundled scripts that
+            // aren't on disk still load from the bundle
+            bool enabled = true;
+
+            BytecodeCache(std::filesystem::path directory) : directory(std::move(directory)) {}
+
+            // like lua.load(code, chunk_name), but from the cache when it can be
+            sol::load_result load(sol::state& lua, const std::string& code, const std::string& chunk_name);
+            // a script that's only in the bundle
+            std::optional<sol::load_result> load_bundled(sol::state& lua, const std::string& chunk_name);
+
+            // the bytecode for `code`, from the cache or compiled in a lua state of
+            // its own, so this can run on any thread. empty if it's bundled (it
+            // loads from there anyway) or doesn't compile (loading it will say why)
+            std::optional<Precompiled> precompile(const std::string& code, const std::string& chunk_name) const;
+            // the next load of the script uses this, unless its source changed since
+            void prime(Precompiled precompiled);
+
+            bool read_bundle(const std::filesystem::path& path);
+            // compiles every script in `scripts` (chunk name, path) into a bundle at `path`
+            bool write_bundle(sol::state& lua, const std::vector<std::pair<std::string, std::filesystem::path>>& scripts, const std::filesystem::path& path);
+
+            bool is_bundled(const std::string& chunk_name) const { return bundle.contains(chunk_name); }
+            // chunk names in the bundle that start with `prefix`
+            std::vector<std::string> bundled_under(std::string_view prefix) const;
+
+            const Stats& get_stats() const { return stats; }
+
+        private:
+            Stats stats;
+    };
+}
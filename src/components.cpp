@@ -1,9 +1,47 @@
 #include "ecs.h"
+#include <deque>
+#include <mutex>
+#include <tuple>
 #include <sol/sol.hpp>
 #include "components.h"
 
 using namespace motorcar;
 
+namespace {
+    // a deque, so the names handed out by event_name stay put
+    struct EventNames {
+        std::mutex mutex;
+        std::deque<std::string> names;
+        std::unordered_map<std::string, EventId> ids;
+    };
+
+    EventNames& event_names() {
+        static EventNames ret;
+        return ret;
+    }
+}
+
+EventId motorcar::event_id(std::string_view name) {
+    EventNames& events = event_names();
+    std::lock_guard guard { events.mutex };
+
+    std::string key = { name.begin(), name.end() };
+    auto it = events.ids.find(key);
+    if (it != events.ids.end()) return it->second;
+
+    EventId id = events.names.size();
+    events.names.push_back(key);
+    events.ids.emplace(key, id);
+    return id;
+}
+
+const std::string& motorcar::event_name(EventId event) {
+    EventNames& events = event_names();
+    std::lock_guard guard { events.mutex };
+
+    return events.names.at(event);
+}
+
 void motorcar::register_components_to_lua(sol::state& state) {
     auto global_transform = state.new_usertype<GlobalTransform>("GlobalTransform", sol::constructors<>());
 
@@ -16,6 +54,18 @@ void motorcar::register_components_to_lua(sol::state& state) {
     global_transform["up"] = &GlobalTransform::up;
     global_transform["down"] = &GlobalTransform::down;
 
+    // the same, as three numbers. `gt:position()` makes a new vec3 every call,
+    // `local x, y, z = gt:position_xyz()` doesn't make anything
+    using xyz = std::tuple<f32, f32, f32>;
+    auto unpack = [](vec3 v) { return xyz(v.x, v.y, v.z); };
+    global_transform["position_xyz"] = [=](const GlobalTransform& gt) { return unpack(gt.position()); };
+    global_transform["forward_xyz"] = [=](const GlobalTransform& gt) { return unpack(gt.forward()); };
+    global_transform["backward_xyz"] = [=](const GlobalTransform& gt) { return unpack(gt.backward()); };
+    global_transform["left_xyz"] = [=](const GlobalTransform& gt) { return unpack(gt.left()); };
+    global_transform["right_xyz"] = [=](const GlobalTransform& gt) { return unpack(gt.right()); };
+    global_transform["up_xyz"] = [=](const GlobalTransform& gt) { return unpack(gt.up()); };
+    global_transform["down_xyz"] = [=](const GlobalTransform& gt) { return unpack(gt.down()); };
+
     auto transform = state.new_usertype<Transform>("Transform",
         sol::constructors<Transform()>(),
         "position", &Transform::position,
@@ -46,11 +96,26 @@ void motorcar::register_components_to_lua(sol::state& state) {
     transform["set_rotation_euler"] = &Transform::set_rotation_euler;
     transform["euler_angles"] = &Transform::euler_angles;
 
+    // raw number versions of the above, so scripts don't make a vec3 to move something
+    transform["position_xyz"] = [=](const Transform& t) { return unpack(t.position); };
+    transform["set_position_xyz"] = [](Transform& t, f32 x, f32 y, f32 z) { t.position = vec3(x, y, z); };
+    transform["translate_xyz"] = [](Transform& t, f32 x, f32 y, f32 z) { t.position += vec3(x, y, z); };
+    // moves `amount` along `direction`, like translate_by(direction * amount) without the temporaries
+    transform["translate_along"] = [](Transform& t, const vec3& direction, f32 amount) { t.position += direction * amount; };
+    transform["set_rotation_euler_xyz"] = [](Transform& t, f32 x, f32 y, f32 z) { t.set_rotation_euler(vec3(x, y, z)); };
+    transform["rotate_by_xyz"] = [](Transform& t, f32 x, f32 y, f32 z, f32 rads) { t.rotate_by(vec3(x, y, z), rads); };
+
     state.new_usertype<Velocity>("Velocity",
         sol::constructors<Velocity(vec3)>(),
         "v", &Velocity::v
     );
 
+    state.new_usertype<Lifetime>("Lifetime",
+        sol::constructors<Lifetime(f32)>(),
+        "time", sol::readonly(&Lifetime::time),
+        "expires_at", sol::readonly(&Lifetime::expires_at)
+    );
+
     state.new_usertype<Sprite>("Sprite",
         sol::constructors<Sprite(std::string)>(),
         "resource_path", &Sprite::resource_path
@@ -83,6 +148,10 @@ void motorcar::register_components_to_lua(sol::state& state) {
         "specular", &Light::specular,
         "distance", &Light::distance
     );
+
+    bind_native_fields<Transform>(state);
+    bind_native_fields<Velocity>(state);
+    bind_native_fields<Light>(state);
 }
 
 void motorcar::register_components_to_ecs(ECSWorld &world) {
@@ -90,6 +159,7 @@ void motorcar::register_components_to_ecs(ECSWorld &world) {
     world.register_component<GlobalTransform>();
     world.register_component<Parent>();
     world.register_component<Velocity>();
+    world.register_component<Lifetime>();
     world.register_component<Sprite>();
     world.register_component<GLTF>();
     world.register_component<Albedo>();
@@ -99,6 +169,7 @@ void motorcar::register_components_to_ecs(ECSWorld &world) {
 
     world.register_component<System>();
     world.register_component<EventHandler>();
+    world.register_component<Task>();
     world.register_component<RenderSystem>();
     world.register_component<PhysicsSystem>();
     world.register_component<BoundToStage>();
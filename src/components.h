@@ -1,8 +1,12 @@
 #pragma once
 #include "traits.h"
 #include "types.h"
+#include "snapshot.h"
 #include <sol/forward.hpp>
 #include <sol/sol.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cmath>
 #include <stdexcept>
 
 #define GLM_ENABLE_EXPERIMENTAL
@@ -13,6 +17,29 @@
     struct ComponentTypeTrait<type> {\
         constexpr static bool value = true;\
         constexpr static std::string_view component_name = name;\
+        constexpr static std::array<ComponentField, 0> fields = {};\
+    }
+
+// COMPONENT_TYPE_TRAIT, plus the fields lua can read and write straight from
+// the component's memory (see bind_native_fields), as COMPONENT_FIELD(member)s
+#define COMPONENT_TYPE_TRAIT_WITH_FIELDS(type, name, ...) \
+    template <>\
+    struct ComponentTypeTrait<type> {\
+        using Component = type;\
+        constexpr static bool value = true;\
+        constexpr static std::string_view component_name = name;\
+        constexpr static std::array fields = { __VA_ARGS__ };\
+    }
+#define COMPONENT_FIELD(member) \
+    ComponentField { #member, field_type<decltype(Component::member)>(), offsetof(Component, member) }
+
+// for components that are just a string, constructable from that string
+#define STRING_COMPONENT_SERIALIZER(type, field) \
+    template <>\
+    struct ComponentSerializer<type> {\
+        constexpr static bool value = true;\
+        static void write(SnapshotWriter& writer, const type& t) { writer.write_string(t.field); }\
+        static void read(SnapshotReader& reader, void* dest) { new ((type*)dest) type(reader.read_string()); }\
     }
 
 #define NOT_LUA_CONSTRUCTABLE(type) \
@@ -183,7 +210,11 @@ namespace motorcar {
             return glm::eulerAngles(rotation);
         }
     };
-    COMPONENT_TYPE_TRAIT(Transform, "transform");
+    COMPONENT_TYPE_TRAIT_WITH_FIELDS(Transform, "transform",
+        COMPONENT_FIELD(position),
+        COMPONENT_FIELD(rotation),
+        COMPONENT_FIELD(scale)
+    );
 
     struct GlobalTransform {
         mat4 model;
@@ -214,6 +245,10 @@ namespace motorcar {
                 throw std::runtime_error("object is not convertible to Parent");
             }
         }
+
+        void remap_entities(const EntityRemap& remap) {
+            if (remap.contains(parent)) parent = remap.at(parent);
+        }
     };
     COMPONENT_TYPE_TRAIT(Parent, "parent");
 
@@ -231,7 +266,38 @@ namespace motorcar {
             }
         }
     };
-    COMPONENT_TYPE_TRAIT(Velocity, "velocity");
+    COMPONENT_TYPE_TRAIT_WITH_FIELDS(Velocity, "velocity", COMPONENT_FIELD(v));
+
+    // despawns its entity `time` simulated seconds after it's inserted. the engine
+    // puts it on the timer wheel when it's inserted, so nothing looks at it every tick.
+    // changing `time` afterwards does nothing, insert a new Lifetime instead.
+    struct Lifetime {
+        f32 time;
+        f64 expires_at = NAN; // filled in by the engine
+        u64 timer = 0;        // the timer that despawns this entity
+
+        Lifetime(f32 time) : time(time) {}
+
+        // snapshots are restored at a different simulated time than they were
+        // captured at. keeps the time left the same
+        void shift_time(f64 secs) { expires_at += secs; }
+        Lifetime(sol::object object) {
+            if (object.is<Lifetime>()) {
+                time = object.as<Lifetime>().time;
+            } else if (object.is<f32>()) {
+                time = object.as<f32>();
+            } else if (object.is<sol::table>()) {
+                sol::optional<f32> t = object.as<sol::table>().get<sol::optional<f32>>("time");
+                if (!t.has_value()) {
+                    throw std::runtime_error("lifetime table needs a time");
+                }
+                time = t.value();
+            } else {
+                throw std::runtime_error("object is not convertible to Lifetime");
+            }
+        }
+    };
+    COMPONENT_TYPE_TRAIT(Lifetime, "lifetime");
 
     struct Sprite {
         std::string resource_path;
@@ -247,26 +313,79 @@ namespace motorcar {
         }
     };
     COMPONENT_TYPE_TRAIT(Sprite, "sprite");
+    STRING_COMPONENT_SERIALIZER(Sprite, resource_path);
+
+    // when a system runs. by default, every tick (or frame, for render systems)
+    struct SystemSchedule {
+        // run once every n ticks
+        u32 every_n_ticks = 1;
+        // run at most this many times a second. 0 means no limit
+        f32 target_hz = 0;
+        // spread the system's entities over this many runs. each run only sees
+        // the entities in ECSWorld::current_slice, 1/amortize_over of them, and
+        // Engine.delta is amortize_over runs long
+        u32 amortize_over = 1;
+        // render systems that can be put off when the frame is running late
+        bool low_priority = false;
+    };
 
     struct System {
+        // a low priority system never gets put off more than this many frames in a row
+        static const u32 MAX_DEFERRED_FRAMES = 4;
+
         std::function<void()> callback;
         size_t priority;
+        SystemSchedule schedule;
+
+        u64 calls = 0; // times the system was due to be considered
+        u64 runs = 0;  // times it actually ran
+        f64 last_run_secs = -INFINITY;
+        u32 deferred_frames = 0;
 
-        System(std::function<void()> callback, size_t priority) : callback(callback), priority(priority) {}
+        System(std::function<void()> callback, size_t priority, SystemSchedule schedule = {}) :
+            callback(callback), priority(priority), schedule(schedule) {}
         NOT_LUA_CONSTRUCTABLE(System)
+
+        // `now` is simulated time for physics systems and wall time for render systems.
+        // doesn't count the call, the caller bumps `calls` once it's decided
+        // the system isn't being put off
+        bool is_due(f64 now) const {
+            bool due = (calls % std::max(schedule.every_n_ticks, 1u)) == 0;
+            if (due && schedule.target_hz > 0) {
+                // a little slack so 60hz ticks land on 20hz runs
+                due = now - last_run_secs + 1e-6 >= 1. / schedule.target_hz;
+            }
+            return due;
+        }
     };
     COMPONENT_TYPE_TRAIT(System, "::system");
 
+    // event names are interned, so firing an event and finding its handlers
+    // compares integers. Events.id(name) hands the id to lua.
+    EventId event_id(std::string_view event_name);
+    const std::string& event_name(EventId event);
+
     struct EventHandler {
         std::function<void(sol::object)> callback;
         std::string event_name;
+        EventId event;
 
         EventHandler(std::function<void(sol::object)> callback, std::string event_name) : 
-            callback(callback), event_name(event_name) {}
+            callback(callback), event_name(event_name), event(event_id(event_name)) {}
         NOT_LUA_CONSTRUCTABLE(EventHandler)
     };
     COMPONENT_TYPE_TRAIT(EventHandler, "::event_handler");
 
+    // a running lua task, see tasks.h
+    struct TaskState;
+    struct Task {
+        std::shared_ptr<TaskState> state;
+
+        Task(std::shared_ptr<TaskState> state) : state(state) {}
+        NOT_LUA_CONSTRUCTABLE(Task)
+    };
+    COMPONENT_TYPE_TRAIT(Task, "::task");
+
     struct RenderSystem {
         RenderSystem() {}
         NOT_LUA_CONSTRUCTABLE(RenderSystem)
@@ -285,6 +404,7 @@ namespace motorcar {
         NOT_LUA_CONSTRUCTABLE(BoundToStage)
     };
     COMPONENT_TYPE_TRAIT(BoundToStage, "::bound_to_stage");
+    STRING_COMPONENT_SERIALIZER(BoundToStage, stage_name);
 
     struct BoundToScript {
         std::string script_name;
@@ -292,6 +412,7 @@ namespace motorcar {
         NOT_LUA_CONSTRUCTABLE(BoundToScript)
     };
     COMPONENT_TYPE_TRAIT(BoundToScript, "::bound_to_script");
+    STRING_COMPONENT_SERIALIZER(BoundToScript, script_name);
 
     struct GLTF {
         std::string resource_path;
@@ -308,6 +429,7 @@ namespace motorcar {
         }
     };
     COMPONENT_TYPE_TRAIT(GLTF, "gltf");
+    STRING_COMPONENT_SERIALIZER(GLTF, resource_path);
 
     struct Albedo {
         vec4 color;
@@ -349,6 +471,7 @@ namespace motorcar {
         }
     };
     COMPONENT_TYPE_TRAIT(Text, "text");
+    STRING_COMPONENT_SERIALIZER(Text, text);
 
     struct Sprite3D {
         std::string resource_path;
@@ -364,6 +487,7 @@ namespace motorcar {
         }
     };
     COMPONENT_TYPE_TRAIT(Sprite3D, "sprite3d");
+    STRING_COMPONENT_SERIALIZER(Sprite3D, resource_path);
 
     struct Light {
         vec3 ambient;
@@ -382,7 +506,12 @@ namespace motorcar {
 
         DEFAULT_LUA_CONSTRUCTABLE(Light);
     };
-    COMPONENT_TYPE_TRAIT(Light, "light");
+    COMPONENT_TYPE_TRAIT_WITH_FIELDS(Light, "light",
+        COMPONENT_FIELD(ambient),
+        COMPONENT_FIELD(diffuse),
+        COMPONENT_FIELD(specular),
+        COMPONENT_FIELD(distance)
+    );
     
     void register_components_to_lua(sol::state& state);
     void register_components_to_ecs(ECSWorld& world);
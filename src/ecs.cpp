@@ -1,4 +1,7 @@
 #include "components.h"
+#include <algorithm>
+#include <format>
+#include <memory>
 #include <vector>
 #include <spdlog/spdlog.h>
 
@@ -12,15 +15,19 @@ const size_t Ocean::MIB;
 
 void ComponentStorage::expand() {
     // realloc with a factor of 1.5x
-    size_t new_capacity = capacity < 2 ? 2 : (capacity >> 1) + capacity;
+    reserve(capacity < 2 ? 2 : (capacity >> 1) + capacity);
+}
+
+void ComponentStorage::reserve(size_t new_capacity) {
+    if (new_capacity <= capacity) return;
 
     void* new_blob = malloc(new_capacity * stride);
     for (size_t idx = 0; idx < len; idx++) {
         void* old_ptr = compute_pointer(idx);
         void* new_ptr = (void*)((size_t)new_blob + (idx * stride));
 
-        MOTORCAR_EAT_EXCEPTION(move_from_ptr(new_ptr, old_ptr), "caught exception when moving component");
-        MOTORCAR_EAT_EXCEPTION(dtor(old_ptr), "caught exception when destroying moved component");
+        MOTORCAR_EAT_EXCEPTION(move_row(new_ptr, old_ptr), "caught exception when moving component");
+        MOTORCAR_EAT_EXCEPTION(destroy_row(old_ptr), "caught exception when destroying moved component");
     }
     free(blob);
     blob = new_blob;
@@ -28,21 +35,54 @@ void ComponentStorage::expand() {
     capacity = new_capacity;
 }
 
+void ComponentStorage::clear() {
+    for (size_t idx = 0; idx < len; idx++) {
+        MOTORCAR_EAT_EXCEPTION(destroy_row(compute_pointer(idx)), "caught exception when clearing component");
+    }
+
+    len = 0;
+    touch_rows();
+    indices.clear();
+    entities.clear();
+}
+
 void ComponentStorage::insert_sol_object(Entity e, sol::object object) {
     // no MOTORCAR_EAT_EXCEPTION. let it bubble up to lua
     // (this code is already exception safe anyhow)
     if (indices.contains(e)) {
+        touch();
+    } else {
+        touch_rows();
+    }
+
+    if (indices.contains(e) && schema) {
+        // build the new row on the side, so a bad table leaves the old one alone
+        std::unique_ptr<u8[]> scratch(new u8[stride]);
+        schema->construct_from_lua(scratch.get(), object);
+
+        void* ptr = compute_pointer(indices.at(e));
+        schema->destroy(ptr);
+        schema->move(ptr, scratch.get());
+        schema->destroy(scratch.get());
+        if (on_insert) on_insert(e, ptr);
+    } else if (indices.contains(e)) {
         ctor_from_sol_object(compute_pointer(indices.at(e)), object);
+        if (on_insert) on_insert(e, compute_pointer(indices.at(e)));
     } else {
         if (len == capacity) {
             expand();
         }
 
-        ctor_from_sol_object(compute_pointer(len), object);
+        if (schema) {
+            schema->construct_from_lua(compute_pointer(len), object);
+        } else {
+            ctor_from_sol_object(compute_pointer(len), object);
+        }
 
         len++;
         indices.emplace(e, len - 1);
         entities.push_back(e);
+        if (on_insert) on_insert(e, compute_pointer(len - 1));
     }
 }
 
@@ -55,7 +95,28 @@ sol::object ComponentStorage::get_component_as_lua_object(Entity e, sol::state&
         return sol::nil;
     }
 
-    return get_sol_object(compute_pointer(indices.at(e)), lua);
+    return get_row_as_lua_object(indices.at(e), lua);
+}
+
+const sol::object& ComponentStorage::get_row_as_lua_object(size_t row, sol::state& lua) {
+    // lua can write through the view, whether it means to or not
+    touch();
+
+    if (lua_views_blob != blob || lua_views_state != lua.lua_state()) {
+        lua_views.clear();
+        lua_views_blob = blob;
+        lua_views_state = lua.lua_state();
+    }
+
+    if (lua_views.size() <= row) {
+        lua_views.resize(std::max(row + 1, len));
+    }
+
+    sol::object& view = lua_views[row];
+    if (!view.valid()) {
+        view = schema ? schema->make_view(compute_pointer(row), lua) : get_sol_object(compute_pointer(row), lua);
+    }
+    return view;
 }
 
 void ComponentStorage::remove_component(Entity e) {
@@ -65,16 +126,17 @@ void ComponentStorage::remove_component(Entity e) {
     }
 
     size_t index = indices.at(e);
+    touch_rows();
 
     // destroy the component
     void* ptr = compute_pointer(index);
-    MOTORCAR_EAT_EXCEPTION(dtor(ptr), "caught unknown exception removing component");
+    MOTORCAR_EAT_EXCEPTION(destroy_row(ptr), "caught unknown exception removing component");
 
     if (index != len - 1) {
         // move the component
         void* last_ptr = compute_pointer(len - 1);
-        MOTORCAR_EAT_EXCEPTION(move_from_ptr(ptr, last_ptr), "caught unknown exception moving component");
-        MOTORCAR_EAT_EXCEPTION(dtor(last_ptr), "caught unkown exception destroying moved component");
+        MOTORCAR_EAT_EXCEPTION(move_row(ptr, last_ptr), "caught unknown exception moving component");
+        MOTORCAR_EAT_EXCEPTION(destroy_row(last_ptr), "caught unkown exception destroying moved component");
 
         // update the metadata
         Entity last_e = entities[len - 1];
@@ -89,34 +151,94 @@ void ComponentStorage::remove_component(Entity e) {
     len--;
 }
 
+void ComponentStorage::invalidate_lua_views() {
+    if (lua_views.empty()) return;
+
+    make_views_stale(lua_views, component_name, "before the last rewind snapshot");
+    lua_views.clear();
+}
+
 ComponentStorage::~ComponentStorage() {
     if (blob == nullptr) return;
 
     for (size_t idx = 0; idx < len; idx++) {
-        dtor(compute_pointer(idx));
+        destroy_row(compute_pointer(idx));
     }
 
     free(blob);
 }
 
-void ECSWorld::fire_event(std::string event_name, sol::object event_payload) {
-    for (auto [event] : query<EventHandler>()) {
-        if (event->event_name == event_name) {
-            event->callback(event_payload);
+void ECSWorld::fire_event(EventId event, sol::object event_payload) {
+    for (auto [handler] : query<const EventHandler>()) {
+        if (handler->event == event) {
+            handler->callback(event_payload);
+        }
+    }
+
+    if (on_event) on_event(event, event_payload);
+}
+
+void ECSWorld::define_component(const std::string& component_name, sol::table fields) {
+    if (component_type_indices.contains(component_name)) {
+        throw std::runtime_error(std::format("can't define {}, there's already a native component by that name.", component_name));
+    }
+
+    auto schema = std::make_shared<const ComponentSchema>(component_name, fields);
+    ComponentStorage storage = ComponentStorage::create(schema, 100);
+
+    auto existing = schema_storage.find(component_name);
+    if (existing != schema_storage.end()) {
+        ComponentStorage& old_storage = existing->second;
+        const ComponentSchema& old_schema = *old_storage.schema;
+
+        // scripts run again whenever they're reloaded
+        if (old_schema.same_layout(*schema)) return;
+
+        SPDLOG_INFO("schema of component {} changed, moving {} rows over.", component_name, old_storage.len);
+        storage.reserve(old_storage.len);
+        for (size_t row = 0; row < old_storage.len; row++) {
+            schema->migrate(storage.compute_pointer(row), old_schema, old_storage.compute_pointer(row));
+        }
+        storage.len = old_storage.len;
+        storage.indices = old_storage.indices;
+        storage.entities = old_storage.entities;
+        storage.on_insert = old_storage.on_insert;
+
+        // lua can still be holding views of the old rows, in a task or a table
+        old_schema.invalidate_views();
+        schema_storage.erase(existing);
+    }
+
+    // components that were plain lua tables until now move in
+    if (lua_storage.valid() && lua_storage[component_name].get_type() == sol::type::table) {
+        sol::table components = lua_storage[component_name];
+        lua_storage[component_name] = sol::nil;
+
+        std::vector<std::pair<sol::object, sol::object>> rows;
+        components.for_each([&](sol::object key, sol::object value) {
+            rows.emplace_back(key, value);
+        });
+
+        for (auto& [key, value] : rows) {
+            if (!key.is<Entity>()) continue;
+            MOTORCAR_EAT_EXCEPTION(storage.insert_sol_object(key.as<Entity>(), value), "couldn't move a lua component into its schema.");
         }
     }
+
+    schema_storage.emplace(component_name, std::move(storage));
+    registry_version++;
 }
 
 void ECSWorld::delete_entity(Entity e) {
     ECSWorld* self = this;
 
-    for (auto [entity, parent] : this->query<Entity, Parent>())
+    for (auto [entity, parent] : this->query<Entity, const Parent>())
         if (parent->parent == e) delete_entity(entity);
 
     command_queue.push_command([=]() {
-        for (auto& [_, s] : self->native_storage) {
+        self->for_each_storage([&](ComponentStorage& s) {
             s.remove_component(e);
-        }
+        });
 
         self->lua_storage.for_each([&](sol::object, sol::object components) {
             if (components.is<sol::table>()) {
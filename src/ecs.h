@@ -4,6 +4,7 @@
 #include <any>
 #include <cstddef>
 #include <cstdlib>
+#include <format>
 #include <functional>
 #include <optional>
 #include <queue>
@@ -13,6 +14,7 @@
 #include <type_traits>
 #include <typeindex>
 #include <ranges>
+#include <span>
 
 #include <sol/sol.hpp>
 #include <utility>
@@ -21,6 +23,9 @@
 #include "types.h"
 #include "traits.h"
 #include "components.h"
+#include "snapshot.h"
+#include "schema.h"
+#include "logging.h"
 
 #define MOTORCAR_EAT_EXCEPTION(code, msg) try { code; } catch (const std::exception& e) { SPDLOG_ERROR(msg, " what(): {}", e.what()); } catch (...) { SPDLOG_ERROR(msg); }
 namespace motorcar {
@@ -33,6 +38,9 @@ namespace motorcar {
         template <typename ...T>
         friend class Query;
         friend class ECSWorld;
+        friend struct WorldSnapshot;
+        friend class LuaQuery;
+        friend class PureSystemPool;
 
         const std::string_view component_name = "";
         const std::type_info* type;
@@ -42,6 +50,19 @@ namespace motorcar {
         size_t len = 0;
         size_t stride = 0;
 
+        // moved by touch() whenever the rows are written, or handed out somewhere
+        // they could be written through: non-const get_component and queries, and
+        // lua views (lua can write through a view's methods, there's no telling
+        // a read from a write). const ones don't move it. snapshots skip columns
+        // whose version hasn't moved, see invalidate_lua_views for views lua keeps.
+        //
+        // versions come from one clock shared by every storage, so a storage
+        // made to replace another never reuses the old one's versions.
+        u64 version = next_version();
+        // only moved when rows are added or removed
+        u64 rows_version = version;
+        inline static u64 version_clock = 0;
+
         std::unordered_map<Entity, size_t> indices;
         std::vector<Entity> entities;
 
@@ -50,13 +71,52 @@ namespace motorcar {
         void (*ctor_from_sol_object)(void* dest, sol::object src) = nullptr;
         sol::object (*get_sol_object)(void*, sol::state&) = nullptr;
 
+        // snapshot support. trivially copyable components are copied as raw bytes,
+        // everything else needs a ComponentSerializer or gets left out of snapshots.
+        bool trivially_copyable = false;
+        void (*write_to_snapshot)(void* src, SnapshotWriter& writer) = nullptr;
+        void (*read_from_snapshot)(void* dest, SnapshotReader& reader) = nullptr;
+        void (*remap_entities)(void* ptr, const EntityRemap& remap) = nullptr;
+        // for components holding an absolute simulated time, moves it `secs` later
+        void (*shift_time)(void* ptr, f64 secs) = nullptr;
+
+        // set for components defined from lua. the function pointers above are
+        // null then, use the *_row helpers below instead of calling them directly.
+        std::shared_ptr<const ComponentSchema> schema;
+
+        // ComponentTypeTrait<T>::fields for native components, empty otherwise
+        std::span<const ComponentField> fields;
+
+        // called whenever a component is inserted or replaced, see ECSWorld::on_insert
+        std::function<void(Entity, void*)> on_insert;
+
+        // a lua userdata pointing at each row, made the first time the row is
+        // handed to lua. rows only move when the blob does, so they stay good until then.
+        std::vector<sol::object> lua_views;
+        void* lua_views_blob = nullptr;
+        lua_State* lua_views_state = nullptr;
+
         void* compute_pointer(size_t index) const { return (void*)((size_t)blob + (index * stride)); }
+        void touch() { version = next_version(); }
+        void touch_rows() { touch(); rows_version = version; }
+
+        void destroy_row(void* ptr) const { if (schema) schema->destroy(ptr); else dtor(ptr); }
+        void move_row(void* dest, void* src) const { if (schema) schema->move(dest, src); else move_from_ptr(dest, src); }
+        bool can_write_to_snapshot() const { return trivially_copyable || schema || write_to_snapshot != nullptr; }
+        bool can_read_from_snapshot() const { return schema || read_from_snapshot != nullptr; }
+        void write_row(void* src, SnapshotWriter& writer) const { if (schema) schema->write(src, writer); else write_to_snapshot(src, writer); }
+        void read_row(void* dest, SnapshotReader& reader) const { if (schema) schema->read(dest, reader); else read_from_snapshot(dest, reader); }
+        bool has_entities() const { return schema ? schema->has_entities : remap_entities != nullptr; }
+        void remap_row(void* ptr, const EntityRemap& remap) const { if (schema) schema->remap_entities(ptr, remap); else remap_entities(ptr, remap); }
+
         ComponentStorage(
                 const std::string_view component_name,
                 const std::type_info* type
         ) : component_name(component_name), type(type)
         {}
         public:
+            static u64 next_version() { return ++version_clock; }
+
             template <typename T>
             static ComponentStorage create(size_t initial_capacity) {
                 static_assert(ComponentTypeTrait<T>::value);
@@ -77,6 +137,36 @@ namespace motorcar {
                 result.ctor_from_sol_object = [](void* dest, sol::object src) { new ((T*)dest) T(src); };
                 result.get_sol_object = [](void* ptr, sol::state& lua) { return sol::make_object(lua, std::ref(*(T*)ptr)); };
 
+                result.fields = ComponentTypeTrait<T>::fields;
+
+                result.trivially_copyable = std::is_trivially_copyable_v<T>;
+                if constexpr (ComponentSerializer<T>::value) {
+                    result.write_to_snapshot = [](void* src, SnapshotWriter& writer) { ComponentSerializer<T>::write(writer, *(T*)src); };
+                    result.read_from_snapshot = [](void* dest, SnapshotReader& reader) { ComponentSerializer<T>::read(reader, dest); };
+                }
+                if constexpr (requires (T& t, const EntityRemap& remap) { t.remap_entities(remap); }) {
+                    result.remap_entities = [](void* ptr, const EntityRemap& remap) { ((T*)ptr)->remap_entities(remap); };
+                }
+                if constexpr (requires (T& t, f64 secs) { t.shift_time(secs); }) {
+                    result.shift_time = [](void* ptr, f64 secs) { ((T*)ptr)->shift_time(secs); };
+                }
+
+                return result;
+            }
+
+            static ComponentStorage create(std::shared_ptr<const ComponentSchema> schema, size_t initial_capacity) {
+                ComponentStorage result = ComponentStorage(schema->name, nullptr);
+
+                result.stride = schema->size;
+                result.capacity = initial_capacity;
+
+                if (result.capacity > 0) {
+                    result.blob = malloc(result.stride * result.capacity);
+                }
+
+                result.trivially_copyable = schema->trivially_copyable;
+                result.schema = std::move(schema);
+
                 return result;
             }
 
@@ -85,8 +175,11 @@ namespace motorcar {
                 assert(type == &typeid(T));
 
                 if (indices.contains(e)) {
+                    touch();
                     MOTORCAR_EAT_EXCEPTION(new (compute_pointer(indices[e])) T(std::forward<Args&&>(args)...), "caught exception when constructing component");
+                    if (on_insert) on_insert(e, compute_pointer(indices[e]));
                 } else {
+                    touch_rows();
                     if (len == capacity) {
                         expand();
                     }
@@ -95,24 +188,35 @@ namespace motorcar {
                     len++;
                     indices.emplace(e, len - 1);
                     entities.push_back(e);
+                    if (on_insert) on_insert(e, compute_pointer(len - 1));
                 }
             }
 
+            // get_component<const T> is a read, and doesn't count as a write
             template <typename T>
             std::optional<T*> get_component(Entity e) {
                 if (!indices.contains(e)) {
                     return {};
                 }
 
+                if constexpr (!std::is_const_v<T>) touch();
                 return (T*)compute_pointer(indices[e]);
             }
 
             void expand();
+            void reserve(size_t new_capacity);
+            void clear();
             void insert_sol_object(Entity e, sol::object object);
             bool has_component(Entity e);
             sol::object get_component_as_lua_object(Entity e, sol::state& lua);
+            const sol::object& get_row_as_lua_object(size_t row, sol::state& lua);
             void remove_component(Entity e);
 
+            // makes every view handed to lua so far raise an error, and forgets
+            // them. views only count as a write when they're handed out, so one
+            // lua kept past a snapshot could otherwise write without moving the version
+            void invalidate_lua_views();
+
             // maybe we'll need them, maybe we won't ¯\_(a)_/¯
             ComponentStorage(ComponentStorage&) = delete;
             ComponentStorage& operator=(ComponentStorage&) = delete;
@@ -126,6 +230,8 @@ namespace motorcar {
                 capacity = other.capacity;
                 len = other.len;
                 stride = other.stride;
+                version = other.version;
+                rows_version = other.rows_version;
 
                 indices = std::move(other.indices);
                 entities = std::move(other.entities);
@@ -135,6 +241,19 @@ namespace motorcar {
                 ctor_from_sol_object = other.ctor_from_sol_object;
                 get_sol_object = other.get_sol_object;
 
+                trivially_copyable = other.trivially_copyable;
+                write_to_snapshot = other.write_to_snapshot;
+                read_from_snapshot = other.read_from_snapshot;
+                remap_entities = other.remap_entities;
+                shift_time = other.shift_time;
+                schema = std::move(other.schema);
+                fields = other.fields;
+                on_insert = std::move(other.on_insert);
+
+                lua_views = std::move(other.lua_views);
+                lua_views_blob = other.lua_views_blob;
+                lua_views_state = other.lua_views_state;
+
                 other.blob = nullptr;
             };
             ComponentStorage& operator=(ComponentStorage&&) = delete;
@@ -244,10 +363,23 @@ namespace motorcar {
     class ECSWorld {
         template <typename ...T>
         friend class Query;
+        friend struct WorldSnapshot;
 
         // usage: lua_storage[component_name][entity] = component
         std::unordered_map<std::type_index, ComponentStorage> native_storage;
         std::unordered_map<std::string, std::type_index> component_type_indices;
+        // components defined from lua with a schema, see define_component
+        std::unordered_map<std::string, ComponentStorage> schema_storage;
+
+        // what a component id was last resolved to, redone when registry_version moves
+        struct ComponentHandle {
+            std::string name;
+            u64 resolved_version = (u64)-1;
+            ComponentStorage* storage = nullptr;
+            sol::table lua_components;
+        };
+        std::vector<ComponentHandle> component_handles;
+        std::unordered_map<std::string, u32> component_ids;
 
         Entity next_entity = 0;
 
@@ -276,14 +408,36 @@ namespace motorcar {
 
 
         public:
+            // which entities the running system should look at. systems amortized
+            // over k runs get a different 1/k of the entities each run.
+            struct Slice {
+                u32 index = 0;
+                u32 count = 1;
+
+                bool contains(Entity e) const { return count <= 1 || e % count == index; }
+            };
+
             CommandQueue command_queue;
             sol::table lua_storage;
+            Slice current_slice;
+
+            // bumped whenever a component (native or lua) is registered, so
+            // compiled queries know when to resolve their names again
+            u64 registry_version = 0;
+
+            // called after the EventHandlers whenever an event is fired
+            std::function<void(EventId, sol::object)> on_event;
             static Ocean ocean;
 
             Entity new_entity() {
                 return next_entity++;
             }
 
+            // the id new_entity will hand out next. every entity made since is at least this
+            Entity peek_next_entity() const {
+                return next_entity;
+            }
+
             template <typename T>
             void register_component() {
                 static_assert(ComponentTypeTrait<T>::value);
@@ -292,15 +446,24 @@ namespace motorcar {
                 if (!native_storage.contains(type_idx)) {
                     const std::string_view sv = ComponentTypeTrait<T>::component_name;
                     std::string key = { sv.begin(), sv.end() };
-                    if (component_type_indices.contains(key)) {
+                    if (component_type_indices.contains(key) || schema_storage.contains(key)) {
                         SPDLOG_ERROR("multiple components sharing names! aborting!");
-                        std::abort();
+                        abort_after_logging();
                     }
                     native_storage.emplace(type_idx, ComponentStorage::create<T>(100));
                     component_type_indices.emplace(key, type_idx);
+                    registry_version++;
                 }
             }
 
+            // `callback` runs right after a T is inserted into (or replaced on) an
+            // entity, while the command queue is being flushed. one per component type.
+            template <typename T>
+            void on_insert(std::function<void(Entity, T&)> callback) {
+                register_component<T>();
+                native_storage.at(typeid(T)).on_insert = [=](Entity e, void* ptr) { callback(e, *(T*)ptr); };
+            }
+
             template <typename T, typename ...Args>
             void emplace_native_component(Entity e, Args ...args) {
                 ECSWorld* self = this;
@@ -315,23 +478,144 @@ namespace motorcar {
 
             void insert_native_component_from_lua(Entity e, std::string_view component_name, sol::object object) {
                 std::string key = { component_name.begin(), component_name.end() };
-                if (!component_type_indices.contains(key)) {
+                if (get_native_storage(key) == nullptr) {
                     SPDLOG_ERROR("attempt to insert non-existent component from lua");
                     throw std::runtime_error("attempt to insert non-existent component from lua");
                 }
 
                 ECSWorld* self = this;
                 command_queue.push_command([=]() {
-                    self->native_storage.at(self->component_type_indices.at(key)).insert_sol_object(e, object);
+                    // looked up again, the component could've been redefined since
+                    if (ComponentStorage* storage = self->get_native_storage(key)) {
+                        storage->insert_sol_object(e, object);
+                    }
                 });
             }
 
-            bool native_component_exists(std::string component_name) {
-                if (!component_type_indices.contains(component_name)) {
-                    return false;
+            // a component stored natively, with the layout from `fields`
+            // ({ field = "type", ... }, see ComponentSchema). defining it again
+            // with a different schema moves the existing rows over, and a lua
+            // component with the same name is moved into it.
+            void define_component(const std::string& component_name, sol::table fields);
+
+            // returns the lua component's table, making it if it doesn't exist yet
+            sol::table register_lua_component(const std::string& component_name) {
+                sol::object components = lua_storage[component_name];
+                if (components.is<sol::table>()) {
+                    return components.as<sol::table>();
+                }
+
+                sol::table ret = sol::state_view(lua_storage.lua_state()).create_table();
+                lua_storage[component_name] = ret;
+                registry_version++;
+                return ret;
+            }
+
+            // a small integer standing in for `component_name`, for ECS.component_id.
+            // the id is good for the world's lifetime, whether or not the component exists yet
+            u32 component_id(const std::string& component_name) {
+                auto it = component_ids.find(component_name);
+                if (it != component_ids.end()) return it->second;
+
+                u32 id = component_handles.size();
+                component_handles.push_back(ComponentHandle { .name = component_name });
+                component_ids.emplace(component_name, id);
+                return id;
+            }
+
+            const std::string& component_name(u32 id) {
+                return component_handles.at(id).name;
+            }
+
+            ComponentHandle& resolve_component(u32 id) {
+                ComponentHandle& handle = component_handles.at(id);
+                if (handle.resolved_version != registry_version) {
+                    handle.storage = get_native_storage(handle.name);
+                    sol::object components = lua_storage.valid() ? lua_storage[handle.name] : sol::object(sol::lua_nil);
+                    handle.lua_components = components.is<sol::table>() ? components.as<sol::table>() : sol::table();
+                    handle.resolved_version = registry_version;
                 }
+                return handle;
+            }
+
+            // the id versions of the lua facing functions below. they skip hashing the name
+            sol::object get_component_as_lua_object(Entity e, u32 id, sol::state& lua) {
+                ComponentHandle& handle = resolve_component(id);
+                if (handle.storage != nullptr) return handle.storage->get_component_as_lua_object(e, lua);
+                if (handle.lua_components.valid()) return handle.lua_components.raw_get<sol::object>(e);
+                return sol::nil;
+            }
+
+            // an entity with the component, if any has it. for components only one entity
+            // has (e.g. a tag on a stage's score label), so scripts don't have to hold on to ids
+            std::optional<Entity> find_entity(u32 id) {
+                ComponentHandle& handle = resolve_component(id);
+                if (handle.storage != nullptr) {
+                    if (handle.storage->entities.empty()) return {};
+                    return handle.storage->entities.front();
+                }
+                if (handle.lua_components.valid()) {
+                    for (auto&& [key, _] : handle.lua_components) {
+                        if (key.is<Entity>()) return key.as<Entity>();
+                    }
+                }
+                return {};
+            }
+
+            void insert_component_from_lua(Entity e, u32 id, sol::object object) {
+                ComponentHandle& handle = resolve_component(id);
+                if (handle.storage == nullptr) {
+                    // lua components go in straight away, like ECS.insert_component does
+                    if (!handle.lua_components.valid()) register_lua_component(handle.name);
+                    resolve_component(id).lua_components.raw_set(e, object);
+                    return;
+                }
+
+                ECSWorld* self = this;
+                command_queue.push_command([=]() {
+                    if (ComponentStorage* storage = self->resolve_component(id).storage) {
+                        storage->insert_sol_object(e, object);
+                    }
+                });
+            }
+
+            void remove_component_from_lua(Entity e, u32 id) {
+                ECSWorld* self = this;
+                command_queue.push_command([=]() {
+                    ComponentHandle& handle = self->resolve_component(id);
+                    if (handle.storage != nullptr) {
+                        handle.storage->remove_component(e);
+                    } else if (handle.lua_components.valid()) {
+                        handle.lua_components.raw_set(e, sol::lua_nil);
+                    }
+                });
+            }
+
+            // null if there's no native component with that name.
+            // components defined with a schema count as native.
+            ComponentStorage* get_native_storage(const std::string& component_name) {
+                auto it = component_type_indices.find(component_name);
+                if (it != component_type_indices.end()) return &native_storage.at(it->second);
+
+                auto schema_it = schema_storage.find(component_name);
+                if (schema_it != schema_storage.end()) return &schema_it->second;
 
-                return true;
+                return nullptr;
+            }
+
+            template <typename Func>
+            void for_each_storage(const Func func) {
+                for (auto& [_, storage] : native_storage) func(storage);
+                for (auto& [_, storage] : schema_storage) func(storage);
+            }
+
+            // see ComponentStorage::invalidate_lua_views
+            void invalidate_lua_views() {
+                for_each_storage([](ComponentStorage& storage) { storage.invalidate_lua_views(); });
+            }
+
+            bool native_component_exists(std::string component_name) {
+                return get_native_storage(component_name) != nullptr;
             }
 
             template <typename T>
@@ -344,11 +628,12 @@ namespace motorcar {
             }
 
             bool entity_has_native_component(Entity e, std::string component_name) {
-                if (!component_type_indices.contains(component_name)) {
+                ComponentStorage* storage = get_native_storage(component_name);
+                if (storage == nullptr) {
                     return false;
                 }
 
-                return native_storage.at(component_type_indices.at(component_name)).has_component(e);
+                return storage->has_component(e);
             }
 
             template <typename T>
@@ -361,25 +646,29 @@ namespace motorcar {
             }
 
             sol::object get_native_component_as_lua_object(Entity e, std::string component_name, sol::state& lua) {
-                std::string key = { component_name.begin(), component_name.end() };
-                if (!component_type_indices.contains(key)) {
-                    if (lua_storage[component_name].valid()) return lua_storage[component_name][e];
-                    else return sol::nil;
+                ComponentStorage* storage = get_native_storage(component_name);
+                if (storage == nullptr) {
+                    if (!lua_storage[component_name].valid()) return sol::nil;
+                    return lua_storage[component_name][e];
                 }
 
-                return native_storage.at(component_type_indices.at(key)).get_component_as_lua_object(e, lua);
+                return storage->get_component_as_lua_object(e, lua);
             }
 
+            // const components are only read, the rest count as written (see ComponentStorage::version):
+            //   for (auto [e, transform] : world.query<Entity, const Transform>()) ...
             template <typename ...Components>
             auto query() {
                 return Query<Components...>::it(*this);
             }
 
             const std::vector<Entity>& get_entities_from_native_component_name(std::string component_name) {
-                return 
-                    native_storage.at(
-                        component_type_indices.at(component_name)
-                    ).entities;
+                ComponentStorage* storage = get_native_storage(component_name);
+                if (storage == nullptr) {
+                    throw std::out_of_range(std::format("no native component named {}", component_name));
+                }
+
+                return storage->entities;
             }
 
             template <typename T>
@@ -396,8 +685,8 @@ namespace motorcar {
                 std::string key = { component_name.begin(), component_name.end() };
                 ECSWorld* self = this;
                 command_queue.push_command([=]() {
-                    if (self->component_type_indices.contains(key)) {
-                        self->native_storage.at(self->component_type_indices.at(key)).remove_component(e);
+                    if (ComponentStorage* storage = self->get_native_storage(key)) {
+                        storage->remove_component(e);
                     }
                 });
             }
@@ -414,7 +703,8 @@ namespace motorcar {
                 }
             }
 
-            void fire_event(std::string event_name, sol::object event_payload);
+            void fire_event(std::string_view event_name, sol::object event_payload) { fire_event(event_id(event_name), event_payload); }
+            void fire_event(EventId event, sol::object event_payload);
     };
 
 
@@ -433,6 +723,7 @@ namespace motorcar {
                         });
                 } else {
                     ComponentStorage& cs = world.native_storage.at(typeid(First));
+                    if constexpr (!std::is_const_v<First>) cs.touch();
 
                     return internal<Other...>(world) |
                         std::views::filter([&](auto& p) {
@@ -454,6 +745,7 @@ namespace motorcar {
                 // using V = std::vector<Pair, Ocean::Allocator<Pair>>;
 
                 ComponentStorage& cs = world.native_storage.at(typeid(First));
+                if constexpr (!std::is_const_v<First>) cs.touch();
                 // V v(Ocean::Allocator(world.ocean));
                 Pair* pairs = Ocean::Allocator<Pair>(world.ocean).allocate(cs.len);
 
@@ -1,4 +1,6 @@
 #include "types.h"
+#include <chrono>
+#include <cmath>
 #include <unordered_set>
 #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
 
@@ -13,12 +15,23 @@
 #include "ecs.h"
 #include "components.h"
 #include "physics3d.h"
+#include "snapshot.h"
+#include "timers.h"
+#include "kernels.h"
+#include "logging.h"
 
 using namespace motorcar;
 
 namespace {
+    const f32 SIMULATION_FREQ = 60;
+    const u32 MAX_PHYSICS_STEPS = 4;
+    const f32 PHYSICS_DELTA = 1. / SIMULATION_FREQ;
+
+    // `deadline` is when low priority systems start getting put off
     template <typename SystemType>
-    void run_systems(ECSWorld& world) {
+    void run_systems(Engine& engine, f64 now, f64 deadline = INFINITY) {
+        ECSWorld& world = *engine.ecs;
+        double base_delta = engine.delta;
         auto it = world.query<System,SystemType>();
         auto v = std::vector(it.begin(), it.end());
         std::sort(v.begin(), v.end(), [](auto& l, auto& r) {
@@ -26,20 +39,48 @@ namespace {
         });
 
         for (auto [system, _] : v) {
-            if (system->callback)
-                system->callback();
+            if (!system->callback) continue;
+            bool due = system->is_due(now);
+
+            // put off without using up the call, so it's still due next frame
+            if (due && system->schedule.low_priority && glfwGetTime() > deadline &&
+                    system->deferred_frames < System::MAX_DEFERRED_FRAMES) {
+                system->deferred_frames++;
+                engine.stats.deferred_systems++;
+                continue;
+            }
+
+            system->calls++;
+            if (!due) continue;
+
+            u32 slices = std::max(system->schedule.amortize_over, 1u);
+            world.current_slice = ECSWorld::Slice { .index = (u32)(system->runs % slices), .count = slices };
+
+            // systems that skip ticks see all the time since their last run in Engine.delta.
+            // amortized ones only get to each entity every `slices` runs, so they see that many runs' worth
+            bool skips = system->schedule.every_n_ticks > 1 || system->schedule.target_hz > 0;
+            engine.delta = skips && std::isfinite(system->last_run_secs) ? now - system->last_run_secs : base_delta;
+            engine.delta *= slices;
+
+            system->runs++;
+            system->last_run_secs = now;
+            system->deferred_frames = 0;
+            system->callback();
         }
+
+        world.current_slice = {};
+        engine.delta = base_delta;
     }
 
     void update_global_transform(ECSWorld& world) {
-        std::unordered_map<Entity, Parent*> parents;
-        std::unordered_map<Entity, Transform*> transforms;
+        std::unordered_map<Entity, const Parent*> parents;
+        std::unordered_map<Entity, const Transform*> transforms;
 
-        for (auto [entity, parent] : world.query<Entity, Parent>()) parents[entity] = parent;
-        for (auto [entity, transform] : world.query<Entity, Transform>()) transforms[entity] = transform;
+        for (auto [entity, parent] : world.query<Entity, const Parent>()) parents[entity] = parent;
+        for (auto [entity, transform] : world.query<Entity, const Transform>()) transforms[entity] = transform;
 
         std::unordered_set<Entity> seen;
-        for (auto [entity, _] : world.query<Entity, Transform>()) {
+        for (auto [entity, _] : world.query<Entity, const Transform>()) {
             mat4 model = {1};
             mat3 normal = {1};
             Entity current = entity;
@@ -75,29 +116,121 @@ namespace {
         ecs.emplace_native_component<System>(e, fn, 0);
         ecs.emplace_native_component<Schedule>(e);
     }
+
+    void step_physics(Engine& engine) {
+        // as late as we can, so the step sees the newest input
+        engine.input->begin_step();
+
+        engine.delta = PHYSICS_DELTA;
+        run_systems<PhysicsSystem>(engine, engine.time_simulated_secs);
+        engine.stats.timers_fired += engine.timers->advance_to(engine.time_simulated_secs);
+        engine.stats.timers = engine.timers->size();
+
+        engine.ecs->flush_command_queue();
+        engine.input->end_step();
+        update_global_transform(*engine.ecs);
+        engine.ecs->flush_command_queue();
+
+        engine.tick++;
+        engine.time_simulated_secs += PHYSICS_DELTA;
+        if (engine.rewind) {
+            engine.rewind->capture(*engine.ecs, engine.tick, engine.time_simulated_secs, engine.timers->now_secs());
+
+            auto& ring_stats = engine.rewind->get_stats();
+            engine.stats.snapshot_capture_secs = ring_stats.last_capture_secs;
+            engine.stats.snapshot_capture_bytes = ring_stats.last_capture_bytes;
+            engine.stats.snapshot_bytes = ring_stats.bytes;
+            engine.stats.snapshot_ticks = engine.rewind->size();
+        }
+    }
 }
 
 Engine::Engine(const std::string_view& name) {
+    init_logging();
+
     resources = std::make_shared<ResourceManager>();
 
     sound = std::make_shared<SoundManager>(*this);
     ecs = std::make_shared<ECSWorld>();
+    timers = std::make_shared<TimerWheel>(PHYSICS_DELTA);
 
     scripts = std::make_shared<ScriptManager>(*this);
     physics = std::make_shared<PhysicsManager>(*this);
+    kernels = std::make_shared<KernelManager>(*this);
 
     gfx = std::make_shared<GraphicsManager>(*this, name);
     input = std::make_shared<InputManager>(*this);
 
     register_components_to_lua(scripts->lua);
     register_components_to_ecs(*ecs);
+
+    ecs->on_insert<Lifetime>([this](Entity e, Lifetime& lifetime) {
+        // restored lifetimes already know when they run out, rebased to now by WorldSnapshot::restore
+        if (std::isnan(lifetime.expires_at)) {
+            lifetime.expires_at = timers->now_secs() + lifetime.time;
+        }
+
+        lifetime.timer = timers->at(lifetime.expires_at, [this, e](TimerId id) {
+            // the lifetime might've been replaced or removed since
+            auto current = ecs->get_native_component<const Lifetime>(e);
+            if (current.has_value() && current.value()->timer == id) {
+                ecs->delete_entity(e);
+            }
+        });
+    });
 }
 
-void Engine::run() {
-    const f32 SIMULATION_FREQ = 60;
-    const u32 MAX_PHYSICS_STEPS = 4;
-    const f32 PHYSICS_DELTA = 1. / SIMULATION_FREQ;
+void Engine::enable_rewind(size_t ticks) {
+    if (ticks == 0) {
+        rewind = nullptr;
+        stats.snapshot_bytes = 0;
+        stats.snapshot_ticks = 0;
+    } else {
+        rewind = std::make_shared<SnapshotRing>(ticks);
+    }
+}
+
+bool Engine::rewind_to(u64 target_tick) {
+    if (!rewind) {
+        SPDLOG_ERROR("can't rewind, rewind isn't enabled.");
+        return false;
+    }
 
+    // the wheel goes back first, so the restored lifetimes' timers are put on
+    // it at the time they were captured at
+    if (auto wheel_secs = rewind->time_secs_at(target_tick)) {
+        timers->rebase_to(*wheel_secs);
+    }
+
+    auto restored_secs = rewind->restore(*ecs, target_tick, timers->now_secs());
+    if (!restored_secs.has_value()) return false;
+
+    tick = target_tick;
+    time_simulated_secs = restored_secs.value();
+    update_global_transform(*ecs);
+    ecs->flush_command_queue();
+    return true;
+}
+
+bool Engine::resimulate(u64 target_tick, u32 ticks) {
+    f64 resume_secs = time_simulated_secs;
+    if (!rewind_to(target_tick)) return false;
+
+    // each replayed tick runs at the simulated time it originally ran at
+    for (u32 idx = 0; idx < ticks; idx++) {
+        step_physics(*this);
+    }
+
+    // ticks that weren't replayed are skipped, not caught up on next frame.
+    // timers too. the wheel runs a tick behind, see step_physics
+    if (resume_secs > time_simulated_secs) {
+        time_simulated_secs = resume_secs;
+        timers->rebase_to(time_simulated_secs - PHYSICS_DELTA);
+    }
+    return true;
+}
+
+void Engine::run() {
     create_system<RenderSystem>(*ecs, [&]() {
         if (input->is_key_pressed_this_frame("f3")) {
             render_collision_shapes = !render_collision_shapes;
@@ -114,46 +247,79 @@ void Engine::run() {
     scripts->load_stage(stage.value());
     ecs->flush_command_queue();
 
+    auto& cache_stats = scripts->bytecode.get_stats();
+    SPDLOG_INFO("started up: {} scripts loaded, {} from cached bytecode, {:.2f}ms of parsing saved.",
+        cache_stats.loaded, cache_stats.hits, cache_stats.parse_secs_saved * 1000.);
+
     f32 lastRenderUpdateTimestamp = glfwGetTime();
     while (!gfx->window_should_close() && keep_running) {
-        next_stage = {};
-
-        // remember input state for render systems
-        InputManager::State input_state = input->state;
-
-        u32 physics_step_allowance = MAX_PHYSICS_STEPS;
-        while (glfwGetTime() > time_simulated_secs && physics_step_allowance > 0) {
-            delta = PHYSICS_DELTA;
-            if (physics_step_allowance == 0) {
-                delta = std::max(PHYSICS_DELTA, (f32)(glfwGetTime() - time_simulated_secs));
+        if (pacing_mode == PacingMode::Latency) {
+            // sleep until the next step is due. events that come in meanwhile
+            // wake us up, but they just go in the input ring
+            for (f64 now = glfwGetTime(); now < time_simulated_secs; now = glfwGetTime()) {
+                glfwWaitEventsTimeout(time_simulated_secs - now);
             }
+        }
 
-            run_systems<PhysicsSystem>(*ecs);
+        next_stage = {};
+        f64 frame_start = glfwGetTime();
+        stats.deferred_systems = 0;
+        stats.timers_fired = 0;
 
+        // hot reloads, between frames
+        if (resources->deliver_file_changes() > 0) {
             ecs->flush_command_queue();
-            input->clear_key_buffers();
-            update_global_transform(*ecs);
+        }
 
-            time_simulated_secs += PHYSICS_DELTA;
+        u32 physics_step_allowance = MAX_PHYSICS_STEPS;
+        while (glfwGetTime() > time_simulated_secs && physics_step_allowance > 0) {
+            step_physics(*this);
             physics_step_allowance--;
         }
 
         time_simulated_secs = std::max(time_simulated_secs, glfwGetTime());
 
-        // setup input for render systems
-        input->state = input_state;
+        // render systems see everything polled this frame, and whatever came
+        // in while physics was running
+        input->poll();
 
         delta = glfwGetTime() - lastRenderUpdateTimestamp;
         lastRenderUpdateTimestamp = glfwGetTime();
-        run_systems<RenderSystem>(*ecs);
+        run_systems<RenderSystem>(*this, glfwGetTime(), frame_start + frame_budget_secs);
 
         ecs->flush_command_queue();
-        input->clear_key_buffers();
-        gfx->draw(); // input->state gets updated here
+        input->end_frame();
+        gfx->draw();
+
+        auto oldest_event_time = input->take_oldest_event_time();
+        stats.input_latency_secs = oldest_event_time.has_value() ? glfwGetTime() - oldest_event_time.value() : 0.;
+
+        // collect lua garbage here, rather than whenever lua feels like it in the middle of a system
+        scripts->gc.step();
+        auto& gc_stats = scripts->gc.get_stats();
+        stats.gc_step_secs = gc_stats.step_secs;
+        stats.gc_steps = gc_stats.steps;
+        stats.gc_heap_bytes = gc_stats.heap_bytes;
+        stats.gc_collections = gc_stats.collections;
+        stats.lua_arena_bytes = scripts->allocator.get_stats().arena_bytes;
+
+        // a bit of Stages.preload's asset loading a frame
+        scripts->preloader.step(*resources);
+
+        if (pending_rewind.has_value()) {
+            auto [target_tick, ticks] = pending_rewind.value();
+            pending_rewind = {};
+            resimulate(target_tick, ticks);
+        }
 
         if (next_stage.has_value()) {
+            auto change_start = std::chrono::steady_clock::now();
+            bool preloaded = scripts->preloader.is_ready(next_stage.value());
+
             std::string& current_stage = stage.value();
-            for (auto [e, stage] : ecs->query<Entity, BoundToStage>()) {
+            timers->cancel_owned_by(current_stage);
+            resources->unwatch_files_owned_by(current_stage);
+            for (auto [e, stage] : ecs->query<Entity, const BoundToStage>()) {
                 if (stage->stage_name == current_stage) {
                     ecs->delete_entity(e);
                 }
@@ -162,9 +328,18 @@ void Engine::run() {
             stage = next_stage;
             scripts->load_stage(next_stage.value());
             ecs->flush_command_queue();
+
+            auto elapsed = std::chrono::duration<f64>(std::chrono::steady_clock::now() - change_start);
+            SPDLOG_INFO("changed stage to {} in {:.2f}ms{}.", stage.value(), elapsed.count() * 1000., preloaded ? " (preloaded)" : "");
         }
 
         update_global_transform(*ecs);
+        scripts->profiler.end_frame();
+        auto watchdog_stats = scripts->watchdog.end_frame();
+        stats.budget_trips = watchdog_stats.trips;
+        stats.systems_throttled = watchdog_stats.throttled;
+        stats.systems_disabled = watchdog_stats.disabled;
+        stats.log_messages_dropped = dropped_log_messages();
 
         // free all the memory we used this frame
         ecs->ocean.reset();
@@ -3,8 +3,14 @@
 #include <memory>
 #include <functional>
 #include <optional>
+#include <string_view>
+
+#include "types.h"
 
 namespace motorcar {
+    // bump when anything scripts could have baked in changes, e.g. cached bytecode
+    constexpr std::string_view ENGINE_VERSION = "0.1.0";
+
     class ResourceManager;
     class ECSWorld;
     class GraphicsManager;
@@ -12,6 +18,57 @@ namespace motorcar {
     class SoundManager;
     class ScriptManager;
     class PhysicsManager;
+    class SnapshotRing;
+    class TimerWheel;
+    class KernelManager;
+
+    // numbers about the last frame, for tuning. exposed to lua with Engine.stats()
+    struct EngineStats {
+        // rewind ring, see Engine::enable_rewind
+        f64 snapshot_capture_secs = 0.;
+        size_t snapshot_capture_bytes = 0;
+        size_t snapshot_bytes = 0;
+        size_t snapshot_ticks = 0;
+
+        // low priority render systems put off because the frame ran over frame_budget_secs
+        size_t deferred_systems = 0;
+
+        // timer wheel, see timers.h
+        size_t timers = 0;
+        size_t timers_fired = 0;
+
+        // bytecode cache, see bytecode.h. totals since the engine started
+        size_t scripts_cached = 0;
+        f64 script_parse_secs_saved = 0.;
+
+        // lua's garbage collector, see lua_gc.h
+        f64 gc_step_secs = 0.;
+        size_t gc_steps = 0;
+        size_t gc_heap_bytes = 0;
+        u64 gc_collections = 0; // since startup
+        size_t lua_arena_bytes = 0; // taken for lua's small blocks, see lua_alloc.h
+
+        // system budgets, see watchdog.h
+        size_t budget_trips = 0; // systems that went over this frame
+        size_t systems_throttled = 0;
+        size_t systems_disabled = 0;
+
+        // log messages rate limited or dropped from a full ring since startup, see logging.h
+        u64 log_messages_dropped = 0;
+
+        // from the oldest input event polled this frame coming in to the frame
+        // being presented. 0 when there wasn't any input
+        f64 input_latency_secs = 0.;
+    };
+
+    enum class PacingMode {
+        // render as often as we can, stepping physics when it's due
+        Throughput,
+        // wait for the next physics step to be due, then poll input and go.
+        // every frame gets a fresh step with the newest input, but the frame
+        // rate can't go over the physics rate
+        Latency,
+    };
 
     struct Engine {
         std::shared_ptr<ScriptManager> scripts;
@@ -21,14 +78,28 @@ namespace motorcar {
         std::shared_ptr<InputManager> input;
         std::shared_ptr<ECSWorld> ecs;
         std::shared_ptr<PhysicsManager> physics;
+        std::shared_ptr<KernelManager> kernels;
+        std::shared_ptr<SnapshotRing> rewind; // null until enable_rewind is called
+        std::shared_ptr<TimerWheel> timers;   // runs on simulated time
 
         std::optional<std::string> stage;
         std::optional<std::string> next_stage;
 
         double delta = 0.;
         double time_simulated_secs = 0.;
+        u64 tick = 0; // physics steps taken so far
         bool keep_running = true;
 
+        // once a frame has taken this long, low priority render systems wait for the next one
+        double frame_budget_secs = 1. / 60.;
+
+        PacingMode pacing_mode = PacingMode::Throughput;
+
+        // set to (tick, ticks to replay) to rewind at the end of the frame
+        std::optional<std::pair<u64, u32>> pending_rewind;
+
+        EngineStats stats;
+
         bool render_collision_shapes = false;
         bool render_lights = false;
 
@@ -41,5 +112,15 @@ namespace motorcar {
         Engine& operator=(Engine&&) = delete;
 
         void run();
+
+        // keep the world state of the last `ticks` physics steps around.
+        // 0 turns it back off.
+        void enable_rewind(size_t ticks);
+        // simulated time goes back with the world
+        bool rewind_to(u64 tick);
+        // rewinds to `tick`, then runs `ticks` physics steps again, each at the
+        // simulated time it first ran at. input is whatever it is right now, it
+        // isn't recorded.
+        bool resimulate(u64 tick, u32 ticks);
     };
 }
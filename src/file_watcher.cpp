@@ -0,0 +1,349 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+#include "file_watcher.h"
+
+using namespace motorcar;
+
+namespace {
+    std::string normalize(const std::filesystem::path& path) {
+        return std::filesystem::absolute(path).lexically_normal().string();
+    }
+
+#ifdef __linux__
+    const u32 WATCH_MASK = IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+    if (!started) return;
+
+    stopping = true;
+#ifdef __linux__
+    u64 one = 1;
+    ssize_t written;
+    do {
+        written = write(wake_fd, &one, sizeof(one));
+    } while (written < 0 && errno == EINTR);
+    if (written != sizeof(one)) {
+        // it still sees `stopping` after the next change to a watched file
+        SPDLOG_ERROR("couldn't wake the file watcher's thread, waiting on it anyway. errno: {}, strerror: {}", errno, strerror(errno));
+    }
+#endif
+    if (thread.joinable()) thread.join();
+
+#ifdef __linux__
+    close(epoll_fd);
+    close(wake_fd);
+    close(inotify_fd);
+#endif
+}
+
+bool FileWatcher::start() {
+#ifdef __EMSCRIPTEN__
+    // nothing to watch on the web
+    return false;
+#elif __linux__
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (inotify_fd < 0 || wake_fd < 0 || epoll_fd < 0) {
+        SPDLOG_ERROR("couldn't set up file watching, no hot reload. errno: {}, strerror: {}", errno, strerror(errno));
+        return false;
+    }
+
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.fd = inotify_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &event);
+    event.data.fd = wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+
+    thread = std::thread([this]() { run(); });
+    return true;
+#elif _WIN32
+    thread = std::thread([this]() { run(); });
+    return true;
+#else
+    #warning "No hot reload handling!"
+    return false;
+#endif
+}
+
+void FileWatcher::run() {
+#ifdef __linux__
+    epoll_event events[2];
+    alignas(inotify_event) char buffer[4096];
+
+    while (!stopping) {
+        int count = epoll_wait(epoll_fd, events, 2, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            SPDLOG_ERROR("epoll_wait failed, hot reload stopped. errno: {}, strerror: {}", errno, strerror(errno));
+            return;
+        }
+
+        for (int idx = 0; idx < count; idx++) {
+            if (events[idx].data.fd == wake_fd) return;
+        }
+
+        // drain everything inotify has, it's non blocking
+        while (true) {
+            ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+            if (length <= 0) break;
+
+            auto now = std::chrono::steady_clock::now();
+            std::lock_guard lock(mutex);
+            for (char* ptr = buffer; ptr < buffer + length;) {
+                auto* event = (inotify_event*)ptr;
+                ptr += sizeof(inotify_event) + event->len;
+
+                auto directory = wd_directories.find(event->wd);
+                if (directory == wd_directories.end()) continue;
+
+                // the directory went away. deliver() watches it again once it's back
+                if (event->mask & IN_IGNORED) {
+                    auto lost = directories.find(directory->second);
+                    if (lost != directories.end()) {
+                        lost_directories[lost->first] += lost->second.files;
+                        directories.erase(lost);
+                        has_lost = true;
+                    }
+                    wd_directories.erase(directory);
+                    continue;
+                }
+                if (event->len == 0) continue;
+
+                std::string path = (std::filesystem::path(directory->second) / event->name).string();
+                if (!watched_files.contains(path)) continue;
+
+                auto [_, inserted] = pending.insert_or_assign(path, now);
+                if (!inserted) stats.coalesced++;
+                has_pending = true;
+            }
+        }
+    }
+#else
+    // no inotify, look at every file's write time instead
+    std::unordered_map<std::string, std::filesystem::file_time_type> last_writes;
+    std::vector<std::string> paths;
+
+    while (!stopping) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+        paths.clear();
+        {
+            std::lock_guard lock(mutex);
+            for (auto& [path, _] : watched_files) paths.push_back(path);
+        }
+
+        for (auto& path : paths) {
+            std::error_code error;
+            auto last_write = std::filesystem::last_write_time(path, error);
+            // if the file was removed or is otherwise unreadable, just wait
+            if (error) continue;
+
+            auto [it, inserted] = last_writes.try_emplace(path, last_write);
+            if (inserted || it->second == last_write) continue;
+            it->second = last_write;
+
+            std::lock_guard lock(mutex);
+            if (!watched_files.contains(path)) continue;
+            auto [_, newly_pending] = pending.insert_or_assign(path, std::chrono::steady_clock::now());
+            if (!newly_pending) stats.coalesced++;
+            has_pending = true;
+        }
+    }
+#endif
+}
+
+void FileWatcher::add_path(const std::string& path) {
+    if (watched_files[path]++ > 0) return;
+
+#ifdef __linux__
+    std::string directory = std::filesystem::path(path).parent_path().string();
+    auto it = directories.find(directory);
+    if (it != directories.end()) {
+        it->second.files++;
+        return;
+    }
+
+    auto lost = lost_directories.find(directory);
+    if (lost != lost_directories.end()) {
+        lost->second++;
+        return;
+    }
+
+    int wd = inotify_add_watch(inotify_fd, directory.c_str(), WATCH_MASK);
+    if (wd < 0) {
+        SPDLOG_ERROR("inotify_add_watch on {} failed. errno: {}, strerror: {}", directory, errno, strerror(errno));
+        return;
+    }
+    directories.emplace(directory, Directory { .wd = wd, .files = 1 });
+    wd_directories.emplace(wd, directory);
+#endif
+}
+
+void FileWatcher::remove_path(const std::string& path) {
+    auto it = watched_files.find(path);
+    if (it == watched_files.end() || --it->second > 0) return;
+    watched_files.erase(it);
+    pending.erase(path);
+
+#ifdef __linux__
+    std::string directory = std::filesystem::path(path).parent_path().string();
+    auto lost = lost_directories.find(directory);
+    if (lost != lost_directories.end()) {
+        if (--lost->second == 0) lost_directories.erase(lost);
+        has_lost = !lost_directories.empty();
+        return;
+    }
+
+    auto dir = directories.find(directory);
+    if (dir == directories.end() || --dir->second.files > 0) return;
+
+    inotify_rm_watch(inotify_fd, dir->second.wd);
+    wd_directories.erase(dir->second.wd);
+    directories.erase(dir);
+#endif
+}
+
+WatchId FileWatcher::watch(const std::filesystem::path& file_path, std::function<void()> callback, std::string owner) {
+    if (!started) {
+        started = true;
+        if (!start()) stopping = true;
+    }
+
+    WatchId id = next_id++;
+    std::string path = normalize(file_path);
+    watches.emplace(id, Watch { .path = path, .callback = std::move(callback), .owner = std::move(owner) });
+
+    if (!stopping) {
+        std::lock_guard lock(mutex);
+        add_path(path);
+    }
+    return id;
+}
+
+bool FileWatcher::unwatch(WatchId id) {
+    auto it = watches.find(id);
+    if (it == watches.end()) return false;
+
+    {
+        std::lock_guard lock(mutex);
+        remove_path(it->second.path);
+    }
+    watches.erase(it);
+    return true;
+}
+
+void FileWatcher::unwatch_owned_by(std::string_view owner) {
+    std::lock_guard lock(mutex);
+    for (auto it = watches.begin(); it != watches.end();) {
+        if (it->second.owner == owner) {
+            remove_path(it->second.path);
+            it = watches.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+#ifdef __linux__
+void FileWatcher::rewatch_lost_directories() {
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<f64>(now - last_rewatch).count() < rewatch_secs) return;
+    last_rewatch = now;
+
+    std::lock_guard lock(mutex);
+    for (auto it = lost_directories.begin(); it != lost_directories.end();) {
+        const std::string& directory = it->first;
+        int wd = inotify_add_watch(inotify_fd, directory.c_str(), WATCH_MASK);
+        if (wd < 0) {
+            // still gone
+            it++;
+            continue;
+        }
+
+        SPDLOG_DEBUG("{} is back, watching it again.", directory);
+        directories.emplace(directory, Directory { .wd = wd, .files = it->second });
+        wd_directories.emplace(wd, directory);
+
+        // whatever is in it now was written while we weren't looking
+        for (auto& [path, _] : watched_files) {
+            if (std::filesystem::path(path).parent_path() == directory) {
+                pending.insert_or_assign(path, now);
+                has_pending = true;
+            }
+        }
+        it = lost_directories.erase(it);
+    }
+    has_lost = !lost_directories.empty();
+}
+#endif
+
+size_t FileWatcher::deliver() {
+#ifdef __linux__
+    if (has_lost) rewatch_lost_directories();
+#endif
+
+    // the usual frame, nothing changed, shouldn't even take the lock
+    if (!has_pending) return 0;
+
+    std::vector<std::string> settled;
+    {
+        std::lock_guard lock(mutex);
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = pending.begin(); it != pending.end();) {
+            if (std::chrono::duration<f64>(now - it->second).count() >= debounce_secs) {
+                settled.push_back(it->first);
+                it = pending.erase(it);
+            } else {
+                it++;
+            }
+        }
+        has_pending = !pending.empty();
+    }
+
+    // copied out first, callbacks are free to watch and unwatch
+    std::vector<std::function<void()>> callbacks;
+    for (auto& path : settled) {
+        for (auto& [_, watch] : watches) {
+            if (watch.path == path) callbacks.push_back(watch.callback);
+        }
+    }
+
+    for (auto& callback : callbacks) {
+        try {
+            callback();
+        } catch (const std::exception& e) {
+            SPDLOG_ERROR("file watch callback threw exception: {}", e.what());
+        } catch (...) {
+            SPDLOG_ERROR("file watch callback threw unknown exception");
+        }
+    }
+
+    stats.delivered += settled.size();
+    return settled.size();
+}
+
+FileWatcher::Stats FileWatcher::get_stats() {
+    std::lock_guard lock(mutex);
+    Stats ret = stats;
+    ret.watches = watches.size();
+#ifdef __linux__
+    ret.directories = directories.size();
+#endif
+    return ret;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "types.h"
+
+// watches files for hot reload, all of them from one thread.
+//
+// on linux that thread sleeps in epoll on a single inotify fd, which watches
+// the directories the files are in rather than the files themselves. editors
+// that save by writing a new file and renaming it over the old one still get
+// noticed that way, and a hundred scripts in one directory cost one watch.
+// elsewhere the thread checks every file's write time a few times a second.
+//
+// the thread only notes which files changed and when. the callbacks run on the
+// main thread, from deliver(), once the file has been quiet for
+// `debounce_secs`, so an editor's burst of writes turns into one reload.
+
+namespace motorcar {
+    using WatchId = u64;
+
+    class FileWatcher {
+        struct Watch {
+            std::string path;
+            std::function<void()> callback;
+            std::string owner;
+        };
+
+        f64 debounce_secs;
+
+        // main thread only
+        WatchId next_id = 1;
+        std::unordered_map<WatchId, Watch> watches;
+        bool started = false;
+
+        // everything below is shared with the watcher thread
+        std::mutex mutex;
+        std::unordered_map<std::string, size_t> watched_files; // path -> how many watches are on it
+        std::unordered_map<std::string, std::chrono::steady_clock::time_point> pending; // path -> when it last changed
+        std::atomic<bool> has_pending = false;
+        std::atomic<bool> stopping = false;
+
+#ifdef __linux__
+        int inotify_fd = -1;
+        int wake_fd = -1; // an eventfd, written to stop the thread
+        int epoll_fd = -1;
+
+        struct Directory {
+            int wd;
+            size_t files; // watched files in it
+        };
+        std::unordered_map<std::string, Directory> directories;
+        std::unordered_map<int, std::string> wd_directories;
+
+        // directories that were deleted out from under their watch (a branch
+        // switch, say) -> watched files in them. deliver() tries to watch them
+        // again every `rewatch_secs` until they come back
+        std::unordered_map<std::string, size_t> lost_directories;
+        std::atomic<bool> has_lost = false;
+        std::chrono::steady_clock::time_point last_rewatch;
+        static constexpr f64 rewatch_secs = 0.5;
+
+        void rewatch_lost_directories();
+#endif
+
+        std::thread thread;
+
+        bool start();
+        void run();
+        void add_path(const std::string& path);
+        void remove_path(const std::string& path);
+
+        public:
+            struct Stats {
+                size_t watches = 0;
+                size_t directories = 0; // inotify watches, linux only
+                size_t delivered = 0;   // changes delivered since startup
+                size_t coalesced = 0;   // changes folded into one still waiting out its debounce
+            };
+
+            FileWatcher(f64 debounce_secs = 0.1) : debounce_secs(debounce_secs) {}
+            ~FileWatcher();
+
+            // `owner` is used to remove a group of watches at once, e.g. a stage's
+            WatchId watch(const std::filesystem::path& file_path, std::function<void()> callback, std::string owner = "");
+            bool unwatch(WatchId id);
+            void unwatch_owned_by(std::string_view owner);
+
+            // runs the callbacks of files that changed and have settled down.
+            // main thread only, once a frame. returns how many files changed.
+            size_t deliver();
+
+            Stats get_stats();
+
+            FileWatcher(FileWatcher&) = delete;
+            FileWatcher& operator=(FileWatcher&) = delete;
+
+        private:
+            Stats stats;
+    };
+}
@@ -31,6 +31,7 @@
 
 #include "ecs.h"
 #include "gfx.h"
+#include "logging.h"
 #include "resources.h"
 #include "engine.h"
 #include "types.h"
@@ -442,7 +443,7 @@ namespace {
 
                         if (texture->mHeight != 0) {
                             SPDLOG_CRITICAL("TODO: uncompressed textures");
-                            std::abort();
+                            abort_after_logging();
                         }
 
                         
@@ -462,7 +463,7 @@ namespace {
                         
                     } else {
                         SPDLOG_CRITICAL("TODO: external textures");
-                        std::abort();
+                        abort_after_logging();
                     }
                 } else {
                     // TODO: untextured meshes
@@ -603,7 +604,7 @@ namespace {
                     char_uvs[i].height = rects[i].h;
                 } else {
                     SPDLOG_ERROR("rects[i].was_packed == false");
-                    std::abort();
+                    abort_after_logging();
                 }
                 free(char_bitmaps[i]);
             }
@@ -620,9 +621,9 @@ namespace {
         LightData lights[NUM_LIGHTS];
         memset(lights, 0, sizeof(lights));
         u32 idx = 0;
-        for (auto [transform, light] : engine.ecs->query<GlobalTransform, Light>()) {
-            if (idx == 8) {
-                SPDLOG_ERROR("more than 8 lights in the scene! 8 is the max number of lights");
+        for (auto [transform, light] : engine.ecs->query<const GlobalTransform, const Light>()) {
+            if (idx == NUM_LIGHTS) {
+                MOTORCAR_LOG_RATE_LIMITED(1., spdlog::level::err, "more than {} lights in the scene! {} is the max number of lights", NUM_LIGHTS, NUM_LIGHTS);
                 break;
             }
 
@@ -1161,7 +1162,7 @@ GraphicsManager::GraphicsManager(
         const char* error;
         glfwGetError(&error);
         SPDLOG_ERROR("Failed to initialize GLFW: {}", error);
-        std::abort();
+        abort_after_logging();
     }
 
     // We don't want GLFW to set up a graphics API.
@@ -1174,7 +1175,7 @@ GraphicsManager::GraphicsManager(
         glfwGetError(&error);
         glfwTerminate();
         SPDLOG_ERROR("Failed to create GLFW window: {}", error);
-        std::abort();
+        abort_after_logging();
     }
     glfwSetWindowAspectRatio(window, window_width, window_height);
     glfwSetWindowUserPointer(window, &engine);
@@ -1213,9 +1214,14 @@ GraphicsManager::GraphicsManager(
     );
 
     sol::table gltf_namespace = engine.scripts->lua["Resources"];
-    gltf_namespace.set_function("get_gltf", [&](std::string resource_path) {
+    gltf_namespace.set_function("get_gltf", sol::overload(
+        [&](ResourceHandle handle) {
+            return engine.resources->get_resource<glTFScene>(handle).value();
+        },
+        [&](std::string resource_path) {
             return engine.resources->get_resource<glTFScene>(resource_path).value();
-    });
+        }
+    ));
 }
 
 bool GraphicsManager::window_should_close() {
@@ -1264,7 +1270,7 @@ void GraphicsManager::draw_sprites(WGPUTextureView surface_texture_view, WGPUTex
     });
 
     if (entities.size() == 0) {
-        if (!warn_flag_2d) SPDLOG_WARN("no sprites! returning early!");
+        if (!warn_flag_2d) MOTORCAR_LOG_RATE_LIMITED(1., spdlog::level::warn, "no sprites! returning early!");
         warn_flag_2d = true;
         return;
     }
@@ -1368,7 +1374,7 @@ void GraphicsManager::draw_sprites(WGPUTextureView surface_texture_view, WGPUTex
 static bool warn_flag_text = false;
 void GraphicsManager::draw_text(WGPUTextureView surface_texture_view, WGPUTextureView depth_texture_view) {
     // == SETUP SPRITES
-    auto it = engine.ecs->query<Transform, Text>();
+    auto it = engine.ecs->query<const Transform, const Text>();
     auto entities = std::vector(it.begin(), it.end());
 
     if (entities.size() == 0) {
@@ -1578,8 +1584,8 @@ void GraphicsManager::draw_3d(WGPUTextureView surface_texture_view, WGPUTextureV
 
     GlobalTransform camera_transform = GlobalTransform({1}, {1});
 
-    auto camera_it = engine.ecs->query<GlobalTransform, Camera>();
-    if (!camera_it.empty()) camera_transform = *std::get<GlobalTransform*>(*camera_it.begin());
+    auto camera_it = engine.ecs->query<const GlobalTransform, const Camera>();
+    if (!camera_it.empty()) camera_transform = *std::get<const GlobalTransform*>(*camera_it.begin());
     vec3 camera_pos = camera_transform.model[3];
 
     mat4 view_matrix = glm::lookAt(
@@ -1600,7 +1606,7 @@ void GraphicsManager::draw_3d(WGPUTextureView surface_texture_view, WGPUTextureV
     u32 instance_counter = 0;
     for (auto [entity, scene, transform] : it) {
         Albedo default_albedo = vec4(1.);
-        vec4 albedo = engine.ecs->get_native_component<Albedo>(entity).value_or(&default_albedo)->color;
+        vec4 albedo = engine.ecs->get_native_component<const Albedo>(entity).value_or(&default_albedo)->color;
 
         mat4 model_matrix = transform->model;
 
@@ -1656,7 +1662,7 @@ void GraphicsManager::draw_3d(WGPUTextureView surface_texture_view, WGPUTextureV
 }
 
 void GraphicsManager::draw_colliders(WGPUTextureView surface_texture_view, WGPUTextureView depth_texture_view) {
-    auto it = engine.ecs->query<Entity, GlobalTransform, Body>();
+    auto it = engine.ecs->query<Entity, const GlobalTransform, const Body>();
 
     u32 count = 0;
     for (auto _it = it.begin(); _it != it.end(); _it++) count++;
@@ -1697,8 +1703,8 @@ void GraphicsManager::draw_colliders(WGPUTextureView surface_texture_view, WGPUT
 
     GlobalTransform camera_transform = GlobalTransform({1}, {1});
 
-    auto camera_it = engine.ecs->query<GlobalTransform, Camera>();
-    if (!camera_it.empty()) camera_transform = *std::get<GlobalTransform*>(*camera_it.begin());
+    auto camera_it = engine.ecs->query<const GlobalTransform, const Camera>();
+    if (!camera_it.empty()) camera_transform = *std::get<const GlobalTransform*>(*camera_it.begin());
 
     mat4 view_matrix = glm::lookAt(
         vec3(camera_transform.model[3]),
@@ -1774,9 +1780,9 @@ void GraphicsManager::draw_colliders(WGPUTextureView surface_texture_view, WGPUT
 
 static bool warn_flag_sprite_3d = false;
 void GraphicsManager::draw_sprite_3d(WGPUTextureView surface_texture_view, WGPUTextureView depth_texture_view) {
-    auto it = engine.ecs->query<Entity, Sprite3D, GlobalTransform>() |
+    auto it = engine.ecs->query<Entity, const Sprite3D, const GlobalTransform>() |
         std::views::filter([&](auto t) {
-            return !std::get<Sprite3D*>(t)->resource_path.empty();
+            return !std::get<const Sprite3D*>(t)->resource_path.empty();
         });
 
     if (it.begin() == it.end()) {
@@ -1821,8 +1827,8 @@ void GraphicsManager::draw_sprite_3d(WGPUTextureView surface_texture_view, WGPUT
     mat4 projection_matrix = glm::perspective(glm::radians(90.f), 16.f / 9.f, 0.1f, 1000.f);
 
     GlobalTransform camera_transform = GlobalTransform({1}, {1});
-    auto camera_it = engine.ecs->query<GlobalTransform, Camera>();
-    if (!camera_it.empty()) camera_transform = *std::get<GlobalTransform*>(*camera_it.begin());
+    auto camera_it = engine.ecs->query<const GlobalTransform, const Camera>();
+    if (!camera_it.empty()) camera_transform = *std::get<const GlobalTransform*>(*camera_it.begin());
     vec3 camera_pos = camera_transform.model[3];
     mat4 view_matrix = glm::lookAt(
         camera_pos,
@@ -1863,7 +1869,7 @@ void GraphicsManager::draw_sprite_3d(WGPUTextureView surface_texture_view, WGPUT
         Texture* texture = maybe_tex.value();
 
         Albedo default_albedo = vec4(1.);
-        vec4 albedo = engine.ecs->get_native_component<Albedo>(entity).value_or(&default_albedo)->color;
+        vec4 albedo = engine.ecs->get_native_component<const Albedo>(entity).value_or(&default_albedo)->color;
 
         mat4 model_matrix = transform->model;
         mat4 normal_matrix = transform->normal;
@@ -1915,8 +1921,6 @@ void GraphicsManager::draw_sprite_3d(WGPUTextureView surface_texture_view, WGPUT
 }
 
 void GraphicsManager::draw() {
-    glfwPollEvents();
-
     WGPUSurfaceTexture surface_texture{};
     wgpuSurfaceGetCurrentTexture( webgpu->surface, &surface_texture );
     WGPUTextureView surface_texture_view = wgpuTextureCreateView( surface_texture.texture, nullptr );
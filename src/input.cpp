@@ -15,14 +15,7 @@ const u8 InputManager::MIDDLE_CLICK;
 const u8 InputManager::SCROLL_WHEEL_DOWN;
 const u8 InputManager::SCROLL_WHEEL_UP;
 
-InputManager::InputManager(Engine& engine) 
-        : engine(engine), 
-        state(State {
-            .keys_repeated_this_frame = { 0 },
-            .keys_pressed_this_frame = { 0 },
-            .keys_released_this_frame = { 0 },
-        })
-{
+InputManager::InputManager(Engine& engine) : engine(engine) {
     glfwSetKeyCallback(engine.gfx->window, [](
             GLFWwindow* window,
             int key,
@@ -37,12 +30,7 @@ InputManager::InputManager(Engine& engine)
             return;
         }
 
-        if (action == GLFW_RELEASE) {
-            us.state.keys_released_this_frame[key] = true;
-        } else {
-            us.state.keys_repeated_this_frame[key] = true;
-            us.state.keys_pressed_this_frame[key] = action == GLFW_PRESS;
-        }
+        us.push_event(key, action);
     });
 
     glfwSetMouseButtonCallback(engine.gfx->window, [](
@@ -65,14 +53,11 @@ InputManager::InputManager(Engine& engine)
             case GLFW_MOUSE_BUTTON_MIDDLE:
                 key = MIDDLE_CLICK;
                 break;
+            default:
+                return;
         }
 
-        if (action == GLFW_RELEASE) {
-            us.state.keys_released_this_frame[key] = true;
-        } else {
-            us.state.keys_repeated_this_frame[key] = true;
-            us.state.keys_pressed_this_frame[key] = action == GLFW_PRESS;
-        }
+        us.push_event(key, action);
     });
 
     glfwSetScrollCallback(engine.gfx->window, [](
@@ -85,34 +70,107 @@ InputManager::InputManager(Engine& engine)
 
 
         u8 key = yoffset < 0 ? SCROLL_WHEEL_DOWN : SCROLL_WHEEL_UP;
-        us.state.keys_pressed_this_frame[key] = true;
+        us.push_event(key, GLFW_PRESS);
     });
 }
 
-void InputManager::clear_key_buffers() {
-    this->state.keys_repeated_this_frame.fill(false);
-    this->state.keys_pressed_this_frame.fill(false);
-    this->state.keys_released_this_frame.fill(false);
+void InputManager::Edges::clear() {
+    repeated.reset();
+    pressed.reset();
+    released.reset();
+    mouse_motion = vec2(0);
+}
+
+void InputManager::push_event(int key, int action) {
+    // a full ring means a lot of input in one poll. hand what's there over
+    // early rather than lose any of it
+    if (events_size == EVENT_QUEUE_SIZE) {
+        apply_events();
+    }
+
+    events[(events_head + events_size) % EVENT_QUEUE_SIZE] = Event {
+        .key = key,
+        .action = action,
+        .time = glfwGetTime(),
+    };
+    events_size++;
+}
+
+void InputManager::apply_events() {
+    for (; events_size > 0; events_size--) {
+        Event& event = events[events_head];
+        events_head = (events_head + 1) % EVENT_QUEUE_SIZE;
+
+        if (!oldest_event_time.has_value()) {
+            oldest_event_time = event.time;
+        }
+
+        for (Edges* e : { &state.step, &state.frame }) {
+            if (event.key == SCROLL_WHEEL_DOWN || event.key == SCROLL_WHEEL_UP) {
+                // the wheel is never held
+                e->pressed.set(event.key);
+            } else if (event.action == GLFW_RELEASE) {
+                e->released.set(event.key);
+            } else {
+                e->repeated.set(event.key);
+                if (event.action == GLFW_PRESS) e->pressed.set(event.key);
+            }
+        }
+
+        if (event.key != SCROLL_WHEEL_DOWN && event.key != SCROLL_WHEEL_UP) {
+            state.held.set(event.key, event.action != GLFW_RELEASE);
+        }
+    }
+}
+
+void InputManager::poll() {
+    glfwPollEvents();
+    apply_events();
 
     double x, y;
     glfwGetCursorPos(engine.gfx->window, &x, &y);
     vec2 v = vec2((f32)x, (f32)y);
 
-    state.mouse_motion = v - state.last_mouse_position;
+    vec2 motion = v - state.last_mouse_position;
+    state.step.mouse_motion += motion;
+    state.frame.mouse_motion += motion;
     state.last_mouse_position = v;
 }
 
+void InputManager::begin_step() {
+    poll();
+    edges = &state.step;
+}
+
+// edges polled outside of a step (before the render systems, say) stay around
+// for the next one, so physics doesn't miss a press
+void InputManager::end_step() {
+    state.step.clear();
+    edges = &state.frame;
+}
+
+void InputManager::end_frame() {
+    state.frame.clear();
+}
+
+std::optional<f64> InputManager::take_oldest_event_time() {
+    auto ret = oldest_event_time;
+    oldest_event_time = {};
+    return ret;
+}
+
+// as of the last poll, so a physics step sees the same thing all the way through
 bool InputManager::is_key_held_down(Key k) const {
-    return glfwGetKey(engine.gfx->window, k.keycode) != GLFW_RELEASE;
+    return state.held[k.keycode];
 }
 bool InputManager::is_key_pressed_this_frame(Key k) const {
-    return this->state.keys_pressed_this_frame[k.keycode];
+    return edges->pressed[k.keycode];
 }
 bool InputManager::is_key_repeated_this_frame(Key k) const {
-    return this->state.keys_repeated_this_frame[k.keycode];
+    return edges->repeated[k.keycode];
 }
 bool InputManager::is_key_released_this_frame(Key k) const {
-    return this->state.keys_released_this_frame[k.keycode];
+    return edges->released[k.keycode];
 }
 vec2 InputManager::get_mouse_position() const {
     double x, y;
@@ -120,7 +178,7 @@ vec2 InputManager::get_mouse_position() const {
     return vec2((f32)x, (f32)y);
 }
 vec2 InputManager::get_mouse_motion_this_frame() const {
-    return state.mouse_motion;
+    return edges->mouse_motion;
 }
 
 void InputManager::lock_mouse() {
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <array>
+#include <bitset>
 #include <format>
+#include <optional>
 #include <ranges>
 #include "GLFW/glfw3.h"
 #include "types.h"
@@ -38,22 +40,55 @@ namespace motorcar {
 
     // TODO: controller input
     // TODO: input action abstraction
+    //
+    // glfw's callbacks only put events in a ring, stamped with when they got to
+    // us. poll() hands them over to the key state, so the physics steps poll
+    // right before they run and see input as it is then, not as it was at the
+    // end of the last frame. render systems see everything polled this frame.
     class InputManager {
         friend class GraphicsManager;
         friend struct Engine;
 
+        using Keys = std::bitset<GLFW_KEY_LAST + 1>;
+
+        struct Event {
+            int key;
+            int action;
+            f64 time;
+        };
+
+        // what changed since the last clear
+        struct Edges {
+            Keys repeated;
+            Keys pressed;
+            Keys released;
+            vec2 mouse_motion = vec2(0);
+
+            void clear();
+        };
+
         struct State {
-            std::array<bool, GLFW_KEY_LAST + 1> keys_repeated_this_frame;
-            std::array<bool, GLFW_KEY_LAST + 1> keys_pressed_this_frame;
-            std::array<bool, GLFW_KEY_LAST + 1> keys_released_this_frame;
+            Keys held;
+            Edges step;  // since the physics step started
+            Edges frame; // since the frame started
             vec2 last_mouse_position = vec2(0);
-            vec2 mouse_motion = vec2(0);
         };
 
+        static const size_t EVENT_QUEUE_SIZE = 256;
+
         Engine& engine;
         State state;
+        // which edges is_key_pressed_this_frame and friends look at
+        const Edges* edges = &state.frame;
 
-        void clear_key_buffers();
+        std::array<Event, EVENT_QUEUE_SIZE> events;
+        size_t events_head = 0;
+        size_t events_size = 0;
+        // the oldest event polled since the last present, see take_oldest_event_time
+        std::optional<f64> oldest_event_time;
+
+        void push_event(int key, int action);
+        void apply_events();
         
     public:
         static const u8 LEFT_CLICK = 163;
@@ -64,6 +99,17 @@ namespace motorcar {
 
         InputManager(Engine& engine);
 
+        // the engine's frame loop drives these
+        //
+        // picks up the latest events
+        void poll();
+        // physics steps see only their own edges
+        void begin_step();
+        void end_step();
+        void end_frame();
+        // when the oldest event polled since the last call came in, empty if none did
+        std::optional<f64> take_oldest_event_time();
+
         bool is_key_held_down(Key k) const;
         bool is_key_pressed_this_frame(Key k) const;
         bool is_key_repeated_this_frame(Key k) const;
@@ -0,0 +1,368 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <format>
+
+#include <spdlog/spdlog.h>
+
+#include "kernels.h"
+#include "engine.h"
+#include "scripts.h"
+#include "ecs.h"
+
+using namespace motorcar;
+
+namespace {
+    const Entity NO_TARGET = -1;
+
+    template <typename T>
+    T read(sol::table table, const char* key, T fallback) {
+        sol::object value = table[key];
+        if (!value.valid()) return fallback;
+        if (!value.is<T>()) {
+            throw std::runtime_error(std::format("kernel parameter '{}' has the wrong type", key));
+        }
+        return value.as<T>();
+    }
+
+    vec3 read_axis(sol::table table, const char* key, vec3 fallback) {
+        sol::object value = table[key];
+        if (!value.valid()) return fallback;
+
+        if (value.is<vec3>()) {
+            vec3 axis = value.as<vec3>();
+            if (glm::length(axis) < 1e-6f) {
+                throw std::runtime_error(std::format("kernel parameter '{}' can't be a zero vector", key));
+            }
+            return glm::normalize(axis);
+        }
+        if (value.get_type() == sol::type::string) {
+            std::string name = value.as<std::string>();
+            if (name == "x") return vec3(1, 0, 0);
+            if (name == "y") return vec3(0, 1, 0);
+            if (name == "z") return vec3(0, 0, 1);
+        }
+        throw std::runtime_error(std::format("kernel parameter '{}' should be \"x\", \"y\", \"z\" or a vec3", key));
+    }
+
+    // a kernel from a table of parameters, or a copy of one
+    template <typename Kernel, typename Parse>
+    Kernel from_lua(sol::object object, const char* name, const Parse parse) {
+        if (object.is<Kernel>()) return object.as<Kernel>();
+        if (object.get_type() == sol::type::table) {
+            Kernel ret;
+            parse(ret, object.as<sol::table>());
+            return ret;
+        }
+        throw std::runtime_error(std::format("object is not convertible to {}", name));
+    }
+
+    void remap_target(Entity& e, const EntityRemap& remap) {
+        if (e != NO_TARGET && remap.contains(e)) e = remap.at(e);
+    }
+
+    // turns `rotation` around y so `forward` points along `direction`, flattened onto the ground
+    void face_along(quat& rotation, vec3 forward, vec3 direction) {
+        if (direction.x * direction.x + direction.z * direction.z < 1e-12f) return;
+
+        f32 yaw = std::atan2(direction.x, direction.z) - std::atan2(forward.x, forward.z);
+        rotation = glm::angleAxis(yaw, vec3(0, 1, 0));
+    }
+
+    bool wants_facing(vec3 face) {
+        return face != vec3(0);
+    }
+
+    // a unit vector perpendicular to `axis`, where orbits start at angle 0
+    vec3 orbit_start(vec3 axis) {
+        vec3 other = std::abs(axis.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 0, 1);
+        return glm::normalize(glm::cross(other, axis));
+    }
+
+    // where `target` is, if it's still around
+    bool target_position(ECSWorld& ecs, Entity target, vec3& out) {
+        if (target == NO_TARGET) return false;
+
+        auto gt = ecs.get_native_component<const GlobalTransform>(target);
+        if (!gt.has_value()) return false;
+
+        out = gt.value()->position();
+        return true;
+    }
+}
+
+Patrol::Patrol(sol::object object) {
+    *this = from_lua<Patrol>(object, "Patrol", [](Patrol& k, sol::table t) {
+        k.axis = read_axis(t, "axis", k.axis);
+        sol::optional<f32> min = t["min"];
+        sol::optional<f32> max = t["max"];
+        if (!min.has_value() || !max.has_value() || min.value() > max.value()) {
+            throw std::runtime_error("patrol needs a min and a max, with min <= max");
+        }
+        k.min = min.value();
+        k.max = max.value();
+        k.speed = read<f32>(t, "speed", k.speed);
+        k.face = read<vec3>(t, "face", k.face);
+    });
+}
+
+LookAt::LookAt(sol::object object) {
+    *this = from_lua<LookAt>(object, "LookAt", [](LookAt& k, sol::table t) {
+        k.target = read<Entity>(t, "target", NO_TARGET);
+        k.point = read<vec3>(t, "point", k.point);
+        k.forward = read_axis(t, "forward", k.forward);
+        k.yaw_only = read<bool>(t, "yaw_only", k.yaw_only);
+    });
+}
+void LookAt::remap_entities(const EntityRemap& remap) { remap_target(target, remap); }
+
+Follow::Follow(sol::object object) {
+    *this = from_lua<Follow>(object, "Follow", [](Follow& k, sol::table t) {
+        sol::optional<Entity> target = t["target"];
+        if (!target.has_value()) {
+            throw std::runtime_error("follow needs a target");
+        }
+        k.target = target.value();
+        k.speed = read<f32>(t, "speed", k.speed);
+        k.stop_distance = read<f32>(t, "stop_distance", k.stop_distance);
+        k.face = read<vec3>(t, "face", k.face);
+    });
+}
+void Follow::remap_entities(const EntityRemap& remap) { remap_target(target, remap); }
+
+Orbit::Orbit(sol::object object) {
+    *this = from_lua<Orbit>(object, "Orbit", [](Orbit& k, sol::table t) {
+        k.target = read<Entity>(t, "target", NO_TARGET);
+        k.center = read<vec3>(t, "center", k.center);
+        k.axis = read_axis(t, "axis", k.axis);
+        k.radius = read<f32>(t, "radius", k.radius);
+        k.speed = read<f32>(t, "speed", k.speed);
+        k.angle = read<f32>(t, "angle", k.angle);
+        k.face = read<vec3>(t, "face", k.face);
+    });
+}
+void Orbit::remap_entities(const EntityRemap& remap) { remap_target(target, remap); }
+
+KernelManager::KernelManager(Engine& engine) : engine(engine) {
+    sol::state& lua = engine.scripts->lua;
+
+    lua.new_usertype<Patrol>("Patrol", sol::constructors<Patrol(sol::object)>(),
+        "axis", &Patrol::axis,
+        "min", &Patrol::min,
+        "max", &Patrol::max,
+        "speed", &Patrol::speed,
+        "face", &Patrol::face,
+        "direction", &Patrol::direction
+    );
+    lua.new_usertype<LookAt>("LookAt", sol::constructors<LookAt(sol::object)>(),
+        "target", &LookAt::target,
+        "point", &LookAt::point,
+        "forward", &LookAt::forward,
+        "yaw_only", &LookAt::yaw_only
+    );
+    lua.new_usertype<Follow>("Follow", sol::constructors<Follow(sol::object)>(),
+        "target", &Follow::target,
+        "speed", &Follow::speed,
+        "stop_distance", &Follow::stop_distance,
+        "face", &Follow::face
+    );
+    lua.new_usertype<Orbit>("Orbit", sol::constructors<Orbit(sol::object)>(),
+        "target", &Orbit::target,
+        "center", &Orbit::center,
+        "axis", &Orbit::axis,
+        "radius", &Orbit::radius,
+        "speed", &Orbit::speed,
+        "angle", &Orbit::angle,
+        "face", &Orbit::face
+    );
+    bind_native_fields<Patrol>(lua);
+    bind_native_fields<LookAt>(lua);
+    bind_native_fields<Follow>(lua);
+    bind_native_fields<Orbit>(lua);
+
+    engine.ecs->register_component<Patrol>();
+    engine.ecs->register_component<LookAt>();
+    engine.ecs->register_component<Follow>();
+    engine.ecs->register_component<Orbit>();
+    engine.ecs->register_component<KernelBinding>();
+
+    Entity kernel_system = engine.ecs->new_entity();
+    engine.ecs->emplace_native_component<PhysicsSystem>(kernel_system);
+    engine.ecs->emplace_native_component<System>(kernel_system, [this]() {
+        run(this->engine.delta);
+    }, 0);
+}
+
+std::function<void(Entity)> KernelManager::attacher(const std::string& kernel, sol::table params) {
+    ECSWorld* ecs = engine.ecs.get();
+
+    // parsed once here, so a bad parameter errors in the script that asked for it
+    if (kernel == "patrol") {
+        Patrol k = Patrol(params);
+        return [=](Entity e) { ecs->emplace_native_component<Patrol>(e, k); };
+    } else if (kernel == "look_at") {
+        LookAt k = LookAt(params);
+        return [=](Entity e) { ecs->emplace_native_component<LookAt>(e, k); };
+    } else if (kernel == "follow") {
+        Follow k = Follow(params);
+        return [=](Entity e) { ecs->emplace_native_component<Follow>(e, k); };
+    } else if (kernel == "orbit") {
+        Orbit k = Orbit(params);
+        return [=](Entity e) { ecs->emplace_native_component<Orbit>(e, k); };
+    }
+
+    throw std::runtime_error(std::format("no kernel named '{}'. there's patrol, look_at, follow and orbit.", kernel));
+}
+
+void KernelManager::attach_bound_kernels() {
+    ECSWorld& ecs = *engine.ecs;
+
+    for (auto [binding] : ecs.query<const KernelBinding>()) {
+        if (binding->resolved_version != ecs.registry_version) {
+            binding->kernel_storage = ecs.get_native_storage(binding->kernel);
+            binding->on_storages.clear();
+            for (const std::string& name : binding->on) {
+                ComponentStorage* storage = ecs.get_native_storage(name);
+                // they might not all exist yet
+                if (storage == nullptr) {
+                    binding->on_storages.clear();
+                    break;
+                }
+                binding->on_storages.push_back(storage);
+            }
+            binding->resolved_version = ecs.registry_version;
+            binding->rows_version = (u64)-1;
+        }
+
+        ComponentStorage* kernel = binding->kernel_storage;
+        if (kernel == nullptr || binding->on_storages.empty()) continue;
+
+        auto newest_rows = [&]() {
+            u64 ret = kernel->rows_version;
+            for (ComponentStorage* storage : binding->on_storages) ret = std::max(ret, storage->rows_version);
+            return ret;
+        };
+        if (newest_rows() == binding->rows_version) continue;
+
+        // drive with the smallest of `on`
+        ComponentStorage* smallest = binding->on_storages.front();
+        for (ComponentStorage* storage : binding->on_storages) {
+            if (storage->len < smallest->len) smallest = storage;
+        }
+
+        // attaching adds rows to `kernel`, not `smallest`, so this is safe to walk
+        for (Entity e : smallest->entities) {
+            if (kernel->has_component(e)) continue;
+
+            bool matches = std::ranges::all_of(binding->on_storages, [&](ComponentStorage* storage) {
+                return storage->has_component(e);
+            });
+            if (matches) binding->attach(e);
+        }
+
+        // including the rows just attached
+        binding->rows_version = newest_rows();
+    }
+}
+
+// gathers up to CHUNK (transform, kernel) rows at a time and hands them to `func`
+template <typename Kernel, typename Func>
+void KernelManager::run_chunked(const Func func) {
+    std::array<Transform*, CHUNK> transforms;
+    std::array<Kernel*, CHUNK> kernels;
+    size_t n = 0;
+
+    for (auto [transform, kernel] : engine.ecs->query<Transform, Kernel>()) {
+        transforms[n] = transform;
+        kernels[n] = kernel;
+        if (++n == CHUNK) {
+            func(transforms.data(), kernels.data(), n);
+            n = 0;
+        }
+    }
+    if (n > 0) func(transforms.data(), kernels.data(), n);
+}
+
+void KernelManager::run(f32 delta) {
+    ECSWorld& ecs = *engine.ecs;
+    attach_bound_kernels();
+
+    run_chunked<Patrol>([&](Transform** transforms, Patrol** kernels, size_t n) {
+        for (size_t idx = 0; idx < n; idx++) {
+            Transform& t = *transforms[idx];
+            Patrol& k = *kernels[idx];
+
+            f32 along = glm::dot(t.position, k.axis);
+            if (along >= k.max) k.direction = -1;
+            else if (along <= k.min) k.direction = 1;
+
+            t.position += k.axis * (k.direction * k.speed * delta);
+            if (wants_facing(k.face)) face_along(t.rotation, k.face, k.axis * k.direction);
+        }
+    });
+
+    run_chunked<LookAt>([&](Transform** transforms, LookAt** kernels, size_t n) {
+        std::array<vec3, CHUNK> targets;
+        for (size_t idx = 0; idx < n; idx++) {
+            LookAt& k = *kernels[idx];
+            if (!target_position(ecs, k.target, targets[idx])) targets[idx] = k.point;
+        }
+
+        for (size_t idx = 0; idx < n; idx++) {
+            Transform& t = *transforms[idx];
+            LookAt& k = *kernels[idx];
+
+            vec3 direction = targets[idx] - t.position;
+            if (glm::length(direction) < 1e-6f) continue;
+
+            if (k.yaw_only) face_along(t.rotation, k.forward, direction);
+            else t.rotation = glm::rotation(k.forward, glm::normalize(direction));
+        }
+    });
+
+    run_chunked<Follow>([&](Transform** transforms, Follow** kernels, size_t n) {
+        std::array<vec3, CHUNK> targets;
+        std::array<bool, CHUNK> found;
+        for (size_t idx = 0; idx < n; idx++) {
+            found[idx] = target_position(ecs, kernels[idx]->target, targets[idx]);
+        }
+
+        for (size_t idx = 0; idx < n; idx++) {
+            if (!found[idx]) continue;
+            Transform& t = *transforms[idx];
+            Follow& k = *kernels[idx];
+
+            vec3 offset = targets[idx] - t.position;
+            f32 distance = glm::length(offset);
+            if (distance <= k.stop_distance || distance < 1e-6f) continue;
+
+            vec3 direction = offset / distance;
+            t.position += direction * std::min(k.speed * delta, distance - k.stop_distance);
+            if (wants_facing(k.face)) face_along(t.rotation, k.face, direction);
+        }
+    });
+
+    run_chunked<Orbit>([&](Transform** transforms, Orbit** kernels, size_t n) {
+        std::array<vec3, CHUNK> centers;
+        for (size_t idx = 0; idx < n; idx++) {
+            Orbit& k = *kernels[idx];
+            if (!target_position(ecs, k.target, centers[idx])) centers[idx] = k.center;
+        }
+
+        for (size_t idx = 0; idx < n; idx++) {
+            Transform& t = *transforms[idx];
+            Orbit& k = *kernels[idx];
+
+            k.angle = std::fmod(k.angle + k.speed * delta, glm::two_pi<f32>());
+            vec3 offset = glm::angleAxis(k.angle, k.axis) * (orbit_start(k.axis) * k.radius);
+            t.position = centers[idx] + offset;
+
+            if (wants_facing(k.face)) {
+                vec3 direction = glm::cross(k.axis, offset) * (k.speed < 0 ? -1.f : 1.f);
+                face_along(t.rotation, k.face, direction);
+            }
+        }
+    });
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "components.h"
+
+// native behaviour kernels. the per entity logic every game ends up writing in
+// lua (walk back and forth, turn towards something, chase something, circle
+// something) as components that one native system runs over every tick.
+//
+// scripts either insert the component themselves:
+//   ECS.insert_component(e, "patrol", { axis = "z", min = -20, max = 20, speed = 3 })
+// or have it put on every entity with some components, now and later:
+//   ECS.use_kernel("patrol", { on = { "enemy" }, axis = "z", min = -20, max = 20, speed = 3, face = vec3.new(1, 0, 0) })
+//
+// kernels move and turn the entity's Transform, so they're meant for entities
+// without a parent. targets are followed through their GlobalTransform.
+//
+// `face` is the direction the entity's model looks in when it isn't rotated.
+// when it's given, the kernel turns the entity (around y) to look where it's going.
+
+namespace motorcar {
+    struct Engine;
+    class ComponentStorage;
+
+    // walks along `axis` between `min` and `max`, turning around at either end
+    //   axis = "x" | "y" | "z" | vec3, min, max, speed = 1, face = vec3
+    struct Patrol {
+        vec3 axis = vec3(1, 0, 0);
+        f32 min = 0;
+        f32 max = 0;
+        f32 speed = 1;
+        vec3 face = vec3(0);
+        f32 direction = 1; // 1 towards max, -1 towards min
+
+        Patrol() {}
+        Patrol(sol::object object);
+    };
+    COMPONENT_TYPE_TRAIT_WITH_FIELDS(Patrol, "patrol",
+        COMPONENT_FIELD(axis),
+        COMPONENT_FIELD(min),
+        COMPONENT_FIELD(max),
+        COMPONENT_FIELD(speed),
+        COMPONENT_FIELD(face),
+        COMPONENT_FIELD(direction)
+    );
+
+    // turns to look at an entity or a point
+    //   target = entity | point = vec3, forward = vec3(0, 0, -1), yaw_only = false
+    struct LookAt {
+        Entity target = -1;
+        vec3 point = vec3(0);
+        vec3 forward = vec3(0, 0, -1);
+        bool yaw_only = false;
+
+        LookAt() {}
+        LookAt(sol::object object);
+        void remap_entities(const EntityRemap& remap);
+    };
+    COMPONENT_TYPE_TRAIT_WITH_FIELDS(LookAt, "look_at",
+        COMPONENT_FIELD(target),
+        COMPONENT_FIELD(point),
+        COMPONENT_FIELD(forward),
+        COMPONENT_FIELD(yaw_only)
+    );
+
+    // moves towards an entity until it's within `stop_distance`
+    //   target = entity, speed = 1, stop_distance = 0, face = vec3
+    struct Follow {
+        Entity target = -1;
+        f32 speed = 1;
+        f32 stop_distance = 0;
+        vec3 face = vec3(0);
+
+        Follow() {}
+        Follow(sol::object object);
+        void remap_entities(const EntityRemap& remap);
+    };
+    COMPONENT_TYPE_TRAIT_WITH_FIELDS(Follow, "follow",
+        COMPONENT_FIELD(target),
+        COMPONENT_FIELD(speed),
+        COMPONENT_FIELD(stop_distance),
+        COMPONENT_FIELD(face)
+    );
+
+    // circles around an entity or a point
+    //   target = entity | center = vec3, radius = 1, speed = 1 (radians a second),
+    //   axis = vec3(0, 1, 0), angle = 0, face = vec3
+    struct Orbit {
+        Entity target = -1;
+        vec3 center = vec3(0);
+        vec3 axis = vec3(0, 1, 0);
+        f32 radius = 1;
+        f32 speed = 1;
+        f32 angle = 0;
+        vec3 face = vec3(0);
+
+        Orbit() {}
+        Orbit(sol::object object);
+        void remap_entities(const EntityRemap& remap);
+    };
+    COMPONENT_TYPE_TRAIT_WITH_FIELDS(Orbit, "orbit",
+        COMPONENT_FIELD(target),
+        COMPONENT_FIELD(center),
+        COMPONENT_FIELD(axis),
+        COMPONENT_FIELD(radius),
+        COMPONENT_FIELD(speed),
+        COMPONENT_FIELD(angle),
+        COMPONENT_FIELD(face)
+    );
+
+    // made by ECS.use_kernel. puts a kernel on every entity with all of `on`
+    // that doesn't have it yet. deleting its entity stops that, but leaves the
+    // kernels it already put on alone.
+    struct KernelBinding {
+        std::vector<std::string> on;
+        std::string kernel;
+        std::function<void(Entity)> attach;
+
+        // KernelManager's, so it doesn't look the storages up by name every tick.
+        // redone when ECSWorld::registry_version moves
+        mutable u64 resolved_version = (u64)-1;
+        mutable ComponentStorage* kernel_storage = nullptr;
+        mutable std::vector<ComponentStorage*> on_storages; // empty if one of `on` doesn't exist yet
+        // the newest rows_version of those storages at the last look. nothing
+        // to attach to until an entity gains or loses one of them
+        mutable u64 rows_version = (u64)-1;
+
+        KernelBinding(std::vector<std::string> on, std::string kernel, std::function<void(Entity)> attach) :
+            on(std::move(on)), kernel(std::move(kernel)), attach(std::move(attach)) {}
+        NOT_LUA_CONSTRUCTABLE(KernelBinding)
+    };
+    COMPONENT_TYPE_TRAIT(KernelBinding, "::kernel_binding");
+
+    class KernelManager {
+        // kernels run over this many entities at a time. a chunk's rows (and
+        // its targets' positions) are gathered into flat arrays on the stack
+        // first, then the math runs over those
+        static const size_t CHUNK = 256;
+
+        Engine& engine;
+
+        void attach_bound_kernels();
+        template <typename Kernel, typename Func>
+        void run_chunked(const Func func);
+
+        public:
+            KernelManager(Engine& engine);
+
+            // puts the kernel named `kernel`, made from `params`, on an entity.
+            // throws if there's no such kernel or the params are bad
+            std::function<void(Entity)> attacher(const std::string& kernel, sol::table params);
+
+            // runs every kernel once, `delta` seconds forward
+            void run(f32 delta);
+    };
+}
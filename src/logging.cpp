@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <format>
+#include <memory>
+
+#include <spdlog/async.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "logging.h"
+
+using namespace motorcar;
+
+namespace {
+    std::atomic<u64> rate_limited = 0;
+}
+
+void motorcar::init_logging() {
+    static bool initialized = false;
+    if (initialized) return;
+    initialized = true;
+
+    spdlog::init_thread_pool(LOG_QUEUE_SIZE, 1);
+    auto sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+    // unnamed like spdlog's own default logger, so the output looks the same
+    auto logger = std::make_shared<spdlog::async_logger>(
+        "", sink, spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest
+    );
+
+    logger->set_level(spdlog::get_level());
+    logger->flush_on(spdlog::level::err);
+    spdlog::set_default_logger(logger);
+}
+
+u64 motorcar::dropped_log_messages() {
+    u64 overrun = 0;
+    if (auto pool = spdlog::thread_pool()) {
+        overrun = pool->overrun_counter();
+    }
+    return rate_limited.load(std::memory_order_relaxed) + overrun;
+}
+
+void motorcar::abort_after_logging() {
+    spdlog::shutdown();
+    std::abort();
+}
+
+LogRateLimit::LogRateLimit(f64 per_sec, f64 burst) :
+    per_sec(per_sec), burst(burst), tokens(burst), last(std::chrono::steady_clock::now())
+{}
+
+bool LogRateLimit::allow(u64& dropped_since) {
+    auto now = std::chrono::steady_clock::now();
+    tokens = std::min(burst, tokens + std::chrono::duration<f64>(now - last).count() * per_sec);
+    last = now;
+
+    if (tokens < 1.) {
+        dropped++;
+        rate_limited.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    tokens -= 1.;
+    dropped_since = dropped;
+    dropped = 0;
+    return true;
+}
+
+std::string motorcar::dropped_note(u64 dropped) {
+    if (dropped == 0) return "";
+    return std::format(" ({} more like this dropped)", dropped);
+}
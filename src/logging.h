@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+#include "types.h"
+
+// the engine logs through spdlog's async logger. the frame only formats the
+// message and puts it in a ring of LOG_QUEUE_SIZE messages, a thread of its own
+// does the writing. if the ring fills up the oldest messages get dropped, the
+// frame never waits on the terminal.
+//
+// things that can go wrong every frame should log through
+// MOTORCAR_LOG_RATE_LIMITED, so they don't flood the ring either.
+
+namespace motorcar {
+    const size_t LOG_QUEUE_SIZE = 8192;
+
+    // swaps spdlog's default logger for the async one, keeping its level.
+    // the engine calls this, calling it again does nothing
+    void init_logging();
+
+    // messages dropped so far, by rate limits or for overrunning the ring
+    u64 dropped_log_messages();
+
+    // the message saying why would otherwise still be in the ring when the
+    // process dies. drains it (spdlog::shutdown waits for the logging thread), then aborts
+    [[noreturn]] void abort_after_logging();
+
+    // a token bucket: `per_sec` messages a second on average, up to `burst` at
+    // once. not thread safe, the macro below keeps one per thread
+    class LogRateLimit {
+        f64 per_sec;
+        f64 burst;
+        f64 tokens;
+        std::chrono::steady_clock::time_point last;
+        u64 dropped = 0;
+
+        public:
+            LogRateLimit(f64 per_sec, f64 burst = 1.);
+
+            // whether this message gets through. if it does, `dropped_since` is
+            // how many didn't since the last one that did
+            bool allow(u64& dropped_since);
+    };
+
+    // "" or " (n more like this dropped)"
+    std::string dropped_note(u64 dropped);
+}
+
+// logs at most `per_sec` times a second from this call site (per thread). the
+// level's checked first, so it's free when that level is off:
+//   MOTORCAR_LOG_RATE_LIMITED(1., spdlog::level::err, "more than {} lights!", NUM_LIGHTS);
+#define MOTORCAR_LOG_RATE_LIMITED(per_sec, level, fmt, ...) do { \
+        if (!spdlog::should_log(level)) break; \
+        static thread_local ::motorcar::LogRateLimit _motorcar_rate_limit(per_sec); \
+        ::motorcar::u64 _motorcar_dropped = 0; \
+        if (_motorcar_rate_limit.allow(_motorcar_dropped)) { \
+            SPDLOG_LOGGER_CALL(spdlog::default_logger_raw(), level, fmt "{}" __VA_OPT__(,) __VA_ARGS__, ::motorcar::dropped_note(_motorcar_dropped)); \
+        } \
+    } while (0)
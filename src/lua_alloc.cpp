@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "lua_alloc.h"
+
+using namespace motorcar;
+
+namespace {
+    // 1 to 16 bytes is class 0, 17 to 32 class 1 and so on
+    size_t size_class_of(size_t size) {
+        return (size - 1) / 16;
+    }
+}
+
+LuaAllocator::LuaAllocator() {
+    owner("engine");
+}
+
+LuaAllocator::~LuaAllocator() {
+    for (void* page : pages) {
+        std::free(page);
+    }
+}
+
+void* LuaAllocator::allocate_small(size_t size_class) {
+    FreeBlock* block = free_lists[size_class];
+    if (block != nullptr) {
+        free_lists[size_class] = block->next;
+        return block;
+    }
+
+    size_t size = (size_class + 1) * GRANULARITY;
+    if (page_top + size > page_end) {
+        // whatever's left of the old page is too small for this class. it's
+        // at most MAX_SMALL bytes, so it's just left there
+        void* page = std::malloc(PAGE_SIZE);
+        if (page == nullptr) return nullptr;
+
+        pages.push_back(page);
+        page_top = (u8*)page;
+        page_end = page_top + PAGE_SIZE;
+    }
+
+    void* ret = page_top;
+    page_top += size;
+    return ret;
+}
+
+void LuaAllocator::free_small(void* ptr, size_t size_class) {
+    FreeBlock* block = (FreeBlock*)ptr;
+    block->next = free_lists[size_class];
+    free_lists[size_class] = block;
+}
+
+void* LuaAllocator::reallocate(void* ptr, size_t old_size, size_t new_size) {
+    bool was_small = ptr != nullptr && old_size <= MAX_SMALL;
+    bool is_small = new_size <= MAX_SMALL;
+
+    if (new_size == 0) {
+        if (ptr == nullptr) return nullptr;
+        if (was_small) free_small(ptr, size_class_of(old_size));
+        else std::free(ptr);
+        return nullptr;
+    }
+
+    if (ptr == nullptr) {
+        return is_small ? allocate_small(size_class_of(new_size)) : std::malloc(new_size);
+    }
+
+    if (was_small && is_small && size_class_of(old_size) == size_class_of(new_size)) return ptr;
+    if (!was_small && !is_small) return std::realloc(ptr, new_size);
+
+    // moving between a size class and the system allocator, or between size classes
+    void* ret = is_small ? allocate_small(size_class_of(new_size)) : std::malloc(new_size);
+    if (ret == nullptr) {
+        // lua counts on shrinking never failing. the block is big enough already,
+        // and freeing it later into a smaller class only wastes the difference
+        if (new_size <= old_size) return ptr;
+        // otherwise lua keeps the old block, so it mustn't be freed
+        return nullptr;
+    }
+
+    std::memcpy(ret, ptr, std::min(old_size, new_size));
+    if (was_small) free_small(ptr, size_class_of(old_size));
+    else std::free(ptr);
+    return ret;
+}
+
+void* LuaAllocator::allocate(void* user_data, void* ptr, size_t old_size, size_t new_size) {
+    LuaAllocator& allocator = *(LuaAllocator*)user_data;
+
+    // without a block, old_size is the kind of object lua's making, not a size
+    if (ptr == nullptr) old_size = 0;
+
+    void* ret = allocator.reallocate(ptr, old_size, new_size);
+    if (ret == nullptr && new_size > 0) return nullptr;
+
+    allocator.live_bytes += new_size;
+    allocator.live_bytes -= old_size;
+
+    if (new_size > old_size) {
+        Owner& owner = allocator.owners[allocator.current];
+        owner.allocations++;
+        owner.bytes += new_size - old_size;
+    }
+    return ret;
+}
+
+LuaAllocator* LuaAllocator::of(lua_State* L) {
+    void* user_data = nullptr;
+    if (lua_getallocf(L, &user_data) != &LuaAllocator::allocate) return nullptr;
+    return (LuaAllocator*)user_data;
+}
+
+u32 LuaAllocator::owner(std::string_view name) {
+    std::string key { name };
+    auto it = owner_ids.find(key);
+    if (it != owner_ids.end()) return it->second;
+
+    u32 ret = owners.size();
+    owners.push_back(Owner { .name = key });
+    owner_ids.emplace(std::move(key), ret);
+    return ret;
+}
+
+std::vector<LuaAllocator::OwnerReport> LuaAllocator::report() const {
+    std::vector<OwnerReport> ret;
+    for (auto& owner : owners) {
+        if (owner.allocations == 0) continue;
+        ret.push_back(OwnerReport { .name = owner.name, .allocations = owner.allocations, .bytes = owner.bytes });
+    }
+    std::sort(ret.begin(), ret.end(), [](auto& l, auto& r) { return l.bytes > r.bytes; });
+    return ret;
+}
+
+void LuaAllocator::reset_report() {
+    for (auto& owner : owners) {
+        owner.allocations = 0;
+        owner.bytes = 0;
+    }
+}
+
+LuaAllocator::Stats LuaAllocator::get_stats() const {
+    return Stats { .live_bytes = live_bytes, .arena_bytes = pages.size() * PAGE_SIZE };
+}
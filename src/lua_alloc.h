@@ -0,0 +1,109 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include "types.h"
+
+// the allocator behind the engine's lua state.
+//
+// lua makes a lot of small blocks (tables, closures, strings, userdata) and
+// frees them again a frame later. blocks up to MAX_SMALL bytes come from free
+// lists, one per 16 byte size class, refilled from big pages the allocator
+// carves up and keeps for as long as the lua state lives. anything bigger
+// goes to the system allocator, lua frees and resizes those one at a time.
+//
+// lua always tells the allocator how big a block it's freeing is, so blocks
+// don't need a header.
+//
+// every allocation is also counted against an owner, the script or system
+// running when it happened (see Scope), so it's easy to see what's churning
+// memory. allocations made while nothing is running go to "engine".
+
+namespace motorcar {
+    class LuaAllocator {
+        static const size_t GRANULARITY = 16;
+        static const size_t MAX_SMALL = 512;
+        static const size_t CLASSES = MAX_SMALL / GRANULARITY;
+        static const size_t PAGE_SIZE = 64 * 1024;
+
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+        std::array<FreeBlock*, CLASSES> free_lists {};
+        std::vector<void*> pages;
+        u8* page_top = nullptr;
+        u8* page_end = nullptr;
+
+        struct Owner {
+            std::string name;
+            u64 allocations = 0;
+            u64 bytes = 0;
+        };
+        std::vector<Owner> owners;
+        std::unordered_map<std::string, u32> owner_ids;
+        u32 current = 0;
+
+        size_t live_bytes = 0;
+
+        void* allocate_small(size_t size_class);
+        void free_small(void* ptr, size_t size_class);
+        void* reallocate(void* ptr, size_t old_size, size_t new_size);
+
+        public:
+            struct OwnerReport {
+                std::string_view name;
+                u64 allocations;
+                u64 bytes;
+            };
+
+            struct Stats {
+                size_t live_bytes = 0;  // what lua has right now
+                size_t arena_bytes = 0; // pages taken for small blocks
+            };
+
+            // makes `owner` the one allocations are counted against until it goes away
+            class Scope {
+                LuaAllocator* allocator;
+                u32 previous = 0;
+
+                public:
+                    Scope(LuaAllocator* allocator, u32 owner) : allocator(allocator) {
+                        if (allocator) previous = std::exchange(allocator->current, owner);
+                    }
+                    ~Scope() {
+                        if (allocator) allocator->current = previous;
+                    }
+
+                    Scope(Scope&) = delete;
+                    Scope& operator=(Scope&) = delete;
+            };
+
+            LuaAllocator();
+            ~LuaAllocator();
+
+            // for sol::state's constructor, with `this`
+            static void* allocate(void* user_data, void* ptr, size_t old_size, size_t new_size);
+            // the allocator behind a lua state, if it's one of these
+            static LuaAllocator* of(lua_State* L);
+
+            // the owner id for a script or system, to hand to Scope
+            u32 owner(std::string_view name);
+
+            // owners that allocated anything, most bytes first
+            std::vector<OwnerReport> report() const;
+            void reset_report();
+
+            Stats get_stats() const;
+
+            LuaAllocator(LuaAllocator&) = delete;
+            LuaAllocator& operator=(LuaAllocator&) = delete;
+    };
+}
@@ -0,0 +1,122 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include <chrono>
+
+#include <spdlog/spdlog.h>
+
+#include "lua_gc.h"
+
+using namespace motorcar;
+
+namespace {
+    // lua's own defaults are a pause of 200, a step multiplier of 100 and
+    // a minor multiplier of 20. the automatic collector waits longer than that,
+    // the engine's stepping starts at about the default
+    const int INCREMENTAL_PAUSE = 300;
+    const int INCREMENTAL_STEPMUL = 200;
+    const int INCREMENTAL_STEPSIZE = 13; // log2 of bytes, 8kb
+    const u32 INCREMENTAL_STEP_PAUSE = 100;
+
+    const int GENERATIONAL_MINORMUL = 40;
+    const int GENERATIONAL_MAJORMUL = 100;
+    const u32 GENERATIONAL_STEP_PAUSE = 20;
+
+    void push_sentinel(lua_State* L, int counter_index);
+
+    int on_sentinel_collected(lua_State* L) {
+        (*(u64*)lua_touserdata(L, lua_upvalueindex(1)))++;
+
+        lua_pushvalue(L, lua_upvalueindex(1));
+        push_sentinel(L, lua_gettop(L));
+        lua_pop(L, 2);
+        return 0;
+    }
+
+    // leaves the sentinel on the stack. nothing else holds on to it, so it
+    // only lives until the next collection
+    void push_sentinel(lua_State* L, int counter_index) {
+        lua_newtable(L);
+        lua_newtable(L);
+        lua_pushvalue(L, counter_index);
+        lua_pushcclosure(L, on_sentinel_collected, 1);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+    }
+}
+
+LuaGc::LuaGc(sol::state& lua) : L(lua.lua_state()) {
+    // the counter is a userdata so it lives exactly as long as the lua state
+    // does. the sentinel's finalizer still runs once more when it's closed
+    collections = (u64*)lua_newuserdatauv(L, sizeof(u64), 0);
+    *collections = 0;
+    push_sentinel(L, lua_gettop(L));
+    lua_pop(L, 1);
+    luaL_ref(L, LUA_REGISTRYINDEX);
+
+    set_mode(Mode::Incremental);
+}
+
+size_t LuaGc::heap_bytes() const {
+    return (size_t)lua_gc(L, LUA_GCCOUNT) * 1024 + lua_gc(L, LUA_GCCOUNTB);
+}
+
+void LuaGc::set_mode(Mode mode) {
+    this->mode = mode;
+    switch (mode) {
+        case Mode::Incremental:
+            lua_gc(L, LUA_GCINC, INCREMENTAL_PAUSE, INCREMENTAL_STEPMUL, INCREMENTAL_STEPSIZE);
+            step_pause = INCREMENTAL_STEP_PAUSE;
+            break;
+        case Mode::Generational:
+            lua_gc(L, LUA_GCGEN, GENERATIONAL_MINORMUL, GENERATIONAL_MAJORMUL);
+            step_pause = GENERATIONAL_STEP_PAUSE;
+            break;
+    }
+    collecting = false;
+    heap_after_collection = heap_bytes();
+}
+
+std::optional<LuaGc::Mode> LuaGc::mode_from_string(std::string_view name) {
+    if (name == "incremental") return Mode::Incremental;
+    if (name == "generational") return Mode::Generational;
+    return {};
+}
+
+void LuaGc::step() {
+    auto start = std::chrono::steady_clock::now();
+    stats.steps = 0;
+
+    // lua might've finished a collection on its own since the last frame
+    if (*collections != collections_seen) {
+        collections_seen = *collections;
+        collecting = false;
+        heap_after_collection = heap_bytes();
+    }
+
+    if (!collecting && heap_bytes() * 100 < heap_after_collection * (100 + step_pause)) {
+        stats.step_secs = 0.;
+        stats.heap_bytes = heap_bytes();
+        stats.collections = *collections;
+        return;
+    }
+
+    collecting = true;
+    f64 elapsed = 0.;
+    do {
+        // a young collection in generational mode, a basic step otherwise
+        bool finished = lua_gc(L, LUA_GCSTEP, 0);
+        stats.steps++;
+
+        if (finished || mode == Mode::Generational || *collections != collections_seen) {
+            collecting = false;
+            collections_seen = *collections;
+            heap_after_collection = heap_bytes();
+            break;
+        }
+
+        elapsed = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < budget_secs);
+
+    stats.step_secs = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+    stats.heap_bytes = heap_bytes();
+    stats.collections = *collections;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+#include <sol/sol.hpp>
+
+#include "types.h"
+
+// the engine's say in when lua collects garbage.
+//
+// left alone, lua collects whenever enough allocation debt piles up, which is
+// usually in the middle of some render system. instead, the automatic
+// collector is tuned to kick in late, and the engine steps the collector
+// itself once a frame, after drawing, for at most `budget_secs`. the stepping
+// starts a bit before the automatic collector would, so most of the work ends
+// up in between frames and the automatic collector is only a backstop.
+//
+// collections are counted with a sentinel object whose finalizer makes the
+// next sentinel, so the count includes the ones lua did on its own.
+
+namespace motorcar {
+    class LuaGc {
+        public:
+            enum class Mode { Incremental, Generational };
+
+            struct Stats {
+                f64 step_secs = 0.;  // spent stepping the collector this frame
+                size_t steps = 0;    // collector steps this frame
+                size_t heap_bytes = 0;
+                u64 collections = 0; // finished cycles (or young collections) since startup, automatic ones too
+            };
+
+        private:
+            lua_State* L;
+            Mode mode = Mode::Incremental;
+            // how far over the heap after the last collection to let it get
+            // before stepping, in percent. under the automatic collector's pause
+            u32 step_pause = 0;
+
+            u64* collections; // bumped by the sentinel's finalizer
+            u64 collections_seen = 0;
+            size_t heap_after_collection = 0;
+            bool collecting = false;
+
+            Stats stats;
+
+            size_t heap_bytes() const;
+
+        public:
+            // most of a frame the collector can have
+            f64 budget_secs = 0.001;
+
+            LuaGc(sol::state& lua);
+
+            void set_mode(Mode mode);
+            Mode get_mode() const { return mode; }
+            static std::optional<Mode> mode_from_string(std::string_view name);
+
+            // once a frame
+            void step();
+
+            const Stats& get_stats() const { return stats; }
+    };
+}
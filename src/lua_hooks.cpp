@@ -0,0 +1,55 @@
+#include <algorithm>
+
+#include "lua_hooks.h"
+
+using namespace motorcar;
+
+namespace {
+    // the registry key the hooks are kept under, for the hook to find them
+    const char HOOKS_KEY = 0;
+}
+
+LuaHooks::LuaHooks(sol::state& lua) : L(lua.lua_state()) {
+    lua_pushlightuserdata(L, this);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &HOOKS_KEY);
+}
+
+void LuaHooks::hook(lua_State* L, lua_Debug*) {
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &HOOKS_KEY);
+    auto* self = (LuaHooks*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (self == nullptr) return;
+
+    for (auto& slot : self->slots) {
+        if (slot.every == 0) continue;
+
+        slot.elapsed += self->count;
+        if (slot.elapsed >= slot.every) {
+            slot.elapsed = 0;
+            slot.callback(slot.self, L);
+        }
+    }
+}
+
+void LuaHooks::install() {
+    count = 0;
+    for (auto& slot : slots) {
+        if (slot.every != 0) count = count == 0 ? slot.every : std::min(count, slot.every);
+    }
+
+    if (count == 0) {
+        lua_sethook(L, nullptr, 0, 0);
+    } else {
+        lua_sethook(L, hook, LUA_MASKCOUNT, count);
+    }
+}
+
+void LuaHooks::set(Client client, u32 every, Callback callback, void* self) {
+    slots[client] = Slot { .every = std::max(every, 1u), .elapsed = 0, .callback = callback, .self = self };
+    install();
+}
+
+void LuaHooks::clear(Client client) {
+    slots[client] = {};
+    install();
+}
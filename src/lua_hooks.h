@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+
+#include <sol/sol.hpp>
+
+#include "types.h"
+
+// lua has one hook per state, and both the profiler and the system watchdog
+// want a count hook. this owns the hook and calls each of them every however
+// many instructions they asked for. with nobody asking, there's no hook at all.
+
+namespace motorcar {
+    class LuaHooks {
+        public:
+            enum Client { Profiler, Watchdog, CLIENTS };
+            // may raise a lua error, in which case the clients after it miss this hook
+            using Callback = void (*)(void* self, lua_State* L);
+
+        private:
+            struct Slot {
+                u32 every = 0; // 0 when the client isn't using the hook
+                u32 elapsed = 0;
+                Callback callback = nullptr;
+                void* self = nullptr;
+            };
+
+            lua_State* L;
+            std::array<Slot, CLIENTS> slots;
+            u32 count = 0; // instructions between hook calls, the smallest `every`
+
+            static void hook(lua_State* L, lua_Debug* ar);
+            void install();
+
+        public:
+            LuaHooks(sol::state& lua);
+
+            void set(Client client, u32 every, Callback callback, void* self);
+            void clear(Client client);
+    };
+}
@@ -0,0 +1,721 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <spdlog/spdlog.h>
+
+#include "lua_query.h"
+#include "ecs.h"
+#include "components.h"
+
+using namespace motorcar;
+
+namespace {
+    // positions come from GlobalTransform, falling back to Transform
+    vec3 position_of(ECSWorld& ecs, Entity e) {
+        if (auto global_transform = ecs.get_native_component<const GlobalTransform>(e)) {
+            return global_transform.value()->position();
+        }
+        if (auto transform = ecs.get_native_component<const Transform>(e)) {
+            return transform.value()->position;
+        }
+        return vec3(NAN);
+    }
+
+    std::vector<std::string> read_names(sol::table components, const char* key) {
+        std::vector<std::string> ret;
+        sol::optional<sol::table> names = components.get<sol::optional<sol::table>>(key);
+        if (!names.has_value()) return ret;
+
+        for (size_t idx = 1; idx <= names->size(); idx++) {
+            ret.push_back(names.value()[idx].get<std::string>());
+        }
+        return ret;
+    }
+}
+
+LuaQuery::LuaQuery(sol::table components) {
+    if (!components.valid()) {
+        throw std::runtime_error("query not specified.");
+    }
+
+    for (size_t idx = 1; idx <= components.size(); idx++) {
+        component_names.push_back(components[idx].get<std::string>());
+    }
+
+    with_names = read_names(components, "with");
+    without_names = read_names(components, "without");
+
+    sol::optional<sol::table> where = components.get<sol::optional<sol::table>>("where");
+    for (size_t idx = 1; where.has_value() && idx <= where->size(); idx++) {
+        sol::table t = where.value()[idx].get<sol::table>();
+        std::string subject = t[1].get<std::string>();
+        std::string op = t[2].get<std::string>();
+
+        Filter filter { .op = Filter::Op::Equal };
+        size_t dot = subject.find('.');
+        filter.component = subject.substr(0, dot);
+        if (dot != std::string::npos) filter.field = subject.substr(dot + 1);
+        filter.value = t[3];
+        filter.high = t[4];
+
+        if (op == "==") filter.op = Filter::Op::Equal;
+        else if (op == "~=") filter.op = Filter::Op::NotEqual;
+        else if (op == "<") filter.op = Filter::Op::Less;
+        else if (op == "<=") filter.op = Filter::Op::LessEqual;
+        else if (op == ">") filter.op = Filter::Op::Greater;
+        else if (op == ">=") filter.op = Filter::Op::GreaterEqual;
+        else if (op == "between") filter.op = Filter::Op::Between;
+        else if (op == "within") filter.op = Filter::Op::Within;
+        else throw std::runtime_error(std::format("unknown filter operator {}.", op));
+
+        if (filter.op == Filter::Op::Within) {
+            if (subject != "position" || !filter.value.is<vec3>() || !filter.high.is<f32>()) {
+                throw std::runtime_error("distance filters look like { \"position\", \"within\", point, radius }.");
+            }
+            filter.point = filter.value.as<vec3>();
+            filter.radius = filter.high.as<f32>();
+        } else if (filter.op == Filter::Op::Between && !(filter.value.get_type() == sol::type::number && filter.high.get_type() == sol::type::number)) {
+            throw std::runtime_error("between takes two numbers.");
+        }
+
+        if (filter.value.get_type() == sol::type::number) filter.number = filter.value.as<f64>();
+        if (filter.value.get_type() == sol::type::boolean) filter.number = filter.value.as<bool>() ? 1 : 0;
+        if (filter.value.get_type() == sol::type::string) filter.string = filter.value.as<std::string>();
+        if (filter.high.get_type() == sol::type::number) filter.number_high = filter.high.as<f64>();
+
+        filters.push_back(std::move(filter));
+    }
+
+    // are entity only queries desirable?
+    if (component_names.size() == 1 && component_names[0] == "entity") {
+        // TODO: is throwing bad here?
+        throw std::runtime_error("component list of just 'entity' not supported.");
+    }
+}
+
+// copies only the names and the plan, not the scratch state
+LuaQuery::LuaQuery(const LuaQuery& other) :
+    component_names(other.component_names),
+    with_names(other.with_names),
+    without_names(other.without_names),
+    filters(other.filters),
+    terms(other.terms),
+    excluded(other.excluded),
+    compiled_version(other.compiled_version),
+    compiled_ok(other.compiled_ok),
+    reuse_arguments(other.reuse_arguments)
+{
+    for (Term& term : terms) term.column = sol::table();
+}
+
+void LuaQuery::compile(sol::state& lua, ECSWorld& ecs) {
+    terms.clear();
+    excluded.clear();
+    compiled_ok = true;
+    compiled_version = ecs.registry_version;
+
+    auto resolve = [&](const std::string& name) {
+        Term term { .kind = Term::Kind::Missing, .name = name, .key = sol::make_object(lua, name) };
+        if (ComponentStorage* storage = ecs.get_native_storage(name)) {
+            term.kind = Term::Kind::Native;
+            term.storage = storage;
+        } else if (sol::object components = ecs.lua_storage[name]; components.is<sol::table>()) {
+            term.kind = Term::Kind::Lua;
+            term.components = components.as<sol::table>();
+        }
+        return term;
+    };
+
+    // nothing can have a component that doesn't exist, so those are just left out
+    for (auto& name : without_names) {
+        Term term = resolve(name);
+        if (term.kind != Term::Kind::Missing) excluded.push_back(term);
+    }
+
+    for (Filter& filter : filters) {
+        filter.path = filter.op == Filter::Op::Within ? Filter::Path::Position : Filter::Path::Lua;
+        filter.storage = nullptr;
+        filter.schema_field = nullptr;
+        filter.components = sol::table();
+        if (filter.path == Filter::Path::Position) continue;
+
+        Term term = resolve(filter.component);
+        filter.storage = term.storage;
+        filter.components = term.components;
+        if (filter.storage == nullptr || !filter.storage->schema || filter.field.empty()) continue;
+
+        // fields with a schema, compared against a constant of the right type, skip lua
+        for (const ComponentSchema::Field& field : filter.storage->schema->fields) {
+            if (field.name != filter.field) continue;
+
+            bool is_string = field.type == ComponentSchema::Type::String;
+            bool is_vector = field.type == ComponentSchema::Type::Vec2 || field.type == ComponentSchema::Type::Vec3 || field.type == ComponentSchema::Type::Quat;
+            sol::type constant = filter.value.get_type();
+
+            if (is_string && constant == sol::type::string && filter.op != Filter::Op::Between) {
+                filter.path = Filter::Path::String;
+            } else if (!is_string && !is_vector && (constant == sol::type::number || constant == sol::type::boolean)) {
+                filter.path = Filter::Path::Number;
+            }
+            filter.schema_field = &field;
+        }
+    }
+    // the cheap ones first
+    std::stable_sort(filters.begin(), filters.end(), [](const Filter& l, const Filter& r) {
+        return l.path != Filter::Path::Lua && r.path == Filter::Path::Lua;
+    });
+
+    auto all_names = component_names;
+    all_names.insert(all_names.end(), with_names.begin(), with_names.end());
+    for (size_t idx = 0; idx < all_names.size(); idx++) {
+        const std::string& name = all_names[idx];
+        Term term = resolve(name);
+        term.bound = idx < component_names.size();
+
+        if (name == "entity") {
+            term.kind = Term::Kind::Entity;
+        } else if (term.kind == Term::Kind::Missing) {
+            // nothing can match until it's registered, which recompiles us
+            SPDLOG_WARN("requested component {} doesn't exist in ECS.", name);
+            compiled_ok = false;
+        }
+
+        terms.push_back(term);
+    }
+}
+
+bool LuaQuery::find_matches(sol::state& lua, ECSWorld& ecs, bool sliced) {
+    matched.clear();
+
+    if (compiled_version != ecs.registry_version) {
+        compile(lua, ecs);
+    }
+    if (!compiled_ok) return false;
+
+    // the smallest native storage drives the loop. lua tables don't know their
+    // size, so one of those only drives when there's nothing else.
+    Term* driver = nullptr;
+    for (Term& term : terms) {
+        if (term.kind == Term::Kind::Native && (driver == nullptr || term.storage->len < driver->storage->len)) {
+            driver = &term;
+        }
+    }
+    if (driver == nullptr) {
+        for (Term& term : terms) {
+            if (term.kind == Term::Kind::Lua) {
+                driver = &term;
+                break;
+            }
+        }
+    }
+
+    // native probes are a hash lookup, lua probes are a table lookup through
+    // the lua api. cheap ones and the ones most likely to fail go first.
+    probes.clear();
+    for (Term& term : terms) {
+        if (&term != driver && term.kind != Term::Kind::Entity) probes.push_back(&term);
+    }
+    std::sort(probes.begin(), probes.end(), [](Term* l, Term* r) {
+        if (l->kind != r->kind) return l->kind == Term::Kind::Native;
+        if (l->kind == Term::Kind::Native) return l->storage->len < r->storage->len;
+        return false;
+    });
+
+    bool slicing = sliced && ecs.current_slice.count > 1;
+    auto passes = [&](Entity e) {
+        if (slicing && !ecs.current_slice.contains(e)) return false;
+
+        for (Term* probe : probes) {
+            if (probe->kind == Term::Kind::Native) {
+                if (!probe->storage->indices.contains(e)) return false;
+            } else if (!probe->components.raw_get<sol::object>(e).valid()) {
+                return false;
+            }
+        }
+        for (Term& term : excluded) {
+            if (term.kind == Term::Kind::Native) {
+                if (term.storage->indices.contains(e)) return false;
+            } else if (term.components.raw_get<sol::object>(e).valid()) {
+                return false;
+            }
+        }
+        for (const Filter& filter : filters) {
+            if (!test(lua, ecs, filter, e)) return false;
+        }
+        return true;
+    };
+
+    // collected up front. lua components can be inserted while we're running callbacks
+    if (driver->kind == Term::Kind::Native) {
+        for (Entity e : driver->storage->entities) {
+            if (passes(e)) matched.push_back(e);
+        }
+    } else {
+        driver->components.for_each([&](sol::object key, sol::object) {
+            if (!key.is<Entity>()) return;
+
+            Entity e = key.as<Entity>();
+            if (passes(e)) matched.push_back(e);
+        });
+    }
+
+    return true;
+}
+
+bool LuaQuery::compare_numbers(Filter::Op op, f64 a, f64 b, f64 high) {
+    using Op = Filter::Op;
+    switch (op) {
+        case Op::Equal: return a == b;
+        case Op::NotEqual: return a != b;
+        case Op::Less: return a < b;
+        case Op::LessEqual: return a <= b;
+        case Op::Greater: return a > b;
+        case Op::GreaterEqual: return a >= b;
+        case Op::Between: return a >= b && a <= high;
+        case Op::Within: return false;
+    }
+    return false;
+}
+
+bool LuaQuery::test(sol::state& lua, ECSWorld& ecs, const Filter& filter, Entity e) {
+    switch (filter.path) {
+        case Filter::Path::Position: {
+            vec3 d = position_of(ecs, e) - filter.point;
+            // written so NaN (no transform) fails
+            return glm::dot(d, d) <= filter.radius * filter.radius;
+        }
+        case Filter::Path::Number:
+        case Filter::Path::String: {
+            auto it = filter.storage->indices.find(e);
+            if (it == filter.storage->indices.end()) return filter.op == Filter::Op::NotEqual;
+
+            void* ptr = (void*)((size_t)filter.storage->compute_pointer(it->second) + filter.schema_field->offset);
+            if (filter.path == Filter::Path::String) {
+                auto order = *(std::string*)ptr <=> filter.string;
+                return compare_numbers(filter.op, order < 0 ? -1 : order > 0 ? 1 : 0, 0, 0);
+            }
+
+            f64 value = 0;
+            switch (filter.schema_field->type) {
+                case ComponentSchema::Type::F32: value = *(f32*)ptr; break;
+                case ComponentSchema::Type::F64: value = *(f64*)ptr; break;
+                case ComponentSchema::Type::I32: value = *(i32*)ptr; break;
+                case ComponentSchema::Type::I64: value = (f64)*(i64*)ptr; break;
+                case ComponentSchema::Type::Entity: value = (f64)*(Entity*)ptr; break;
+                case ComponentSchema::Type::Bool: value = *(bool*)ptr ? 1 : 0; break;
+                default: return false;
+            }
+            return compare_numbers(filter.op, value, filter.number, filter.number_high);
+        }
+        case Filter::Path::Lua:
+            return test_lua(lua, filter, e);
+    }
+    return false;
+}
+
+bool LuaQuery::test_lua(sol::state& lua, const Filter& filter, Entity e) {
+    lua_State* L = lua.lua_state();
+    int top = lua_gettop(L);
+
+    // the component, or nil
+    if (filter.storage != nullptr) {
+        auto it = filter.storage->indices.find(e);
+        if (it == filter.storage->indices.end()) lua_pushnil(L);
+        else filter.storage->get_row_as_lua_object(it->second, lua).push(L);
+    } else if (filter.components.valid()) {
+        filter.components.push(L);
+        lua_rawgeti(L, -1, (lua_Integer)e);
+        lua_remove(L, -2);
+    } else {
+        lua_pushnil(L);
+    }
+
+    if (!filter.field.empty()) {
+        int type = lua_type(L, -1);
+        if (type == LUA_TTABLE || type == LUA_TUSERDATA) {
+            lua_getfield(L, -1, filter.field.c_str());
+            lua_remove(L, -2);
+        } else {
+            lua_pop(L, 1);
+            lua_pushnil(L);
+        }
+    }
+
+    filter.value.push(L);
+    bool ret = false;
+    if (filter.op == Filter::Op::Equal) {
+        ret = lua_rawequal(L, -2, -1);
+    } else if (filter.op == Filter::Op::NotEqual) {
+        ret = !lua_rawequal(L, -2, -1);
+    } else {
+        // only numbers with numbers and strings with strings, so nothing can raise an error
+        int a = lua_type(L, -2);
+        int b = lua_type(L, -1);
+        if (a == b && (a == LUA_TNUMBER || a == LUA_TSTRING)) {
+            switch (filter.op) {
+                case Filter::Op::Less: ret = lua_compare(L, -2, -1, LUA_OPLT); break;
+                case Filter::Op::LessEqual: ret = lua_compare(L, -2, -1, LUA_OPLE); break;
+                case Filter::Op::Greater: ret = lua_compare(L, -1, -2, LUA_OPLT); break;
+                case Filter::Op::GreaterEqual: ret = lua_compare(L, -1, -2, LUA_OPLE); break;
+                case Filter::Op::Between:
+                    filter.high.push(L);
+                    ret = lua_compare(L, -2, -3, LUA_OPLE) && lua_compare(L, -3, -1, LUA_OPLE);
+                    break;
+                default: break;
+            }
+        }
+    }
+
+    lua_settop(L, top);
+    return ret;
+}
+
+void LuaQuery::bind(sol::state& lua, Entity e, sol::table& target) {
+    for (Term& term : terms) {
+        if (!term.bound) continue;
+        switch (term.kind) {
+            case Term::Kind::Entity:
+                target.raw_set(term.key, e);
+                break;
+            case Term::Kind::Native: {
+                auto it = term.storage->indices.find(e);
+                if (it == term.storage->indices.end()) {
+                    target.raw_set(term.key, sol::lua_nil);
+                } else {
+                    target.raw_set(term.key, term.storage->get_row_as_lua_object(it->second, lua));
+                }
+                break;
+            }
+            case Term::Kind::Lua:
+                target.raw_set(term.key, term.components.raw_get<sol::object>(e));
+                break;
+            case Term::Kind::Missing:
+                break;
+        }
+    }
+}
+
+void LuaQuery::for_each(sol::state& lua, ECSWorld& ecs, bool sliced, const std::function<void(sol::table&)>& visit) {
+    if (reuse_arguments && !argument.valid()) {
+        argument = sol::table(lua, sol::create);
+    }
+
+    if (component_names.empty()) {
+        sol::table t = reuse_arguments ? argument : sol::table(lua, sol::create);
+        visit(t);
+        return;
+    }
+
+    if (running) {
+        LuaQuery nested(*this);
+        nested.for_each(lua, ecs, sliced, visit);
+        return;
+    }
+
+    if (!find_matches(lua, ecs, sliced)) return;
+
+    running = true;
+    struct Done { bool& running; ~Done() { running = false; } } done { running };
+
+    for (Entity e : matched) {
+        if (reuse_arguments) {
+            bind(lua, e, argument);
+            visit(argument);
+        } else {
+            sol::table t = sol::table(lua, sol::create);
+            bind(lua, e, t);
+            visit(t);
+        }
+    }
+}
+
+void LuaQuery::fill_columns(sol::state& lua) {
+    if (!batch.valid()) {
+        batch = sol::table(lua, sol::create);
+    }
+
+    for (Term& term : terms) {
+        if (term.kind == Term::Kind::Missing || !term.bound) continue;
+        if (!term.column.valid()) {
+            term.column = sol::table(lua, sol::create);
+        }
+        batch.raw_set(term.key, term.column);
+    }
+
+    for (size_t row = 0; row < matched.size(); row++) {
+        Entity e = matched[row];
+        for (Term& term : terms) {
+            if (!term.bound) continue;
+            switch (term.kind) {
+                case Term::Kind::Entity:
+                    term.column.raw_set(row + 1, e);
+                    break;
+                case Term::Kind::Native:
+                    term.column.raw_set(row + 1, term.storage->get_row_as_lua_object(term.storage->indices.at(e), lua));
+                    break;
+                case Term::Kind::Lua:
+                    term.column.raw_set(row + 1, term.components.raw_get<sol::object>(e));
+                    break;
+                case Term::Kind::Missing:
+                    break;
+            }
+        }
+    }
+
+    // rows left over from a bigger run
+    for (size_t row = matched.size(); row < last_batch_size; row++) {
+        for (Term& term : terms) {
+            if (term.column.valid()) term.column.raw_set(row + 1, sol::lua_nil);
+        }
+    }
+    last_batch_size = matched.size();
+
+    batch.raw_set("n", matched.size());
+}
+
+sol::object LuaQuery::make_iterator(sol::state& lua) {
+    if (!argument.valid()) {
+        argument = sol::table(lua, sol::create);
+    }
+
+    next_row = 0;
+    sol::state* state = &lua;
+    return sol::make_object(lua, [this, state, token = live_run, run = runs]() -> sol::object {
+        if (*token != run || next_row >= matched.size()) {
+            return sol::object(sol::lua_nil);
+        }
+
+        bind(*state, matched[next_row++], argument);
+        return argument;
+    });
+}
+
+void LuaQuery::for_each_batch(sol::state& lua, ECSWorld& ecs, bool sliced, Batch mode, const std::function<void(sol::object)>& visit) {
+    if (running) {
+        LuaQuery nested(*this);
+        nested.for_each_batch(lua, ecs, sliced, mode, visit);
+        return;
+    }
+
+    matched.clear();
+    if (!component_names.empty()) {
+        find_matches(lua, ecs, sliced);
+    }
+
+    running = true;
+    *live_run = ++runs;
+    struct Done {
+        LuaQuery& query;
+        ~Done() { query.running = false; *query.live_run = 0; }
+    } done { *this };
+
+    if (mode == Batch::Columns) {
+        fill_columns(lua);
+        visit(batch);
+    } else {
+        visit(make_iterator(lua));
+    }
+}
+
+std::vector<sol::table> LuaQuery::collect(sol::state& lua, ECSWorld& ecs, bool sliced) {
+    std::vector<sol::table> ret;
+
+    if (component_names.empty()) {
+        ret.push_back(sol::table(lua, sol::create));
+        return ret;
+    }
+
+    if (running) return LuaQuery(*this).collect(lua, ecs, sliced);
+    if (!find_matches(lua, ecs, sliced)) return ret;
+
+    ret.reserve(matched.size());
+    for (Entity e : matched) {
+        sol::table t = sol::table(lua, sol::create);
+        bind(lua, e, t);
+        ret.push_back(t);
+    }
+    return ret;
+}
+
+size_t LuaQuery::count(sol::state& lua, ECSWorld& ecs) {
+    if (component_names.empty()) return 1;
+    if (running) return LuaQuery(*this).count(lua, ecs);
+    if (!find_matches(lua, ecs, false)) return 0;
+
+    return matched.size();
+}
+
+namespace {
+    sol::object value_of(sol::state& lua, ECSWorld& ecs, const std::string& component, const std::string& field, Entity e) {
+        if (component == "entity") {
+            return sol::make_object(lua, e);
+        }
+
+        sol::object object = ecs.get_native_component_as_lua_object(e, component, lua);
+        if (field.empty() || !object.valid()) return object;
+        if (object.get_type() != sol::type::table && object.get_type() != sol::type::userdata) {
+            return sol::object(sol::lua_nil);
+        }
+
+        lua_State* L = lua.lua_state();
+        object.push();
+        lua_getfield(L, -1, field.c_str());
+        sol::object ret(L, -1);
+        lua_pop(L, 2);
+        return ret;
+    }
+
+    // nil never equals anything, not even nil
+    bool raw_equal(const sol::object& l, const sol::object& r) {
+        if (!l.valid() || !r.valid()) return false;
+
+        lua_State* L = l.lua_state();
+        l.push();
+        r.push(L);
+        bool ret = lua_rawequal(L, -1, -2);
+        lua_pop(L, 2);
+        return ret;
+    }
+}
+
+LuaJoin::LuaJoin(sol::table query_list, sol::object join) {
+    for (size_t idx = 1; idx <= query_list.size(); idx++) {
+        queries.emplace_back(query_list[idx].get<sol::table>());
+    }
+
+    auto parse_side = [](const std::string& s) {
+        size_t dot = s.find('.');
+        if (dot == std::string::npos) return Side { .component = s, .field = "" };
+        return Side { .component = s.substr(0, dot), .field = s.substr(dot + 1) };
+    };
+
+    auto parse_predicate = [&](sol::table t) {
+        Predicate predicate { .kind = Predicate::Kind::Within };
+        predicate.a = t.get_or<size_t>("a", 1) - 1;
+        predicate.b = t.get_or<size_t>("b", 2) - 1;
+
+        if (predicate.a >= queries.size() || predicate.b >= queries.size() || predicate.a == predicate.b) {
+            throw std::runtime_error("join predicate needs two different queries to compare.");
+        }
+        if (queries[predicate.a].empty() || queries[predicate.b].empty()) {
+            throw std::runtime_error("join predicate can't compare an empty query.");
+        }
+
+        sol::optional<f32> within = t.get<sol::optional<f32>>("within");
+        sol::optional<sol::table> equal = t.get<sol::optional<sol::table>>("equal");
+        if (within.has_value()) {
+            predicate.kind = Predicate::Kind::Within;
+            predicate.distance = within.value();
+        } else if (equal.has_value() && equal.value()[1].is<std::string>() && equal.value()[2].is<std::string>()) {
+            predicate.kind = Predicate::Kind::Equal;
+            predicate.left = parse_side(equal.value()[1].get<std::string>());
+            predicate.right = parse_side(equal.value()[2].get<std::string>());
+        } else {
+            throw std::runtime_error("join predicate needs 'within = distance' or 'equal = { \"component.field\", \"component.field\" }'.");
+        }
+
+        predicates.push_back(std::move(predicate));
+    };
+
+    if (join.is<sol::table>()) {
+        sol::table t = join.as<sol::table>();
+        if (t["within"].valid() || t["equal"].valid()) {
+            parse_predicate(t);
+        } else {
+            for (size_t idx = 1; idx <= t.size(); idx++) {
+                parse_predicate(t[idx].get<sol::table>());
+            }
+        }
+    } else if (join.valid()) {
+        throw std::runtime_error("join should be a predicate or a list of them.");
+    }
+
+    arguments.resize(queries.size());
+    rows.resize(queries.size());
+}
+
+void LuaJoin::cache_predicates(sol::state& lua, ECSWorld& ecs) {
+    for (Predicate& predicate : predicates) {
+        const std::vector<Entity>& left = queries[predicate.a].matched;
+        const std::vector<Entity>& right = queries[predicate.b].matched;
+
+        if (predicate.kind == Predicate::Kind::Within) {
+            predicate.left_positions.clear();
+            predicate.right_positions.clear();
+            for (Entity e : left) predicate.left_positions.push_back(position_of(ecs, e));
+            for (Entity e : right) predicate.right_positions.push_back(position_of(ecs, e));
+        } else {
+            predicate.left_values.clear();
+            predicate.right_values.clear();
+            for (Entity e : left) predicate.left_values.push_back(value_of(lua, ecs, predicate.left.component, predicate.left.field, e));
+            for (Entity e : right) predicate.right_values.push_back(value_of(lua, ecs, predicate.right.component, predicate.right.field, e));
+        }
+    }
+}
+
+bool LuaJoin::passes(size_t depth) {
+    // each predicate is checked as soon as both of its queries have a row picked
+    for (Predicate& predicate : predicates) {
+        if (std::max(predicate.a, predicate.b) != depth) continue;
+
+        size_t l = rows[predicate.a];
+        size_t r = rows[predicate.b];
+        if (predicate.kind == Predicate::Kind::Within) {
+            vec3 d = predicate.left_positions[l] - predicate.right_positions[r];
+            // written so NaN (no transform) fails
+            if (!(glm::dot(d, d) <= predicate.distance * predicate.distance)) return false;
+        } else if (!raw_equal(predicate.left_values[l], predicate.right_values[r])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void LuaJoin::walk(sol::state& lua, size_t depth, const std::function<void(std::vector<sol::table>&)>& visit) {
+    if (depth == queries.size()) {
+        visit(arguments);
+        return;
+    }
+
+    LuaQuery& query = queries[depth];
+    if (query.empty()) {
+        arguments[depth] = reuse_arguments ? empty_argument : sol::table(lua, sol::create);
+        walk(lua, depth + 1, visit);
+        return;
+    }
+
+    for (size_t row = 0; row < query.matched.size(); row++) {
+        rows[depth] = row;
+        if (!passes(depth)) continue;
+
+        if (!reuse_arguments) {
+            arguments[depth] = sol::table(lua, sol::create);
+        }
+        query.bind(lua, query.matched[row], arguments[depth]);
+        walk(lua, depth + 1, visit);
+    }
+}
+
+void LuaJoin::for_each(sol::state& lua, ECSWorld& ecs, bool sliced, const std::function<void(std::vector<sol::table>&)>& visit) {
+    for (size_t idx = 0; idx < queries.size(); idx++) {
+        LuaQuery& query = queries[idx];
+        if (query.empty()) continue;
+
+        query.find_matches(lua, ecs, sliced && idx == 0);
+        if (query.matched.empty()) return;
+    }
+
+    cache_predicates(lua, ecs);
+
+    if (!empty_argument.valid()) {
+        empty_argument = sol::table(lua, sol::create);
+    }
+    if (reuse_arguments) {
+        for (sol::table& argument : arguments) {
+            if (!argument.valid()) argument = sol::table(lua, sol::create);
+        }
+    }
+
+    walk(lua, 0, visit);
+}
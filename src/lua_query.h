@@ -0,0 +1,189 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include "types.h"
+#include "schema.h"
+
+namespace motorcar {
+    class ECSWorld;
+    class ComponentStorage;
+
+    // a list of component names from lua, like { "transform", "enemy", "entity" },
+    // run against an ECSWorld. "entity" isn't a component, it's the matching entity.
+    //
+    // the names are compiled into a plan once: each one is resolved to its native
+    // storage or lua table, and its key in the argument table is made up front. the
+    // plan is only redone when a new component gets registered. running it picks the
+    // smallest native storage to drive the loop and probes the rest, smallest first,
+    // without any string lookups.
+    //
+    // every match is handed to lua as a new table with one field per name. with
+    // reuse_arguments it's the same table every time instead, with its fields
+    // rebound between matches, so running a query doesn't make garbage per entity.
+    //
+    // the table can also filter matches before lua sees them:
+    //   with = { "trigger_body" }   has these too, without passing them along
+    //   without = { "dead" }        doesn't have any of these
+    //   where = {
+    //       { "enemy.wants", "==", "chili" },          also ~=, <, <=, >, >=
+    //       { "enemy.speed", "between", 1, 5 },        inclusive
+    //       { "food_type", "==", "chili" },            no field compares the whole component
+    //       { "position", "within", vec3.new(0, 0, 0), 10 },
+    //   }
+    // fields of components defined with a schema are compared without touching
+    // lua. anything else is read through lua, but still before the callback runs.
+    class LuaQuery {
+        friend class LuaJoin;
+        friend class PureSystemPool;
+
+        struct Term {
+            enum class Kind { Entity, Native, Lua, Missing };
+
+            Kind kind;
+            std::string name;
+            sol::object key; // `name` as a lua string
+            ComponentStorage* storage = nullptr;
+            sol::table components;
+            sol::table column; // for batched runs
+            bool bound = true; // false for `with` components
+        };
+
+        struct Filter {
+            enum class Op { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, Between, Within };
+            // how compile decided to evaluate it
+            enum class Path { Position, Number, String, Lua };
+
+            Op op;
+            std::string component; // "position" for Within
+            std::string field;     // empty to compare the whole component
+            sol::object value, high;
+            vec3 point = vec3(0);
+            f32 radius = 0;
+
+            Path path = Path::Lua;
+            ComponentStorage* storage = nullptr;
+            const ComponentSchema::Field* schema_field = nullptr;
+            sol::table components;
+            f64 number = 0, number_high = 0;
+            std::string string;
+        };
+
+        std::vector<std::string> component_names;
+        std::vector<std::string> with_names;
+        std::vector<std::string> without_names;
+        std::vector<Filter> filters;
+
+        std::vector<Term> terms;
+        std::vector<Term> excluded;
+        u64 compiled_version = (u64)-1;
+        bool compiled_ok = false;
+
+        // scratch, kept around so running doesn't allocate
+        std::vector<Term*> probes;
+        std::vector<Entity> matched;
+        sol::table argument;
+        sol::table batch;
+        size_t last_batch_size = 0;
+        bool running = false; // a callback can run the same query again
+
+        // iterators handed to lua check this against the run they were made for,
+        // so one that's kept around after its run just stops
+        u64 runs = 0;
+        std::shared_ptr<u64> live_run = std::make_shared<u64>(0);
+        size_t next_row = 0;
+
+        void fill_columns(sol::state& lua);
+        sol::object make_iterator(sol::state& lua);
+
+        void compile(sol::state& lua, ECSWorld& ecs);
+        // fills `matched`. returns false if a component doesn't exist at all
+        bool find_matches(sol::state& lua, ECSWorld& ecs, bool sliced);
+        bool test(sol::state& lua, ECSWorld& ecs, const Filter& filter, Entity e);
+        bool test_lua(sol::state& lua, const Filter& filter, Entity e);
+        static bool compare_numbers(Filter::Op op, f64 a, f64 b, f64 high);
+        void bind(sol::state& lua, Entity e, sol::table& target);
+
+        public:
+            // how a batched run hands its matches to lua
+            enum class Batch {
+                // { n = count, <name> = { row 1, row 2, ... }, ... }. the tables are reused between runs
+                Columns,
+                // a function returning the next match's argument table, or nil once it runs out
+                Iterator,
+            };
+
+            // hand out the same table for every match, rebinding its fields. only
+            // for callbacks that don't hold on to their argument past the call
+            bool reuse_arguments = false;
+
+            LuaQuery(sol::table components);
+            LuaQuery(const LuaQuery& other);
+
+            bool empty() const { return component_names.empty(); }
+
+            // `sliced` restricts the matches to ECSWorld::current_slice, for amortized systems
+            void for_each(sol::state& lua, ECSWorld& ecs, bool sliced, const std::function<void(sol::table&)>& visit);
+            // calls `visit` once with every match, so lua loops over them itself
+            void for_each_batch(sol::state& lua, ECSWorld& ecs, bool sliced, Batch mode, const std::function<void(sol::object)>& visit);
+            // one new table per match
+            std::vector<sol::table> collect(sol::state& lua, ECSWorld& ecs, bool sliced);
+            size_t count(sol::state& lua, ECSWorld& ecs);
+    };
+
+    // several queries run together, like {{ "player", "transform" }, { "enemy", "transform" }}.
+    // the callback gets every combination of their matches, one argument per query.
+    //
+    // it's a nested loop over each query's matches, binding arguments as it goes
+    // down, so nothing is copied per combination. join predicates prune
+    // combinations natively, before lua ever sees them:
+    //   { within = 5, a = 1, b = 2 }                   the queries' entities are within 5 units
+    //   { equal = { "enemy.wants", "food.kind" } }   a field (or "entity", or a whole component) matches
+    // `a` and `b` say which queries the predicate compares, the first two by default.
+    class LuaJoin {
+        struct Side {
+            std::string component; // "entity" for the entity itself
+            std::string field;     // empty for the whole component
+        };
+
+        struct Predicate {
+            enum class Kind { Within, Equal };
+
+            Kind kind;
+            size_t a, b; // indices into queries
+            f32 distance = 0;
+            Side left, right;
+
+            // per run, one value per match of query a and query b
+            std::vector<vec3> left_positions, right_positions;
+            std::vector<sol::object> left_values, right_values;
+        };
+
+        std::vector<LuaQuery> queries;
+        std::vector<Predicate> predicates;
+
+        // scratch, kept around so running doesn't allocate
+        std::vector<sol::table> arguments;
+        std::vector<size_t> rows;
+        sol::table empty_argument;
+
+        void cache_predicates(sol::state& lua, ECSWorld& ecs);
+        bool passes(size_t depth);
+        void walk(sol::state& lua, size_t depth, const std::function<void(std::vector<sol::table>&)>& visit);
+
+        public:
+            // see LuaQuery::reuse_arguments
+            bool reuse_arguments = false;
+
+            // `join` is a predicate, a list of them, or nil
+            LuaJoin(sol::table queries, sol::object join);
+
+            // `sliced` only slices the first query, otherwise we'd see 1/k^n of the combinations
+            void for_each(sol::state& lua, ECSWorld& ecs, bool sliced, const std::function<void(std::vector<sol::table>&)>& visit);
+    };
+}
@@ -207,7 +207,7 @@ PhysicsManager::PhysicsManager(Engine& engine) : engine(engine) {
     Entity collision_system = engine.ecs->new_entity();
     engine.ecs->emplace_native_component<PhysicsSystem>(collision_system);
     engine.ecs->emplace_native_component<System>(collision_system, [&]() {
-        auto it = engine.ecs->query<Entity, GlobalTransform, Body>() | std::views::transform([](auto t) {
+        auto it = engine.ecs->query<Entity, const GlobalTransform, const Body>() | std::views::transform([](auto t) {
             return std::make_pair(std::get<0>(t), TransformedBody(*std::get<2>(t), std::get<1>(t)->model, std::get<1>(t)->normal));
         });
 
@@ -244,7 +244,7 @@ PhysicsManager::PhysicsManager(Engine& engine) : engine(engine) {
         }
 
         // clear CollidingWith
-        for (auto [entity, _] : engine.ecs->query<Entity, CollidingWith>()) {
+        for (auto [entity, _] : engine.ecs->query<Entity, const CollidingWith>()) {
             engine.ecs->remove_native_component_from_entity<CollidingWith>(entity);
         }
 
@@ -258,7 +258,7 @@ PhysicsManager::PhysicsManager(Engine& engine) : engine(engine) {
 }
 
 std::optional<std::pair<Entity, vec3>> PhysicsManager::cast_ray(vec3 origin, vec3 direction, Entity excluded) {
-    auto it = engine.ecs->query<Entity, GlobalTransform, Body>();
+    auto it = engine.ecs->query<Entity, const GlobalTransform, const Body>();
 
     Entity ret_e = -1;
     f32 ret_t = INFINITY;
@@ -0,0 +1,138 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include <algorithm>
+#include <format>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+
+#include "profiler.h"
+
+using namespace motorcar;
+
+void LuaProfiler::on_hook(void* self, lua_State* L) {
+    ((LuaProfiler*)self)->sample(L);
+}
+
+void LuaProfiler::sample(lua_State* L) {
+    frames.clear();
+
+    lua_Debug ar;
+    std::string leaf;
+    for (int level = 0; level < MAX_DEPTH && lua_getstack(L, level, &ar); level++) {
+        if (!lua_getinfo(L, "Sln", &ar)) break;
+
+        if (*ar.what == 'C') {
+            frames.push_back(std::format("{} [C]", ar.name ? ar.name : "?"));
+        } else if (*ar.what == 'm') {
+            frames.push_back(std::format("{}", ar.short_src));
+        } else {
+            frames.push_back(std::format("{} {}:{}", ar.name ? ar.name : "?", ar.short_src, ar.linedefined));
+        }
+
+        if (leaf.empty() && ar.currentline > 0) {
+            leaf = std::format("{}:{}", ar.short_src, ar.currentline);
+        }
+    }
+    if (frames.empty()) return;
+
+    std::string stack = current == NOT_A_SYSTEM ? "engine" : systems[current].where;
+    for (auto it = frames.rbegin(); it != frames.rend(); it++) {
+        stack += ';';
+        stack += *it;
+    }
+    // the line the innermost lua function was on, as its own frame
+    if (!leaf.empty()) {
+        stack += ';';
+        stack += leaf;
+        lines[leaf]++;
+    }
+
+    stacks[stack]++;
+    samples++;
+    if (current != NOT_A_SYSTEM) systems[current].samples++;
+}
+
+void LuaProfiler::start(u32 sample_every) {
+    this->sample_every = std::max(sample_every, 1u);
+    running = true;
+    current = NOT_A_SYSTEM;
+
+    samples = 0;
+    stacks.clear();
+    lines.clear();
+    for (auto& entry : systems) {
+        entry = SystemEntry { .where = std::move(entry.where), .script = std::move(entry.script) };
+    }
+
+    hooks.set(LuaHooks::Profiler, this->sample_every, on_hook, this);
+}
+
+void LuaProfiler::stop() {
+    running = false;
+    hooks.clear(LuaHooks::Profiler);
+}
+
+u32 LuaProfiler::system(std::string_view where, std::string_view script) {
+    std::string key { where };
+    auto it = system_ids.find(key);
+    if (it != system_ids.end()) return it->second;
+
+    u32 ret = systems.size();
+    systems.push_back(SystemEntry { .where = key, .script = std::string(script) });
+    system_ids.emplace(std::move(key), ret);
+    return ret;
+}
+
+void LuaProfiler::end_frame() {
+    if (!running) return;
+
+    for (auto& entry : systems) {
+        entry.last_frame_calls = entry.frame_calls;
+        entry.last_frame_secs = entry.frame_secs;
+        entry.calls += entry.frame_calls;
+        entry.secs += entry.frame_secs;
+        entry.frame_calls = 0;
+        entry.frame_secs = 0.;
+    }
+}
+
+std::vector<LuaProfiler::SystemReport> LuaProfiler::system_report() const {
+    std::vector<SystemReport> ret;
+    for (auto& entry : systems) {
+        if (entry.calls == 0 && entry.last_frame_calls == 0) continue;
+        ret.push_back(SystemReport {
+            .where = entry.where,
+            .script = entry.script,
+            .frame_calls = entry.last_frame_calls,
+            .frame_secs = entry.last_frame_secs,
+            .calls = entry.calls,
+            .secs = entry.secs,
+            .samples = entry.samples,
+        });
+    }
+    std::sort(ret.begin(), ret.end(), [](auto& l, auto& r) { return l.frame_secs > r.frame_secs; });
+    return ret;
+}
+
+std::vector<LuaProfiler::LineReport> LuaProfiler::line_report(size_t limit) const {
+    std::vector<LineReport> ret;
+    for (auto& [line, count] : lines) {
+        ret.push_back(LineReport { .line = line, .samples = count });
+    }
+    std::sort(ret.begin(), ret.end(), [](auto& l, auto& r) { return l.samples > r.samples; });
+    if (ret.size() > limit) ret.resize(limit);
+    return ret;
+}
+
+bool LuaProfiler::write_collapsed_stacks(const std::filesystem::path& path) const {
+    std::ofstream file_stream(path, std::ios::trunc);
+    if (file_stream.fail()) {
+        SPDLOG_ERROR("couldn't open {} to write the profile.", path.string());
+        return false;
+    }
+
+    for (auto& [stack, count] : stacks) {
+        file_stream << stack << ' ' << count << '\n';
+    }
+    return file_stream.good();
+}
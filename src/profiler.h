@@ -0,0 +1,124 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include "types.h"
+#include "lua_hooks.h"
+
+// an opt in profiler for lua.
+//
+// while it's running, a count hook (see lua_hooks.h) samples lua's stack every `sample_every`
+// instructions. samples are kept as collapsed stacks (the format flamegraph.pl
+// and friends read), rooted at the system that was running, and per source
+// line. every system run is also timed.
+//
+// when it isn't running there's no hook, and timing a system is one branch.
+// coroutines only get the hook if they were made while the profiler was running.
+
+namespace motorcar {
+    class LuaProfiler {
+        static const u32 NOT_A_SYSTEM = -1;
+        static const int MAX_DEPTH = 64;
+
+        struct SystemEntry {
+            std::string where;  // file:line it was registered at
+            std::string script; // its BoundToScript
+
+            u64 frame_calls = 0;
+            f64 frame_secs = 0.;
+            u64 last_frame_calls = 0;
+            f64 last_frame_secs = 0.;
+            u64 calls = 0;
+            f64 secs = 0.;
+            u64 samples = 0;
+        };
+
+        LuaHooks& hooks;
+        bool running = false;
+        u32 sample_every = 1000;
+
+        std::vector<SystemEntry> systems;
+        std::unordered_map<std::string, u32> system_ids;
+        u32 current = NOT_A_SYSTEM;
+
+        u64 samples = 0;
+        std::unordered_map<std::string, u64> stacks; // collapsed stack -> samples
+        std::unordered_map<std::string, u64> lines;  // file:line -> samples
+        std::vector<std::string> frames;             // reused between samples
+
+        static void on_hook(void* self, lua_State* L);
+        void sample(lua_State* L);
+
+        public:
+            struct SystemReport {
+                std::string_view where;
+                std::string_view script;
+                u64 frame_calls; // last frame
+                f64 frame_secs;
+                u64 calls;       // since the profiler started
+                f64 secs;
+                u64 samples;
+            };
+
+            struct LineReport {
+                std::string_view line;
+                u64 samples;
+            };
+
+            // times a system run, when the profiler is running
+            class Scope {
+                LuaProfiler* profiler = nullptr;
+                u32 system;
+                u32 previous = NOT_A_SYSTEM;
+                std::chrono::steady_clock::time_point start;
+
+                public:
+                    Scope(LuaProfiler* profiler, u32 system) : system(system) {
+                        if (profiler == nullptr || !profiler->running) return;
+                        this->profiler = profiler;
+                        previous = std::exchange(profiler->current, system);
+                        start = std::chrono::steady_clock::now();
+                    }
+                    ~Scope() {
+                        if (profiler == nullptr) return;
+                        auto& entry = profiler->systems[system];
+                        entry.frame_calls++;
+                        entry.frame_secs += std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+                        profiler->current = previous;
+                    }
+
+                    Scope(Scope&) = delete;
+                    Scope& operator=(Scope&) = delete;
+            };
+
+            LuaProfiler(LuaHooks& hooks) : hooks(hooks) {}
+
+            // clears whatever was collected before
+            void start(u32 sample_every);
+            void stop();
+            bool is_running() const { return running; }
+
+            // the id to hand to Scope for a system
+            u32 system(std::string_view where, std::string_view script);
+
+            // once a frame, makes this frame's system timings the last frame's
+            void end_frame();
+
+            // most time last frame first
+            std::vector<SystemReport> system_report() const;
+            // most samples first
+            std::vector<LineReport> line_report(size_t limit) const;
+            u64 sample_count() const { return samples; }
+
+            // collapsed stacks, one "frame;frame;frame samples" per line
+            bool write_collapsed_stacks(const std::filesystem::path& path) const;
+    };
+}
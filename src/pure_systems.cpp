@@ -0,0 +1,475 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+#include "pure_systems.h"
+#include "engine.h"
+#include "ecs.h"
+#include "lua_query.h"
+#include "schema.h"
+#include "scripts.h"
+
+using namespace motorcar;
+
+namespace {
+    int dump_to_string(lua_State*, const void* data, size_t size, void* ud) {
+        ((std::string*)ud)->append((const char*)data, size);
+        return 0;
+    }
+
+    // like push_field_value, but vectors and quats are copies. the row isn't the worker's to write to
+    void push_field_copy(lua_State* L, FieldType type, const void* ptr) {
+        switch (type) {
+            case FieldType::Vec2: sol::stack::push(L, *(const vec2*)ptr); break;
+            case FieldType::Vec3: sol::stack::push(L, *(const vec3*)ptr); break;
+            case FieldType::Quat: sol::stack::push(L, *(const quat*)ptr); break;
+            default: push_field_value(L, type, (void*)ptr); break;
+        }
+    }
+}
+
+PureSystemPool::PureSystemPool(Engine& engine, sol::state& main_lua, size_t worker_count) : engine(engine), main_lua(main_lua) {
+    for (size_t idx = 0; idx < worker_count; idx++) {
+        auto worker = std::make_unique<Worker>();
+        setup(*worker);
+        workers.push_back(std::move(worker));
+    }
+
+    // started once they're all set up, so their states only ever get touched from their own thread
+    for (auto& worker : workers) {
+        worker->thread = std::thread([this, worker = worker.get()]() { work(*worker); });
+    }
+
+    SPDLOG_INFO("started {} workers for pure systems.", workers.size());
+}
+
+PureSystemPool::~PureSystemPool() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& worker : workers) {
+        worker->thread.join();
+    }
+}
+
+void PureSystemPool::setup(Worker& worker) {
+    sol::state& lua = worker.lua;
+    lua.open_libraries(sol::lib::base, sol::lib::math, sol::lib::string, sol::lib::table);
+    register_math_to_lua(lua);
+
+    // the run's. run_state doesn't change while the workers are going
+    sol::table engine_namespace = lua["Engine"].force();
+    engine_namespace.set_function("delta", [this]() { return run_state.delta; });
+    engine_namespace.set_function("tick", [this]() { return run_state.tick; });
+
+    Worker* w = &worker;
+    auto record = [w](Op op, Entity e) {
+        w->commands.write(op);
+        w->commands.write<u64>(e);
+        w->command_count++;
+    };
+
+    sol::table commands = lua["Commands"].force();
+    commands.set_function("set", [=](Entity e, std::string component, sol::table fields) {
+        record(Op::Set, e);
+        w->commands.write_string(component);
+        encode_lua_value(w->commands, fields);
+    });
+    commands.set_function("insert_component", [=](Entity e, std::string component, sol::object value) {
+        record(Op::Insert, e);
+        w->commands.write_string(component);
+        encode_lua_value(w->commands, value);
+    });
+    commands.set_function("remove_component", [=](Entity e, std::string component) {
+        record(Op::Remove, e);
+        w->commands.write_string(component);
+    });
+    commands.set_function("delete_entity", [=](Entity e) {
+        record(Op::Delete, e);
+    });
+    commands.set_function("fire_event", [=](std::string event_name, sol::object event_payload) {
+        record(Op::Fire, 0);
+        w->commands.write_string(event_name);
+        encode_lua_value(w->commands, event_payload);
+    });
+}
+
+void PureSystemPool::work(Worker& worker) {
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            wake.wait(lock, [&]() { return stopping || worker.has_job; });
+            if (stopping) return;
+        }
+
+        run_share(worker);
+
+        {
+            std::lock_guard lock(mutex);
+            worker.has_job = false;
+            busy--;
+        }
+        done.notify_one();
+    }
+}
+
+sol::protected_function PureSystemPool::load(Worker& worker, const PureSystem& system) {
+    lua_State* L = worker.lua.lua_state();
+    if (luaL_loadbufferx(L, system.bytecode.data(), system.bytecode.size(), system.where.c_str(), "b") != LUA_OK) {
+        SPDLOG_ERROR("couldn't load pure system registered at {} on a worker: {}", system.where, lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return {};
+    }
+
+    sol::state_view lua(L);
+    for (size_t idx = 0; idx < system.upvalues.size(); idx++) {
+        const PureSystem::Upvalue& upvalue = system.upvalues[idx];
+        if (upvalue.is_env) {
+            lua_pushglobaltable(L);
+        } else {
+            SnapshotReader reader(upvalue.value);
+            decode_lua_value(reader, lua).push();
+        }
+
+        if (lua_setupvalue(L, -2, idx + 1) == nullptr) lua_pop(L, 1);
+    }
+
+    sol::protected_function ret(L, -1);
+    lua_pop(L, 1);
+    return ret;
+}
+
+void PureSystemPool::run_share(Worker& worker) {
+    for (u32 id : worker.to_forget) worker.functions.erase(id);
+    worker.to_forget.clear();
+
+    const Run& run = run_state;
+    const PureSystem& system = *run.system;
+
+    auto it = worker.functions.find(system.id);
+    if (it == worker.functions.end()) {
+        it = worker.functions.emplace(system.id, load(worker, system)).first;
+    }
+    sol::protected_function& callback = it->second;
+    if (!callback.valid()) return;
+
+    sol::state& lua = worker.lua;
+    lua_State* L = lua.lua_state();
+
+    // the argument and the native components' tables are rebound between
+    // matches, like LuaQuery's. lua components are new copies every time
+    sol::table argument = lua.create_table();
+    std::vector<sol::table> copies(run.columns.size());
+    for (size_t col = 0; col < run.columns.size(); col++) {
+        const Column& column = run.columns[col];
+        if (column.kind == Column::Kind::Native) {
+            copies[col] = lua.create_table(0, column.fields.size());
+            argument[column.name] = copies[col];
+        }
+    }
+
+    std::span<const u8> lua_values = run.lua_values.view();
+    size_t width = run.columns.size();
+    for (size_t match = worker.begin; match < worker.end; match++) {
+        for (size_t col = 0; col < width; col++) {
+            const Column& column = run.columns[col];
+            size_t cell = match * width + col;
+
+            switch (column.kind) {
+                case Column::Kind::Entity:
+                    argument[column.name] = run.matches[match];
+                    break;
+                case Column::Kind::Native:
+                    copies[col].push();
+                    for (const Field& field : column.fields) {
+                        push_field_copy(L, field.type, (const u8*)run.rows[cell] + field.offset);
+                        lua_setfield(L, -2, field.name.c_str());
+                    }
+                    lua_pop(L, 1);
+                    break;
+                case Column::Kind::Lua: {
+                    SnapshotReader reader(lua_values.subspan(run.offsets[cell]));
+                    argument[column.name] = decode_lua_value(reader, lua);
+                    break;
+                }
+            }
+        }
+
+        auto result = callback(argument);
+        if (!result.valid()) {
+            sol::error error = result;
+            SPDLOG_ERROR("Caught lua error in pure system registered at {}: {}", system.where, error.what());
+        }
+    }
+}
+
+std::vector<PureSystemPool::Field> PureSystemPool::fields_of(const ComponentStorage& storage) {
+    std::vector<Field> ret;
+    if (storage.schema) {
+        for (const auto& field : storage.schema->fields) {
+            ret.push_back(Field { .name = field.name, .type = field.type, .offset = field.offset });
+        }
+    } else {
+        for (const ComponentField& field : storage.fields) {
+            ret.push_back(Field { .name = std::string(field.name), .type = field.type, .offset = field.offset });
+        }
+    }
+    return ret;
+}
+
+bool PureSystemPool::gather(const PureSystem& system) {
+    ECSWorld& ecs = *engine.ecs;
+    LuaQuery& query = *system.query;
+
+    Run& run = run_state;
+    run.system = &system;
+    // already scaled by run_systems for systems that skip ticks or are amortized
+    run.delta = engine.delta;
+    run.tick = engine.tick;
+    run.columns.clear();
+    run.matches.clear();
+    run.rows.clear();
+    run.offsets.clear();
+    run.lua_values.take();
+
+    if (!query.find_matches(main_lua, ecs, true) || query.matched.empty()) return false;
+    run.matches = query.matched;
+
+    std::vector<const LuaQuery::Term*> terms;
+    for (const LuaQuery::Term& term : query.terms) {
+        if (!term.bound) continue;
+
+        Column column { .name = term.name };
+        switch (term.kind) {
+            case LuaQuery::Term::Kind::Entity:
+                column.kind = Column::Kind::Entity;
+                break;
+            case LuaQuery::Term::Kind::Native:
+                column.kind = Column::Kind::Native;
+                column.fields = fields_of(*term.storage);
+                if (column.fields.empty() && warned_no_fields.insert(term.name).second) {
+                    SPDLOG_WARN("{} doesn't list its fields (see COMPONENT_FIELDS), pure systems get an empty table for it.", term.name);
+                }
+                break;
+            case LuaQuery::Term::Kind::Lua:
+                column.kind = Column::Kind::Lua;
+                break;
+            case LuaQuery::Term::Kind::Missing:
+                return false;
+        }
+
+        run.columns.push_back(std::move(column));
+        terms.push_back(&term);
+    }
+
+    // rows are only read while the main thread waits, so pointers are fine. lua
+    // components can't be read off the main thread at all, they get copied out here
+    size_t width = run.columns.size();
+    run.rows.resize(run.matches.size() * width);
+    run.offsets.resize(run.matches.size() * width);
+    for (size_t match = 0; match < run.matches.size(); match++) {
+        Entity e = run.matches[match];
+        for (size_t col = 0; col < width; col++) {
+            const LuaQuery::Term& term = *terms[col];
+            size_t cell = match * width + col;
+
+            if (term.kind == LuaQuery::Term::Kind::Native) {
+                run.rows[cell] = term.storage->compute_pointer(term.storage->indices.at(e));
+            } else if (term.kind == LuaQuery::Term::Kind::Lua) {
+                run.offsets[cell] = run.lua_values.size();
+                encode_lua_value(run.lua_values, term.components.raw_get<sol::object>(e));
+            }
+        }
+    }
+
+    return true;
+}
+
+void PureSystemPool::set_fields(const PureSystem& system, Entity e, const std::string& component, sol::object fields) {
+    if (!fields.is<sol::table>()) {
+        SPDLOG_ERROR("pure system registered at {} set {} to something that isn't a table of fields.", system.where, component);
+        return;
+    }
+    sol::table table = fields.as<sol::table>();
+    ECSWorld& ecs = *engine.ecs;
+
+    if (ComponentStorage* storage = ecs.get_native_storage(component)) {
+        // it could've lost the component since the run started
+        auto it = storage->indices.find(e);
+        if (it == storage->indices.end()) return;
+
+        void* row = storage->compute_pointer(it->second);
+        storage->touch();
+        std::vector<Field> columns = fields_of(*storage);
+        lua_State* L = main_lua.lua_state();
+
+        table.for_each([&](sol::object key, sol::object value) {
+            auto field = std::find_if(columns.begin(), columns.end(), [&](const Field& candidate) {
+                return key.is<std::string>() && key.as<std::string_view>() == candidate.name;
+            });
+            if (field == columns.end()) {
+                SPDLOG_ERROR("pure system registered at {} set a field {} doesn't have.", system.where, component);
+                return;
+            }
+
+            value.push();
+            if (!set_field_value(L, field->type, (void*)((size_t)row + field->offset), -1)) {
+                SPDLOG_ERROR("pure system registered at {} set {}.{}, which should be a {}.",
+                    system.where, component, field->name, field_type_name(field->type));
+            }
+            lua_pop(L, 1);
+        });
+        return;
+    }
+
+    sol::object components = ecs.lua_storage[component];
+    if (!components.is<sol::table>()) return;
+
+    sol::object current = components.as<sol::table>().raw_get<sol::object>(e);
+    if (!current.is<sol::table>()) return;
+
+    sol::table target = current.as<sol::table>();
+    table.for_each([&](sol::object key, sol::object value) {
+        target.raw_set(key, value);
+    });
+}
+
+void PureSystemPool::play_back(const PureSystem& system, std::span<const u8> commands, u64 count) {
+    ECSWorld& ecs = *engine.ecs;
+    sol::state_view lua(main_lua);
+    sol::table ecs_namespace = lua["ECS"];
+
+    auto call = [&](const char* function, auto&&... args) {
+        sol::protected_function f = ecs_namespace[function];
+        auto result = f(std::forward<decltype(args)>(args)...);
+        if (!result.valid()) {
+            sol::error error = result;
+            SPDLOG_ERROR("Caught lua error playing back pure system registered at {}: {}", system.where, error.what());
+        }
+    };
+
+    SnapshotReader reader(commands);
+    for (u64 idx = 0; idx < count && reader.ok(); idx++) {
+        Op op = reader.read<Op>();
+        Entity e = reader.read<u64>();
+
+        switch (op) {
+            case Op::Set: {
+                std::string component = reader.read_string();
+                set_fields(system, e, component, decode_lua_value(reader, lua));
+                break;
+            }
+            case Op::Insert: {
+                std::string component = reader.read_string();
+                call("insert_component", e, component, decode_lua_value(reader, lua));
+                break;
+            }
+            case Op::Remove:
+                call("remove_component_from_entity", e, reader.read_string());
+                break;
+            case Op::Delete:
+                ecs.delete_entity(e);
+                break;
+            case Op::Fire: {
+                std::string event_name = reader.read_string();
+                ecs.fire_event(event_name, decode_lua_value(reader, lua));
+                break;
+            }
+        }
+    }
+
+    if (!reader.ok()) {
+        SPDLOG_ERROR("pure system registered at {} left a broken command buffer.", system.where);
+    }
+}
+
+void PureSystemPool::forget_expired() {
+    std::erase_if(registered, [&](const auto& entry) {
+        if (!entry.second.expired()) return false;
+
+        for (auto& worker : workers) worker->to_forget.push_back(entry.first);
+        return true;
+    });
+}
+
+std::shared_ptr<PureSystem> PureSystemPool::make_system(sol::protected_function callback, std::shared_ptr<LuaQuery> query, std::string where) {
+    auto system = std::make_shared<PureSystem>();
+    system->id = next_id++;
+    system->where = std::move(where);
+    system->query = std::move(query);
+
+    lua_State* L = main_lua.lua_state();
+    callback.push();
+    if (lua_iscfunction(L, -1) || lua_dump(L, dump_to_string, &system->bytecode, 0) != 0) {
+        lua_pop(L, 1);
+        throw std::runtime_error("pure systems need to be lua functions.");
+    }
+
+    for (int idx = 1; ; idx++) {
+        const char* name = lua_getupvalue(L, -1, idx);
+        if (name == nullptr) break;
+
+        PureSystem::Upvalue upvalue;
+        int type = lua_type(L, -1);
+        if (strcmp(name, "_ENV") == 0) {
+            upvalue.is_env = true;
+        } else if (type == LUA_TFUNCTION || type == LUA_TTHREAD || type == LUA_TLIGHTUSERDATA) {
+            std::string upvalue_name = name;
+            lua_pop(L, 2);
+            throw std::runtime_error(std::format(
+                "pure systems can only use plain values from outside, and `{}` isn't one. define it in the callback instead.", upvalue_name));
+        } else {
+            SnapshotWriter writer;
+            encode_lua_value(writer, sol::object(L, -1));
+            upvalue.value = writer.take();
+        }
+
+        lua_pop(L, 1);
+        system->upvalues.push_back(std::move(upvalue));
+    }
+    lua_pop(L, 1);
+
+    registered.emplace_back(system->id, system);
+    return system;
+}
+
+void PureSystemPool::run(const PureSystem& system) {
+    forget_expired();
+    if (!gather(system)) return;
+
+    size_t matches = run_state.matches.size();
+    size_t used = std::clamp<size_t>((matches + MIN_MATCHES_PER_WORKER - 1) / MIN_MATCHES_PER_WORKER, 1, workers.size());
+    size_t share = (matches + used - 1) / used;
+
+    {
+        std::lock_guard lock(mutex);
+        for (size_t idx = 0; idx < used; idx++) {
+            Worker& worker = *workers[idx];
+            worker.begin = std::min(idx * share, matches);
+            worker.end = std::min(worker.begin + share, matches);
+            worker.has_job = true;
+        }
+        busy = used;
+    }
+    wake.notify_all();
+
+    {
+        std::unique_lock lock(mutex);
+        done.wait(lock, [&]() { return busy == 0; });
+    }
+
+    // in worker order, which is match order
+    for (size_t idx = 0; idx < used; idx++) {
+        Worker& worker = *workers[idx];
+        std::vector<u8> commands = worker.commands.take();
+        play_back(system, commands, std::exchange(worker.command_count, 0));
+    }
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include "types.h"
+#include "snapshot.h"
+
+// systems registered with `pure = true` run on worker threads, each with its
+// own lua state, instead of on the main one:
+//   local SPEED = 4
+//   ECS.register_system({ "boid", "entity" }, function(e)
+//       local heading = e.boid.heading + e.boid.turn * Engine.delta()
+//       Commands.set(e.entity, "boid", { heading = heading, speed = SPEED })
+//   end, "physics", { pure = true })
+//
+// a pure system only gets to see its arguments, and can only change the world
+// through Commands. its arguments are copies: native and schema components are
+// tables of their fields, lua components are deep copies (made on the main
+// thread, so schema components are the cheap ones here). workers have the
+// base, math, string and table libraries, vectors, Engine.delta and Engine.tick,
+// and nothing else. its upvalues are copied over once, when it's registered, so
+// they have to be plain values. helper functions go inside the callback.
+//
+// each run, the matches are split between the workers, which run the callback's
+// bytecode over their share. whatever they did through Commands is recorded to
+// a buffer per worker, and played back on the main thread once all of them are
+// done, worker by worker, so the result doesn't depend on who finished first.
+//
+// Commands:
+//   set(e, component, { field = value, ... })  writes those fields, if e still has the component
+//   insert_component(e, component, value)
+//   remove_component(e, component)
+//   delete_entity(e)
+//   fire_event(name, payload)
+
+namespace motorcar {
+    struct Engine;
+    class LuaQuery;
+    class ComponentStorage;
+
+    // one system's callback and query, ready to run on a worker
+    struct PureSystem {
+        struct Upvalue {
+            bool is_env = false;    // _ENV becomes the worker's globals
+            std::vector<u8> value;  // otherwise a copy, see encode_lua_value
+        };
+
+        u32 id;
+        std::string where;
+        std::string bytecode;
+        std::vector<Upvalue> upvalues;
+        std::shared_ptr<LuaQuery> query;
+    };
+
+    class PureSystemPool {
+        // fewer matches per worker than this and it isn't worth waking another one
+        static const size_t MIN_MATCHES_PER_WORKER = 64;
+
+        enum class Op : u8 { Set, Insert, Remove, Delete, Fire };
+
+        struct Field {
+            std::string name;
+            FieldType type;
+            size_t offset;
+        };
+
+        // one thing the callback's argument has
+        struct Column {
+            enum class Kind { Entity, Native, Lua };
+
+            Kind kind;
+            std::string name;
+            std::vector<Field> fields; // for Native
+        };
+
+        // the run in progress. filled in on the main thread, only read by the workers
+        struct Run {
+            const PureSystem* system = nullptr;
+            f64 delta = 0.;
+            u64 tick = 0;
+            std::vector<Column> columns;
+            std::vector<Entity> matches;
+            // matches * columns cells. a native row, or where a lua component starts in lua_values
+            std::vector<const void*> rows;
+            std::vector<size_t> offsets;
+            SnapshotWriter lua_values;
+        };
+
+        struct Worker {
+            sol::state lua;
+            std::thread thread;
+            std::unordered_map<u32, sol::protected_function> functions;
+            std::vector<u32> to_forget; // systems that are gone, for `functions`
+
+            // this run's share of the matches
+            size_t begin = 0, end = 0;
+            bool has_job = false;
+
+            SnapshotWriter commands;
+            u64 command_count = 0;
+        };
+
+        Engine& engine;
+        sol::state& main_lua;
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        size_t busy = 0;
+        bool stopping = false;
+
+        Run run_state;
+        u32 next_id = 0;
+        std::vector<std::pair<u32, std::weak_ptr<const PureSystem>>> registered;
+        std::unordered_set<std::string> warned_no_fields;
+
+        static std::vector<Field> fields_of(const ComponentStorage& storage);
+        void setup(Worker& worker);
+        void work(Worker& worker);
+        void run_share(Worker& worker);
+        sol::protected_function load(Worker& worker, const PureSystem& system);
+        bool gather(const PureSystem& system);
+        void play_back(const PureSystem& system, std::span<const u8> commands, u64 count);
+        void set_fields(const PureSystem& system, Entity e, const std::string& component, sol::object fields);
+        void forget_expired();
+
+        public:
+            PureSystemPool(Engine& engine, sol::state& main_lua, size_t worker_count);
+            ~PureSystemPool();
+
+            // throws if the callback can't run on a worker
+            std::shared_ptr<PureSystem> make_system(sol::protected_function callback, std::shared_ptr<LuaQuery> query, std::string where);
+
+            // runs it over its matches on the workers and plays back what they did.
+            // returns once it's all done
+            void run(const PureSystem& system);
+
+            size_t worker_count() const { return workers.size(); }
+
+            PureSystemPool(PureSystemPool&) = delete;
+            PureSystemPool& operator=(PureSystemPool&) = delete;
+    };
+}
@@ -6,15 +6,6 @@
 #include <filesystem>
 #include <fstream>
 #include <string_view>
-#include <thread>
-#include <chrono>
-
-#ifdef __linux__
-#include <sys/inotify.h>
-#include <unistd.h>
-#elif _WIN32
-#include <windows.h>
-#endif
 
 #include "spdlog/spdlog.h"
 
@@ -80,80 +71,6 @@ std::filesystem::path ResourceManager::convert_path(std::string_view path) {
     return assets_path / path;
 }
 
-void ResourceManager::watch_file(std::filesystem::path file_path, std::function<void()> callback) {
-// do nothing for emscripten
-#ifdef __EMSCRIPTEN__
-#else
-    std::thread thread {[=]() {
-#ifdef __linux__
-        int fd = inotify_init();
-        if (fd < 0) {
-            SPDLOG_ERROR("inotify_init failed. errno: {}, strerror: {}", errno, strerror(errno));
-            return;
-        }
-
-        int wd = inotify_add_watch(fd, file_path.c_str(), IN_MODIFY);
-        if (wd < 0) {
-            SPDLOG_ERROR("inotify_add_watch failed. errno: {}, strerror: {}", errno, strerror(errno));
-            return;
-        }
-
-        char buffer[1024];
-        while (true) {
-            int length = read(fd, buffer, sizeof(buffer));
-            if (length > 0) {
-                callback();
-            }
-            inotify_add_watch(fd, file_path.c_str(), IN_MODIFY);
-        }
-#elif _WIN32
-        try {
-            // Start by noting the last write time. If the file doesn't exist yet,
-            // last_write_time will throw; swallow that and retry until it exists.
-            std::error_code ec;
-            auto last_write = std::filesystem::last_write_time(file_path, ec);
-            if (ec) {
-                // file may not exist yet - keep looping until it does
-                while (true) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(250));
-                    last_write = std::filesystem::last_write_time(file_path, ec);
-                    if (!ec) break;
-                }
-            }
-
-            while (true) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(250));
-
-                std::error_code ec2;
-                auto now_write = std::filesystem::last_write_time(file_path, ec2);
-                if (ec2) {
-                    // if the file was removed or is otherwise unreadable, just wait
-                    continue;
-                }
-
-                if (now_write != last_write) {
-                    last_write = now_write;
-                    try {
-                        callback();
-                    } catch (const std::exception& e) {
-                        SPDLOG_ERROR("watch_file callback threw exception: {}", e.what());
-                    } catch (...) {
-                        SPDLOG_ERROR("watch_file callback threw unknown exception");
-                    }
-                }
-            }
-        } catch (const std::filesystem::filesystem_error& e) {
-            SPDLOG_ERROR("watch_file failed: {}", e.what());
-            return;
-        }
-#else
-    #warning "No hot reload handling!"
-#endif
-    }};
-    thread.detach();
-#endif
-}
-
 bool ResourceManager::load_resource(std::string_view resource_path) {
    // maybe we loaded it already?
     if (path_to_resource_map.contains(svhasher{}(resource_path))) {
@@ -193,6 +110,25 @@ void ResourceManager::insert_resource(std::string_view resource_path, Resource&&
     path_to_resource_map.insert({ svhasher{}(resource_path), std::move(resource) /* ??? how tf does std::move-ing an rvalue work ??? */ });
 }
 
+ResourceHandle ResourceManager::handle(std::string_view resource_path) {
+    std::string key = { resource_path.begin(), resource_path.end() };
+    auto it = handle_ids.find(key);
+    if (it != handle_ids.end()) return it->second;
+
+    ResourceHandle ret = handles.size();
+    handles.push_back(HandleInfo { .path = key, .hash = svhasher{}(resource_path) });
+    handle_ids.emplace(key, ret);
+    return ret;
+}
+
+bool ResourceManager::load_resource(ResourceHandle handle) {
+    if (path_to_resource_map.contains(handles.at(handle).hash)) {
+        return true;
+    }
+
+    return load_resource(std::string_view(handles.at(handle).path));
+}
+
 void ResourceManager::register_resource_loader(std::unique_ptr<ILoadResources> resource_loader) {
     resource_loaders.push_back(std::move(resource_loader));
 }
@@ -1,6 +1,9 @@
+#pragma once
+
 #include <filesystem>
 #include <fstream>
 #include <optional>
+#include <string>
 #include <typeinfo>
 #include <unordered_map>
 #include <vector>
@@ -9,6 +12,7 @@
 #include <spdlog/spdlog.h>
 
 #include "types.h"
+#include "file_watcher.h"
 
 // resource manager needs to
 // 1. convert paths "file.txt" to "cwd://assets/file.txt"
@@ -60,12 +64,23 @@ namespace motorcar {
             virtual ~ILoadResources() = default;
     };
 
+    // a small integer standing in for a resource path, see ResourceManager::handle
+    typedef u32 ResourceHandle;
+
     class ResourceManager {
         typedef std::hash<std::string_view> svhasher;
         // std::hash<std::string_view>() -> size_t
         std::unordered_map<size_t, Resource> path_to_resource_map;
         std::vector<std::unique_ptr<ILoadResources>> resource_loaders;
 
+        // the path behind each handle and its hash, worked out once
+        struct HandleInfo {
+            std::string path;
+            size_t hash;
+        };
+        std::vector<HandleInfo> handles;
+        std::unordered_map<std::string, ResourceHandle> handle_ids;
+
         public:
             void register_resource_loader(std::unique_ptr<ILoadResources> resource_loader);
             static std::filesystem::path convert_path(std::string_view path);
@@ -77,7 +92,21 @@ namespace motorcar {
             bool load_resource(std::string_view resource_path);
             void insert_resource(std::string_view resource_path, Resource&& resource);
 
-            static void watch_file(std::filesystem::path file_path, std::function<void()> callback);
+            // handles let lua (or anything else asking every frame) skip hashing
+            // the path. getting one doesn't load the resource.
+            ResourceHandle handle(std::string_view resource_path);
+            const std::string& path_of(ResourceHandle handle) const { return handles.at(handle).path; }
+            template <typename T>
+            std::optional<T*> get_resource(ResourceHandle handle);
+            bool load_resource(ResourceHandle handle);
+
+            // hot reload. see file_watcher.h; callbacks run from deliver_file_changes
+            FileWatcher watcher;
+            WatchId watch_file(std::filesystem::path file_path, std::function<void()> callback, std::string owner = "") {
+                return watcher.watch(file_path, std::move(callback), std::move(owner));
+            }
+            void unwatch_files_owned_by(std::string_view owner) { watcher.unwatch_owned_by(owner); }
+            size_t deliver_file_changes() { return watcher.deliver(); }
     };
 }
 
@@ -102,6 +131,17 @@ std::optional<T*> motorcar::ResourceManager::get_resource(std::string_view resou
     }
 }
 
+template <typename T>
+std::optional<T*> motorcar::ResourceManager::get_resource(ResourceHandle handle) {
+    // already loaded is the common case, and it's one integer lookup
+    auto it = path_to_resource_map.find(handles.at(handle).hash);
+    if (it != path_to_resource_map.end()) {
+        return it->second.get<T>();
+    }
+
+    return get_resource<T>(std::string_view(handles.at(handle).path));
+}
+
 template <typename T>
 bool motorcar::ResourceManager::has_resource(std::string_view resource_path) {
     if (!load_resource(resource_path)) {
@@ -0,0 +1,455 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <spdlog/spdlog.h>
+
+#include "schema.h"
+
+using namespace motorcar;
+using Type = ComponentSchema::Type;
+
+namespace {
+    struct TypeInfo {
+        std::string_view name;
+        Type type;
+        size_t size;
+        size_t align;
+    };
+
+    const TypeInfo TYPES[] = {
+        { "f32", Type::F32, sizeof(f32), alignof(f32) },
+        { "f64", Type::F64, sizeof(f64), alignof(f64) },
+        { "i32", Type::I32, sizeof(i32), alignof(i32) },
+        { "i64", Type::I64, sizeof(i64), alignof(i64) },
+        { "bool", Type::Bool, sizeof(bool), alignof(bool) },
+        { "entity", Type::Entity, sizeof(Entity), alignof(Entity) },
+        { "string", Type::String, sizeof(std::string), alignof(std::string) },
+        { "vec2", Type::Vec2, sizeof(vec2), alignof(vec2) },
+        { "vec3", Type::Vec3, sizeof(vec3), alignof(vec3) },
+        { "quat", Type::Quat, sizeof(quat), alignof(quat) },
+    };
+
+    const TypeInfo& info(Type type) {
+        for (const TypeInfo& t : TYPES) {
+            if (t.type == type) return t;
+        }
+        std::abort();
+    }
+
+    // what lua holds on to for each row
+    struct RowView {
+        const ComponentSchema* schema;
+        void* row;
+    };
+
+    void* field_pointer(void* row, const ComponentSchema::Field& field) {
+        return (void*)((size_t)row + field.offset);
+    }
+
+    // these are called straight from lua, so nothing here may be holding on
+    // to a c++ object when luaL_error jumps out
+
+    int row_index(lua_State* L) {
+        RowView* view = (RowView*)lua_touserdata(L, 1);
+        const ComponentSchema::Field* field = view->schema->find_field(L, 2);
+        if (field == nullptr) {
+            lua_pushnil(L);
+            return 1;
+        }
+
+        view->schema->push_field(L, *field, view->row);
+        return 1;
+    }
+
+    int row_newindex(lua_State* L) {
+        RowView* view = (RowView*)lua_touserdata(L, 1);
+        const ComponentSchema::Field* field = view->schema->find_field(L, 2);
+        if (field == nullptr) {
+            return luaL_error(L, "component %s has no field %s", view->schema->name.c_str(), luaL_tolstring(L, 2, nullptr));
+        }
+
+        if (!view->schema->set_field(L, *field, view->row, 3)) {
+            return luaL_error(L, "%s.%s should be a %s", view->schema->name.c_str(), field->name.c_str(), info(field->type).name.data());
+        }
+        return 0;
+    }
+
+    int row_tostring(lua_State* L) {
+        RowView* view = (RowView*)lua_touserdata(L, 1);
+        lua_pushfstring(L, "%s: %p", view->schema->name.c_str(), view->row);
+        return 1;
+    }
+
+    // every metamethod of a view that's been invalidated. the view's pointers
+    // could be dangling, so this only looks at its upvalues: the component's
+    // name and when the view went stale
+    int stale_row(lua_State* L) {
+        return luaL_error(L, "this %s was handed out %s. get it again.",
+            lua_tostring(L, lua_upvalueindex(1)), lua_tostring(L, lua_upvalueindex(2)));
+    }
+
+    // pushes the three metamethods stale_row stands in for onto the table at the top of the stack
+    void set_stale_metamethods(lua_State* L, std::string_view component_name, const char* why) {
+        for (const char* metamethod : { "__index", "__newindex", "__tostring" }) {
+            lua_pushlstring(L, component_name.data(), component_name.size());
+            lua_pushstring(L, why);
+            lua_pushcclosure(L, stale_row, 2);
+            lua_setfield(L, -2, metamethod);
+        }
+    }
+}
+
+ComponentSchema::ComponentSchema(std::string name, sol::table field_types) : name(std::move(name)) {
+    sol::state_view lua(field_types.lua_state());
+
+    std::vector<std::pair<sol::object, sol::object>> pairs;
+    field_types.for_each([&](sol::object key, sol::object value) {
+        pairs.emplace_back(key, value);
+    });
+
+    for (auto& [key, value] : pairs) {
+        if (!key.is<std::string>() || !value.is<std::string>()) {
+            throw std::runtime_error(std::format("schema of component {} should look like {{ field = \"type\" }}.", this->name));
+        }
+
+        std::string type_name = value.as<std::string>();
+        auto type = std::find_if(std::begin(TYPES), std::end(TYPES), [&](const TypeInfo& t) { return t.name == type_name; });
+        if (type == std::end(TYPES)) {
+            throw std::runtime_error(std::format("field {}.{} has unknown type {}.", this->name, key.as<std::string>(), type_name));
+        }
+
+        fields.push_back(Field { .name = key.as<std::string>(), .type = type->type, .offset = 0 });
+    }
+
+    // lua doesn't keep the table in order, so sort it to get the same layout
+    // every time (snapshots depend on it). biggest alignment first packs it tightly.
+    std::sort(fields.begin(), fields.end(), [](const Field& a, const Field& b) { return a.name < b.name; });
+    std::stable_sort(fields.begin(), fields.end(), [](const Field& a, const Field& b) {
+        return info(a.type).align > info(b.type).align;
+    });
+
+    for (Field& field : fields) {
+        const TypeInfo& type = info(field.type);
+        size = (size + type.align - 1) / type.align * type.align;
+        field.offset = size;
+        size += type.size;
+        align = std::max(align, type.align);
+
+        if (field.type == Type::String) trivially_copyable = false;
+        if (field.type == Type::Entity) has_entities = true;
+    }
+    size = std::max((size + align - 1) / align * align, align);
+
+    lua_State* L = lua.lua_state();
+    for (Field& field : fields) {
+        keys.push_back(sol::make_object(lua, field.name));
+        keys.back().push();
+        key_pointers.push_back(lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+
+    metatable = lua.create_table();
+    metatable["__name"] = this->name;
+    metatable.push();
+    lua_pushcfunction(L, row_index);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, row_newindex);
+    lua_setfield(L, -2, "__newindex");
+    lua_pushcfunction(L, row_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pop(L, 1);
+}
+
+void ComponentSchema::invalidate_views() const {
+    lua_State* L = metatable.lua_state();
+
+    metatable.push(L);
+    set_stale_metamethods(L, name, "before the component was redefined");
+    lua_pop(L, 1);
+}
+
+void motorcar::make_views_stale(std::span<const sol::object> views, std::string_view component_name, const char* why) {
+    // only userdata. a metatable set on anything else is shared by its whole type
+    auto is_view = [](const sol::object& view) { return view.valid() && view.get_type() == sol::type::userdata; };
+    auto first = std::find_if(views.begin(), views.end(), is_view);
+    if (first == views.end()) return;
+    lua_State* L = first->lua_state();
+
+    // one metatable for all of them. it's only swapped on these userdata, the
+    // usertype's (or schema's) own metatable is left alone
+    lua_createtable(L, 0, 3);
+    set_stale_metamethods(L, component_name, why);
+
+    for (const sol::object& view : views) {
+        if (!is_view(view)) continue;
+        view.push(L);
+        lua_pushvalue(L, -2);
+        lua_setmetatable(L, -2);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+}
+
+bool ComponentSchema::same_layout(const ComponentSchema& other) const {
+    if (size != other.size || fields.size() != other.fields.size()) return false;
+
+    for (size_t idx = 0; idx < fields.size(); idx++) {
+        const Field& a = fields[idx];
+        const Field& b = other.fields[idx];
+        if (a.name != b.name || a.type != b.type || a.offset != b.offset) return false;
+    }
+    return true;
+}
+
+const ComponentSchema::Field* ComponentSchema::find_field(lua_State* L, int index) const {
+    if (lua_type(L, index) != LUA_TSTRING) return nullptr;
+
+    const char* key = lua_tostring(L, index);
+    for (size_t idx = 0; idx < key_pointers.size(); idx++) {
+        if (key_pointers[idx] == key) return &fields[idx];
+    }
+
+    // long strings aren't interned
+    for (const Field& field : fields) {
+        if (field.name == key) return &field;
+    }
+    return nullptr;
+}
+
+bool motorcar::set_field_value(lua_State* L, FieldType type, void* ptr, int index) {
+    int is_number = 0;
+
+    switch (type) {
+        case Type::F32: {
+            lua_Number n = lua_tonumberx(L, index, &is_number);
+            if (is_number) *(f32*)ptr = (f32)n;
+            return is_number;
+        }
+        case Type::F64: {
+            lua_Number n = lua_tonumberx(L, index, &is_number);
+            if (is_number) *(f64*)ptr = (f64)n;
+            return is_number;
+        }
+        case Type::I32: {
+            lua_Integer n = lua_tointegerx(L, index, &is_number);
+            if (is_number) *(i32*)ptr = (i32)n;
+            return is_number;
+        }
+        case Type::I64: {
+            lua_Integer n = lua_tointegerx(L, index, &is_number);
+            if (is_number) *(i64*)ptr = (i64)n;
+            return is_number;
+        }
+        case Type::Entity: {
+            lua_Integer n = lua_tointegerx(L, index, &is_number);
+            if (is_number) *(Entity*)ptr = (Entity)n;
+            return is_number;
+        }
+        case Type::Bool:
+            if (lua_type(L, index) != LUA_TBOOLEAN) return false;
+            *(bool*)ptr = lua_toboolean(L, index);
+            return true;
+        case Type::String: {
+            if (lua_type(L, index) != LUA_TSTRING) return false;
+            size_t len;
+            const char* s = lua_tolstring(L, index, &len);
+            ((std::string*)ptr)->assign(s, len);
+            return true;
+        }
+        case Type::Vec2:
+            if (!sol::stack::check<vec2>(L, index, sol::no_panic)) return false;
+            *(vec2*)ptr = sol::stack::get<vec2>(L, index);
+            return true;
+        case Type::Vec3:
+            if (!sol::stack::check<vec3>(L, index, sol::no_panic)) return false;
+            *(vec3*)ptr = sol::stack::get<vec3>(L, index);
+            return true;
+        case Type::Quat:
+            if (!sol::stack::check<quat>(L, index, sol::no_panic)) return false;
+            *(quat*)ptr = sol::stack::get<quat>(L, index);
+            return true;
+    }
+    return false;
+}
+
+void motorcar::push_field_value(lua_State* L, FieldType type, void* ptr) {
+    switch (type) {
+        case Type::F32: lua_pushnumber(L, *(f32*)ptr); break;
+        case Type::F64: lua_pushnumber(L, *(f64*)ptr); break;
+        case Type::I32: lua_pushinteger(L, *(i32*)ptr); break;
+        case Type::I64: lua_pushinteger(L, *(i64*)ptr); break;
+        case Type::Entity: lua_pushinteger(L, (lua_Integer)*(Entity*)ptr); break;
+        case Type::Bool: lua_pushboolean(L, *(bool*)ptr); break;
+        case Type::String: {
+            std::string& s = *(std::string*)ptr;
+            lua_pushlstring(L, s.data(), s.size());
+            break;
+        }
+        // by reference, so `t.position.x = 1` writes into the component
+        case Type::Vec2: sol::stack::push(L, (vec2*)ptr); break;
+        case Type::Vec3: sol::stack::push(L, (vec3*)ptr); break;
+        case Type::Quat: sol::stack::push(L, (quat*)ptr); break;
+    }
+}
+
+bool ComponentSchema::set_field(lua_State* L, const Field& field, void* row, int index) const {
+    return set_field_value(L, field.type, field_pointer(row, field), index);
+}
+
+void ComponentSchema::push_field(lua_State* L, const Field& field, void* row) const {
+    push_field_value(L, field.type, field_pointer(row, field));
+}
+
+std::string_view motorcar::field_type_name(FieldType type) {
+    return info(type).name;
+}
+
+void ComponentSchema::construct(void* dest) const {
+    memset(dest, 0, size);
+
+    for (const Field& field : fields) {
+        if (field.type == Type::String) new (field_pointer(dest, field)) std::string();
+        if (field.type == Type::Quat) *(quat*)field_pointer(dest, field) = quat(1, 0, 0, 0);
+    }
+}
+
+void ComponentSchema::construct_from_lua(void* dest, sol::object src) const {
+    construct(dest);
+    if (!src.valid()) return;
+
+    lua_State* L = src.lua_state();
+    auto fail = [&](std::string message) {
+        destroy(dest);
+        throw std::runtime_error(message);
+    };
+
+    if (src.get_type() == sol::type::userdata) {
+        src.push();
+        bool same_schema = false;
+        if (lua_getmetatable(L, -1)) {
+            metatable.push(L);
+            same_schema = lua_rawequal(L, -1, -2);
+            lua_pop(L, 2);
+        }
+        RowView* view = (RowView*)lua_touserdata(L, -1);
+        lua_pop(L, 1);
+
+        if (!same_schema) fail(std::format("component {} can't be made from a different userdata.", name));
+
+        for (const Field& field : fields) {
+            if (field.type == Type::String) {
+                *(std::string*)field_pointer(dest, field) = *(std::string*)field_pointer(view->row, field);
+            } else {
+                memcpy(field_pointer(dest, field), field_pointer(view->row, field), info(field.type).size);
+            }
+        }
+        return;
+    }
+
+    if (src.get_type() != sol::type::table) {
+        fail(std::format("component {} should be made from a table of its fields.", name));
+    }
+
+    std::vector<std::pair<sol::object, sol::object>> pairs;
+    src.as<sol::table>().for_each([&](sol::object key, sol::object value) {
+        pairs.emplace_back(key, value);
+    });
+
+    for (auto& [key, value] : pairs) {
+        key.push();
+        const Field* field = find_field(L, -1);
+        lua_pop(L, 1);
+
+        if (field == nullptr) {
+            fail(std::format("component {} has no field {}.", name, key.is<std::string>() ? key.as<std::string>() : "that isn't a string"));
+        }
+
+        value.push();
+        bool ok = set_field(L, *field, dest, -1);
+        lua_pop(L, 1);
+
+        if (!ok) fail(std::format("{}.{} should be a {}.", name, field->name, info(field->type).name));
+    }
+}
+
+void ComponentSchema::destroy(void* row) const {
+    if (trivially_copyable) return;
+
+    for (const Field& field : fields) {
+        if (field.type == Type::String) ((std::string*)field_pointer(row, field))->~basic_string();
+    }
+}
+
+void ComponentSchema::move(void* dest, void* src) const {
+    memcpy(dest, src, size);
+    if (trivially_copyable) return;
+
+    // the memcpy'd strings are just bytes, move the real ones over them
+    for (const Field& field : fields) {
+        if (field.type == Type::String) {
+            new (field_pointer(dest, field)) std::string(std::move(*(std::string*)field_pointer(src, field)));
+        }
+    }
+}
+
+sol::object ComponentSchema::make_view(void* row, sol::state& lua) const {
+    lua_State* L = lua.lua_state();
+
+    RowView* view = (RowView*)lua_newuserdatauv(L, sizeof(RowView), 0);
+    view->schema = this;
+    view->row = row;
+    metatable.push(L);
+    lua_setmetatable(L, -2);
+
+    return sol::stack::pop<sol::object>(L);
+}
+
+void ComponentSchema::write(void* src, SnapshotWriter& writer) const {
+    for (const Field& field : fields) {
+        if (field.type == Type::String) {
+            writer.write_string(*(std::string*)field_pointer(src, field));
+        } else {
+            writer.write_bytes(field_pointer(src, field), info(field.type).size);
+        }
+    }
+}
+
+void ComponentSchema::read(void* dest, SnapshotReader& reader) const {
+    construct(dest);
+
+    for (const Field& field : fields) {
+        if (field.type == Type::String) {
+            *(std::string*)field_pointer(dest, field) = reader.read_string();
+        } else {
+            reader.read_bytes(field_pointer(dest, field), info(field.type).size);
+        }
+    }
+}
+
+void ComponentSchema::remap_entities(void* row, const EntityRemap& remap) const {
+    for (const Field& field : fields) {
+        if (field.type != Type::Entity) continue;
+
+        Entity& e = *(Entity*)field_pointer(row, field);
+        if (remap.contains(e)) e = remap.at(e);
+    }
+}
+
+void ComponentSchema::migrate(void* dest, const ComponentSchema& other, void* src) const {
+    construct(dest);
+
+    for (const Field& field : fields) {
+        auto old = std::find_if(other.fields.begin(), other.fields.end(), [&](const Field& f) {
+            return f.name == field.name && f.type == field.type;
+        });
+        if (old == other.fields.end()) continue;
+
+        if (field.type == Type::String) {
+            *(std::string*)field_pointer(dest, field) = *(std::string*)field_pointer(src, *old);
+        } else {
+            memcpy(field_pointer(dest, field), field_pointer(src, *old), info(field.type).size);
+        }
+    }
+}
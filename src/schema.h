@@ -0,0 +1,194 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include "types.h"
+#include "traits.h"
+#include "snapshot.h"
+
+namespace motorcar {
+    // one field's value to and from the lua stack. `ptr` points at the field.
+    // vectors and quats are pushed by reference, so writing to them writes to the field
+    void push_field_value(lua_State* L, FieldType type, void* ptr);
+    // false if the value at `index` is the wrong type
+    bool set_field_value(lua_State* L, FieldType type, void* ptr, int index);
+    std::string_view field_type_name(FieldType type);
+
+    // gives each of `views` (component userdata handed to lua) a metatable that
+    // raises an error instead, so lua can't read or write through them anymore.
+    // `why` finishes "this <component> was handed out ..."
+    void make_views_stale(std::span<const sol::object> views, std::string_view component_name, const char* why);
+
+    // the layout of a component defined from lua, like
+    //   ECS.define_component("enemy", { direction = "vec3", wants = "string", speed = "f32" })
+    //
+    // rows live in a ComponentStorage like any native component, so they're dense,
+    // native queries see them and they go into snapshots. lua gets a userdata per
+    // row, whose __index/__newindex go straight to the field's bytes.
+    //
+    // field types: f32, f64, i32, i64, bool, entity, string, vec2, vec3, quat
+    struct ComponentSchema {
+        using Type = FieldType;
+
+        struct Field {
+            std::string name;
+            Type type;
+            size_t offset;
+        };
+
+        std::string name;
+        std::vector<Field> fields;
+        size_t size = 0;
+        size_t align = 1;
+        bool trivially_copyable = true;
+        bool has_entities = false;
+
+        // the field names as lua strings. short lua strings are interned, so
+        // __index can usually find a field by comparing pointers.
+        std::vector<sol::object> keys;
+        std::vector<const char*> key_pointers;
+        sol::table metatable;
+
+        // `fields` is { field_name = "type", ... }
+        ComponentSchema(std::string name, sol::table fields);
+
+        // same names, types and layout
+        bool same_layout(const ComponentSchema& other) const;
+
+        // the field named by the string at `index` on the stack, or null
+        const Field* find_field(lua_State* L, int index) const;
+        // sets a field from the value at `index` on the stack. false if it's the wrong type
+        bool set_field(lua_State* L, const Field& field, void* row, int index) const;
+        void push_field(lua_State* L, const Field& field, void* row) const;
+
+        // every field zeroed, strings empty
+        void construct(void* dest) const;
+        // from nil, a table of fields or another row of this schema
+        void construct_from_lua(void* dest, sol::object src) const;
+        void destroy(void* row) const;
+        void move(void* dest, void* src) const;
+        sol::object make_view(void* row, sol::state& lua) const;
+        // views point straight at the schema and the row. once either is about
+        // to go away, this makes every view of this schema raise an error
+        // instead. the views all share this schema's metatable, so it's one table to change
+        void invalidate_views() const;
+
+        void write(void* src, SnapshotWriter& writer) const;
+        void read(void* dest, SnapshotReader& reader) const;
+        void remap_entities(void* row, const EntityRemap& remap) const;
+
+        // copies the fields both schemas have, with the same type, from `src` (a row of `other`)
+        void migrate(void* dest, const ComponentSchema& other, void* src) const;
+    };
+
+    namespace native_fields {
+        // which of the `count` fields the key at stack index 2 names, or -1.
+        // the field names are upvalues 2 and on, and short strings are
+        // interned, so this is mostly pointer compares
+        inline int find(lua_State* L, size_t count) {
+            if (lua_type(L, 2) != LUA_TSTRING) return -1;
+            for (size_t idx = 0; idx < count; idx++) {
+                if (lua_rawequal(L, 2, lua_upvalueindex(2 + idx))) return idx;
+            }
+            return -1;
+        }
+
+        template <typename T>
+        void* field_pointer(lua_State* L, const ComponentField& field) {
+#ifndef NDEBUG
+            // debug builds check self like sol would. release builds trust the metatable
+            if (!sol::stack::check<T>(L, 1, sol::no_panic)) {
+                luaL_error(L, "expected a %s", ComponentTypeTrait<T>::component_name.data());
+            }
+#endif
+            T* self = sol::stack::unqualified_get<T*>(L, 1);
+            return (void*)((size_t)self + field.offset);
+        }
+
+        // upvalue 1 is sol's __index, for everything that isn't a field
+        template <typename T>
+        int index(lua_State* L) {
+            constexpr auto& fields = ComponentTypeTrait<T>::fields;
+            int field = find(L, fields.size());
+            if (field >= 0) {
+                push_field_value(L, fields[field].type, field_pointer<T>(L, fields[field]));
+                return 1;
+            }
+
+            lua_pushvalue(L, lua_upvalueindex(1));
+            switch (lua_type(L, -1)) {
+                case LUA_TTABLE:
+                    lua_pushvalue(L, 2);
+                    lua_gettable(L, -2);
+                    return 1;
+                case LUA_TFUNCTION:
+                    lua_pushvalue(L, 1);
+                    lua_pushvalue(L, 2);
+                    lua_call(L, 2, 1);
+                    return 1;
+                default:
+                    lua_pushnil(L);
+                    return 1;
+            }
+        }
+
+        // upvalue 1 is sol's __newindex
+        template <typename T>
+        int newindex(lua_State* L) {
+            constexpr auto& fields = ComponentTypeTrait<T>::fields;
+            int field = find(L, fields.size());
+            if (field >= 0) {
+                if (!set_field_value(L, fields[field].type, field_pointer<T>(L, fields[field]), 3)) {
+                    return luaL_error(L, "%s.%s should be a %s",
+                        ComponentTypeTrait<T>::component_name.data(), fields[field].name.data(), field_type_name(fields[field].type).data());
+                }
+                return 0;
+            }
+
+            lua_pushvalue(L, lua_upvalueindex(1));
+            lua_pushvalue(L, 1);
+            lua_pushvalue(L, 2);
+            lua_pushvalue(L, 3);
+            lua_call(L, 3, 0);
+            return 0;
+        }
+
+        // swaps `name` on the metatable at the top of the stack for `func`, keeping the old one as upvalue 1
+        template <size_t N>
+        void replace(lua_State* L, const char* name, lua_CFunction func, const std::array<ComponentField, N>& fields) {
+            lua_getfield(L, -1, name);
+            for (const ComponentField& field : fields) {
+                lua_pushlstring(L, field.name.data(), field.name.size());
+            }
+            lua_pushcclosure(L, func, 1 + fields.size());
+            lua_setfield(L, -2, name);
+        }
+    }
+
+    // reads and writes the fields in ComponentTypeTrait<T>::fields straight
+    // from the component's memory, instead of through sol's usertype lookup and
+    // its checks. everything else on the usertype still goes to sol. call it
+    // after the usertype is done, once all its methods are on it
+    template <typename T>
+    void bind_native_fields(sol::state& lua) {
+        constexpr auto& fields = ComponentTypeTrait<T>::fields;
+        static_assert(fields.size() > 0, "list the component's fields in its trait first");
+
+        lua_State* L = lua.lua_state();
+        // values and references (which is how components get handed out) have their own metatables
+        for (const std::string* name : { &sol::usertype_traits<T>::metatable(), &sol::usertype_traits<T*>::metatable() }) {
+            if (luaL_getmetatable(L, name->c_str()) != LUA_TTABLE) {
+                lua_pop(L, 1);
+                continue;
+            }
+            native_fields::replace(L, "__index", native_fields::index<T>, fields);
+            native_fields::replace(L, "__newindex", native_fields::newindex<T>, fields);
+            lua_pop(L, 1);
+        }
+    }
+}
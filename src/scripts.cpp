@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "GLFW/glfw3.h"
@@ -13,9 +18,14 @@
 #include "sound.h"
 #include "ecs.h"
 #include "components.h"
+#include "snapshot.h"
+#include "timers.h"
+#include "lua_query.h"
+#include "kernels.h"
+#include "bytecode.h"
+#include "logging.h"
 
 using namespace motorcar;
-using Tables = std::vector<sol::table>;
 
 #define TOKCAT2(t1, t2) t1 ## t2
 #define TOKCAT(t1, t2) TOKCAT2(t1, t2)
@@ -24,6 +34,7 @@ namespace {
     struct Event {
         std::string name;
         Event(std::string name) : name(name) {}
+        Event(EventId event) : name(event_name(event)) {}
     };
 
     struct CallInfo {
@@ -31,6 +42,15 @@ namespace {
         int lineno;
     }; 
 
+    // lua interns chunk names, so the pointer is enough to tell scripts apart
+    using CallSite = std::pair<const char*, int>;
+    struct CallSiteHash {
+        size_t operator()(const CallSite& site) const { return std::hash<const void*>{}(site.first) ^ ((size_t)site.second * 0x9e3779b97f4a7c15); }
+    };
+
+    const f64 LUA_LOG_PER_SEC = 10.;
+    const f64 LUA_LOG_BURST = 20.;
+
     template <typename ...Args>
     bool pcall(sol::protected_function f, Args&& ...args) {
         sol::protected_function_result result = f(std::forward<Args>(args)...);
@@ -41,6 +61,59 @@ namespace {
         return result.valid();
     }
 
+    // where a system was registered, for errors, LuaAllocator's report and the profiler
+    struct SystemOrigin {
+        std::string where;
+        LuaAllocator* allocator;
+        u32 allocation_owner;
+        LuaProfiler* profiler;
+        u32 profiler_system;
+        SystemWatchdog* watchdog;
+        u32 watchdog_system;
+    };
+
+    // the watchdog stopped this run. if it was an outer system's budget that ran
+    // out (this is an event handler it fired), the error goes on up to it: the
+    // throw becomes a lua error in the ECS.fire_event call that got us here
+    void stop_for_budget(const SystemOrigin& origin) {
+        if (!origin.watchdog->tripped_by(origin.watchdog_system)) {
+            throw std::runtime_error(std::format("the system registered at {} went over its budget", origin.watchdog->tripped_where()));
+        }
+    }
+
+    // like pcall, but says which system the error came from
+    template <typename ...Args>
+    bool pcall_system(const SystemOrigin& origin, sol::protected_function f, Args&& ...args) {
+        // the watchdog already stopped this run, don't start the next entity's callback
+        if (origin.watchdog->tripped()) {
+            stop_for_budget(origin);
+            return false;
+        }
+
+        LuaAllocator::Scope allocation_scope(origin.allocator, origin.allocation_owner);
+        LuaProfiler::Scope profile_scope(origin.profiler, origin.profiler_system);
+        sol::protected_function_result result = f(std::forward<Args>(args)...);
+        if (!result.valid()) {
+            if (origin.watchdog->tripped()) stop_for_budget(origin);
+
+            sol::error error = result;
+            spdlog::error("Caught lua error in system registered at {}: {}", origin.where, error.what());
+        }
+        return result.valid();
+    }
+
+    // { instructions = 1000000, ms = 4 }, either can be left out
+    SystemBudget system_budget_from_lua(sol::object object) {
+        if (!object.is<sol::table>()) {
+            throw std::runtime_error("a budget should be a table like { instructions = 1000000, ms = 4 }.");
+        }
+        sol::table t = object.as<sol::table>();
+        return SystemBudget {
+            .instructions = t.get_or<u64>("instructions", 0),
+            .secs = t.get_or<f64>("ms", 0.) / 1000.,
+        };
+    }
+
     std::optional<CallInfo> get_debug_info(sol::state& lua) {
         lua_Debug ld;
         if (!lua_getstack(lua.lua_state(), 1, &ld)) return {};
@@ -51,9 +124,10 @@ namespace {
 
     class ScriptLoader : public ILoadResources {
         sol::state& lua;
+        BytecodeCache& bytecode;
 
         public:
-            ScriptLoader(sol::state& lua) : lua(lua) {}
+            ScriptLoader(sol::state& lua, BytecodeCache& bytecode) : lua(lua), bytecode(bytecode) {}
 
             virtual std::optional<Resource> load_resource(const std::filesystem::path&, std::ifstream& file_stream, std::string_view resource_path) {
                 if (!resource_path.ends_with(".lua")) {
@@ -67,7 +141,7 @@ namespace {
                 // it also requires a reference to a string view for the code for whatever reason
                 std::string owned_resource_path{ resource_path.data(), resource_path.size() };
                 
-                sol::load_result result = lua.load(lua_code, owned_resource_path);
+                sol::load_result result = bytecode.load(lua, lua_code, owned_resource_path);
 
                 if (result.valid()) {
                     return sol::protected_function(result);
@@ -79,167 +153,171 @@ namespace {
             };
     };
 
-    Tables query(sol::state& lua, ECSWorld& ecs, sol::table query) {
-        Tables ret;
+    std::string script_name_of(const std::filesystem::path& file_path) {
+        return file_path.lexically_relative(std::filesystem::current_path()).string();
+    }
 
-        if (!query.valid()) {
-            throw std::runtime_error("query not specified.");
-        }
+    // the .lua files under `directory`, then the bundled scripts under it that aren't on disk
+    std::vector<std::filesystem::path> scripts_under(ScriptManager& script_manager, const std::filesystem::path& directory) {
+        std::vector<std::filesystem::path> ret;
+        std::unordered_set<std::string> on_disk;
 
-        if (query.size() == 0) {
-            ret.push_back(sol::table(lua, sol::create));
-            return ret;
+        if (std::filesystem::exists(directory)) {
+            for (auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+                if (entry.is_regular_file() and entry.path().extension() == ".lua") {
+                    ret.push_back(entry.path());
+                    on_disk.insert(script_name_of(entry.path()));
+                }
+            }
         }
 
-#define STRCMP(object, s) (object.is<std::string>() && object.get<std::string>() == s)
-        // are entity only queries desirable?
-        if (query.size() == 1 && STRCMP(query[1],std::string("entity"))) {
-            // TODO: is throwing bad here?
-            throw std::runtime_error("component list of just 'entity' not supported.");
+        std::string prefix = (std::filesystem::path(script_name_of(directory)) / "").string();
+        for (const std::string& script_name : script_manager.bytecode.bundled_under(prefix)) {
+            if (!on_disk.contains(script_name)) ret.push_back(std::filesystem::current_path() / script_name);
         }
-#undef STRCMP
-
-        std::vector<std::string> component_names;
-        for (size_t idx = 1; idx <= query.size(); idx++) {
-            component_names.push_back(query[idx].get<std::string>());
-        }
-
-        auto view = component_names | std::views::filter([](auto s) { return s != "entity"; });
-        auto first_component_name = *view.begin();
-        std::vector<Entity> starting_entites;
+        return ret;
+    }
 
-        if (ecs.native_component_exists(first_component_name)) {
-            starting_entites = ecs.get_entities_from_native_component_name(first_component_name);
-        } else if (ecs.lua_storage[first_component_name].valid()) {
-            ecs.lua_storage[first_component_name].get<sol::table>().for_each([&](sol::object e, sol::object) {
-                starting_entites.push_back(e.as<Entity>());
-            });
-        } else {
-            SPDLOG_WARN("requested component {} doesn't exist in ECS.", first_component_name);
-            return ret;
-        }
-        
-        std::unordered_set<Entity> entities(starting_entites.begin(), starting_entites.end());
-
-        std::vector<Entity> to_remove;
-        for (auto component_name : component_names | std::views::drop(1)) {
-            if (component_name == "entity") continue;
-            for (Entity e : entities) {
-                bool is_native_component = ecs.native_component_exists(component_name);
-                bool is_lua_component = ecs.lua_storage[component_name].valid();
-
-                // if the component doesn't exist in the ecs, give up
-                if (!is_native_component && !is_lua_component) {
-                    to_remove.push_back(e);
-                // if the component does exist in the native storage, but this entity doesn't have it, filter
-                } else if (is_native_component && !ecs.entity_has_native_component(e, component_name)) {
-                    to_remove.push_back(e);
-                // ditto for lua
-                } else if (is_lua_component && !ecs.lua_storage[component_name][e].valid()) {
-                    to_remove.push_back(e);
-                }
-            }
+    bool script_exists(ScriptManager& script_manager, const std::filesystem::path& file_path) {
+        return std::filesystem::exists(file_path) || script_manager.bytecode.is_bundled(script_name_of(file_path));
+    }
 
-            for (Entity e : to_remove) {
-                entities.erase(e);
-            }
+    // stages/<name>.lua first, then everything under stages/<name>/
+    std::vector<std::filesystem::path> scripts_of_stage(ScriptManager& script_manager, std::string_view stage_name) {
+        auto stages_path = std::filesystem::current_path() / "stages";
+        auto first_script = stages_path / std::format("{}.lua", stage_name);
 
-            to_remove.clear();
+        std::vector<std::filesystem::path> ret;
+        if (script_exists(script_manager, first_script)) {
+            ret.push_back(first_script);
         }
-
-        for (Entity e : entities) {
-            sol::table argument = sol::table(lua, sol::new_table());
-            for (auto component : component_names) {
-                bool is_native_component = ecs.native_component_exists(component);
-
-                if (component == "entity") {
-                    argument[component] = e;
-                } else {
-                    if (is_native_component) {
-                        argument[component] = ecs.get_native_component_as_lua_object(e, component, lua);
-                    } else {
-                        argument[component] = ecs.lua_storage[component][e];
-                    }
-                }
-            }
-            ret.push_back(argument);
+        for (auto& script : scripts_under(script_manager, stages_path / stage_name)) {
+            ret.push_back(script);
         }
         return ret;
     }
 
-    using I = std::vector<Tables>::iterator;
-    template <typename Func>
-    void f(
-        I begin, I end, 
-        Tables args, 
-        Func callback
-    ) {
-        if (begin == end) {
-            callback(args);
-            return;
-        }
+    std::filesystem::path baked_snapshot_of(std::string_view stage_name) {
+        return std::filesystem::current_path() / "stages" / std::format("{}.snapshot", stage_name);
+    }
 
-        for (sol::table arg : *begin) {
-            // NOTE: this is quite slow, O(n*m), where n is the number
-            // of queries the user is doing and m is the number of
-            // entities we've queried. This is a good spot to
-            // use the engine's ocean allocator, and/or a cons list.
-            Tables new_args;
-            new_args.reserve(args.size() + 1);
-            new_args.assign(args.begin(), args.end());
-            new_args.push_back(arg);
+    // what Stages.bake keeps: the stage's entities, minus the ones tagged with
+    // the `unbaked` component (e.g. ones that depend on Stages.props)
+    bool is_baked_into(ECSWorld& ecs, Entity e, const std::string& stage_name) {
+        auto bound_to_stage = ecs.get_native_component<const BoundToStage>(e);
+        if (!bound_to_stage.has_value() || (*bound_to_stage)->stage_name != stage_name) return false;
 
-            f(begin + 1, end, new_args, callback);
+        sol::object unbaked = ecs.lua_storage["unbaked"];
+        return !unbaked.is<sol::table>() || !unbaked.as<sol::table>()[e].valid();
+    }
+
+    // a baked stage's entities all come from its snapshot, so anything its scripts
+    // spawned on top (in [first, last)) is there twice. systems, tasks and kernel
+    // bindings belong to the scripts and aren't baked, those don't count
+    void check_baked_stage(ECSWorld& ecs, const std::string& stage_name, Entity first, Entity last) {
+        size_t spawned = 0;
+        for (Entity e = first; e < last; e++) {
+            if (!is_baked_into(ecs, e, stage_name)) continue;
+            if (ecs.entity_has_native_component<System>(e) || ecs.entity_has_native_component<EventHandler>(e) ||
+                    ecs.entity_has_native_component<Task>(e) || ecs.entity_has_native_component<KernelBinding>(e)) {
+                continue;
+            }
+            spawned++;
+        }
+
+        if (spawned > 0) {
+            SPDLOG_ERROR("stage {} was loaded from its baked snapshot, but its scripts spawned {} entities on top of it. "
+                "they should skip spawning when Stages.from_snapshot is set.", stage_name, spawned);
         }
     }
 
-    void load_and_execute_script(Engine& engine, const std::filesystem::path& file_path, bool watch = true) {
+    // `owner` is the stage the script belongs to, so its watch goes when the stage does
+    void load_and_execute_script(Engine& engine, const std::filesystem::path& file_path, std::string_view owner, bool watch = true) {
         ScriptManager& script_manager = *engine.scripts;
+        std::string script_name = script_name_of(file_path);
+        std::optional<sol::load_result> load_result;
+
         std::ifstream file_stream { file_path };
-        std::string script_name = file_path.lexically_relative(std::filesystem::current_path()).string();
-        if (file_stream.fail()) {
+        if (!file_stream.fail()) {
+            std::string code { std::istreambuf_iterator<char>(file_stream), std::istreambuf_iterator<char>() };
+            load_result = script_manager.bytecode.load(script_manager.lua, code, script_name);
+        } else if (script_manager.bytecode.is_bundled(script_name)) {
+            // shipped without its source
+            load_result = script_manager.bytecode.load_bundled(script_manager.lua, script_name);
+            watch = false;
+            if (!load_result.has_value()) {
+                SPDLOG_ERROR("failed loading bundled script {}.", script_name);
+                return;
+            }
+        } else {
             SPDLOG_ERROR("failed opening file backing {}.", file_path.string());
             return;
         }
 
-        std::string code { std::istreambuf_iterator<char>(file_stream), std::istreambuf_iterator<char>() };
-        sol::load_result load_result = script_manager.lua.load(code, script_name);
-
-        if (!load_result.valid()) {
-            sol::error err = load_result;
+        if (!load_result->valid()) {
+            sol::error err = *load_result;
             SPDLOG_ERROR("failed loading script {}: err.what(): {}", file_path.string(), err.what());
             return;
         }
 
-        sol::protected_function script = load_result;
+        sol::protected_function script = *load_result;
 
-        for (auto [e, bound_to_script] : engine.ecs->query<Entity, BoundToScript>()) {
+        for (auto [e, bound_to_script] : engine.ecs->query<Entity, const BoundToScript>()) {
             if (bound_to_script->script_name == script_name) {
                 engine.ecs->delete_entity(e);
             }
         }
 
-        if (pcall(script)) {
+        bool ran = false;
+        {
+            LuaAllocator::Scope allocation_scope(&script_manager.allocator, script_manager.allocator.owner(script_name));
+            ran = pcall(script);
+        }
+
+        if (ran) {
             if (watch) {
                 Engine* _engine = &engine;
-                ResourceManager::watch_file(file_path, 
-                    [=]() { 
-                        _engine->ecs->command_queue.push_command([=]() {
-                            load_and_execute_script(*_engine, file_path, false); 
-                        });
-                    }
+                engine.resources->watch_file(file_path,
+                    [=]() {
+                        load_and_execute_script(*_engine, file_path, "", false);
+                    },
+                    std::string(owner)
                 );
             }
         }
     }
 }
 
-ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
+ScriptManager::ScriptManager(Engine& engine) :
+    engine(engine),
+    lua(sol::default_at_panic, &LuaAllocator::allocate, &allocator),
+    tasks(engine, lua),
+    bytecode(std::filesystem::current_path() / ".cache" / "bytecode"),
+    gc(lua),
+    hooks(lua),
+    profiler(hooks),
+    watchdog(hooks)
+{
+    auto bundle_path = std::filesystem::current_path() / "scripts.bundle";
+    if (std::filesystem::exists(bundle_path)) {
+        bytecode.read_bundle(bundle_path);
+    }
+
     lua.open_libraries(sol::lib::base, sol::lib::math, sol::lib::table, sol::lib::string);
     engine.ecs->lua_storage = sol::table(lua, sol::new_table());
 
+    // the interned handle functions (Input.key, ECS.component_id, Events.id,
+    // Resources.handle) do the string work once, so code that runs every tick
+    // can hold on to the result instead. every function taking a name takes
+    // its handle too.
     sol::table input_namespace = lua["Input"].force();
-    #define INPUT_METHOD(name) input_namespace.set_function(#name, [&](std::string key_name) { return engine.input->name(Key::key_from_string(key_name)); })
+    input_namespace.set_function("key", [](std::string key_name) {
+        return Key::key_from_string(key_name).keycode;
+    });
+    #define INPUT_METHOD(name) input_namespace.set_function(#name, sol::overload( \
+        [&](int keycode) { return engine.input->name(Key(keycode)); }, \
+        [&](std::string key_name) { return engine.input->name(Key::key_from_string(key_name)); } \
+    ))
     INPUT_METHOD(is_key_held_down);
     INPUT_METHOD(is_key_pressed_this_frame);
     INPUT_METHOD(is_key_repeated_this_frame);
@@ -251,16 +329,23 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
     input_namespace.set_function("unlock_mouse", [&]() { engine.input->unlock_mouse(); });
 
 
+    // the level's checked before looking up who called, and each call site gets
+    // LUA_LOG_PER_SEC messages a second (after a burst of LUA_LOG_BURST), see logging.h
     sol::table log_namespace = lua["Log"].force();
-    #define LOG_FN(log_level) \
-    log_namespace.set_function(#log_level, [&](std::string message) {\
-        auto call_info = get_debug_info(lua);\
-        spdlog::log_level("[{}:{}] {}", call_info->filename, call_info->lineno, message);\
+    auto log_limits = std::make_shared<std::unordered_map<CallSite, LogRateLimit, CallSiteHash>>();
+    #define LOG_FN(log_level, level_enum) \
+    log_namespace.set_function(#log_level, [&, log_limits](std::string_view message) {\
+        if (!spdlog::should_log(spdlog::level::level_enum)) return;\
+        auto call_info = get_debug_info(lua).value_or(CallInfo { .filename = "?", .lineno = 0 });\
+        auto limit = log_limits->try_emplace(CallSite { call_info.filename, call_info.lineno }, LUA_LOG_PER_SEC, LUA_LOG_BURST).first;\
+        u64 dropped = 0;\
+        if (!limit->second.allow(dropped)) return;\
+        spdlog::log_level("[{}:{}] {}{}", call_info.filename, call_info.lineno, message, dropped_note(dropped));\
     })
-    LOG_FN(trace);
-    LOG_FN(debug);
-    LOG_FN(warn);
-    LOG_FN(error);
+    LOG_FN(trace, trace);
+    LOG_FN(debug, debug);
+    LOG_FN(warn, warn);
+    LOG_FN(error, err);
     #undef LOG_FN
 
 
@@ -273,20 +358,100 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
             (*_lua)["Stages"]["props"] = props;
         });
     });
+    stages_namespace.set_function("bake", [&]() {
+        if (!engine.stage.has_value()) {
+            throw std::runtime_error("can't bake a stage when no stage is loaded.");
+        }
 
-    sol::table sound_namespace = lua["Sound"].force();
-    sound_namespace.set_function("play_sound", [&](std::string sound_name) {
-        engine.sound->play_sound(sound_name);
+        // queued, so everything the stage's scripts spawned is in the world by then
+        std::string stage_name = engine.stage.value();
+        ECSWorld* ecs = engine.ecs.get();
+        TimerWheel* timers = engine.timers.get();
+        engine.ecs->command_queue.push_command([=]() {
+            auto snapshot = WorldSnapshot::capture(*ecs, [=](Entity e) {
+                return is_baked_into(*ecs, e, stage_name);
+            });
+            snapshot.time_secs = timers->now_secs();
+
+            auto path = std::filesystem::current_path() / "stages" / std::format("{}.snapshot", stage_name);
+            if (snapshot.write_to_file(path)) {
+                SPDLOG_INFO("baked stage {} into {} ({} bytes).", stage_name, path.string(), snapshot.size_in_bytes());
+            }
+        });
+    });
+    stages_namespace["from_snapshot"] = false;
+    // gets the slow parts of changing to a stage done ahead of time, see stage_preloader.h.
+    // is_preloaded says when it's all done, for loading screens
+    stages_namespace.set_function("preload", [&](std::string stage_name) {
+        preload_stage(stage_name);
     });
-    sound_namespace.set_function("play_music", [&](std::string sound_name) {
-        engine.sound->play_music(sound_name);
+    stages_namespace.set_function("is_preloaded", [&](std::string stage_name) {
+        return preloader.is_ready(stage_name);
+    });
+
+    // compiles every script under plugins/ and stages/ into scripts.bundle, for
+    // shipping. when it's there, scripts load from it instead of being parsed,
+    // and the sources don't need to ship at all
+    sol::table scripts_namespace = lua["Scripts"].force();
+    scripts_namespace.set_function("bundle", [&]() {
+        auto cwd = std::filesystem::current_path();
+
+        std::vector<std::pair<std::string, std::filesystem::path>> scripts;
+        for (auto directory : { cwd / "plugins", cwd / "stages" }) {
+            if (!std::filesystem::exists(directory)) continue;
+            for (auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+                if (entry.is_regular_file() and entry.path().extension() == ".lua") {
+                    scripts.emplace_back(script_name_of(entry.path()), entry.path());
+                }
+            }
+        }
+
+        auto path = cwd / "scripts.bundle";
+        if (!bytecode.write_bundle(lua, scripts, path)) {
+            throw std::runtime_error("couldn't write scripts.bundle, see the log.");
+        }
+        SPDLOG_INFO("bundled {} scripts into {}.", scripts.size(), path.string());
+    });
+
+    sol::table snapshot_namespace = lua["Snapshot"].force();
+    snapshot_namespace.set_function("save", [&](std::string path) {
+        ECSWorld* ecs = engine.ecs.get();
+        TimerWheel* timers = engine.timers.get();
+        engine.ecs->command_queue.push_command([=]() {
+            auto snapshot = WorldSnapshot::capture(*ecs);
+            snapshot.time_secs = timers->now_secs();
+            snapshot.write_to_file(path);
+        });
+    });
+    snapshot_namespace.set_function("load", [&](std::string path) {
+        ECSWorld* ecs = engine.ecs.get();
+        TimerWheel* timers = engine.timers.get();
+        engine.ecs->command_queue.push_command([=]() {
+            if (auto snapshot = WorldSnapshot::read_from_file(path)) {
+                snapshot->restore(*ecs, WorldSnapshot::RestoreMode::Replace, timers->now_secs());
+            }
+        });
     });
 
+    sol::table sound_namespace = lua["Sound"].force();
+    sound_namespace.set_function("play_sound", sol::overload(
+        [&](ResourceHandle handle) { engine.sound->play_sound(handle); },
+        [&](std::string sound_name) { engine.sound->play_sound(sound_name); }
+    ));
+    sound_namespace.set_function("play_music", sol::overload(
+        [&](ResourceHandle handle) { engine.sound->play_music(handle); },
+        [&](std::string sound_name) { engine.sound->play_music(sound_name); }
+    ));
+
 
     sol::table resources_namespace = lua["Resources"].force();
-    resources_namespace.set_function("load_resource", [&](std::string resource_path) {
-        engine.resources->load_resource(resource_path);
+    resources_namespace.set_function("handle", [&](std::string resource_path) {
+        return engine.resources->handle(resource_path);
     });
+    resources_namespace.set_function("load_resource", sol::overload(
+        [&](ResourceHandle handle) { engine.resources->load_resource(handle); },
+        [&](std::string resource_path) { engine.resources->load_resource(resource_path); }
+    ));
 
 
     sol::table engine_namespace = lua["Engine"].force();
@@ -299,6 +464,225 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
     engine_namespace.set_function("delta", [&]() {
         return engine.delta;
     });
+    engine_namespace.set_function("tick", [&]() {
+        return engine.tick;
+    });
+    engine_namespace.set_function("enable_rewind", [&](size_t ticks) {
+        engine.enable_rewind(ticks);
+    });
+    // both happen at the end of the frame, never in the middle of a system
+    engine_namespace.set_function("rewind", [&](u64 tick) {
+        engine.pending_rewind = std::make_pair(tick, 0u);
+    });
+    engine_namespace.set_function("resimulate", [&](u64 tick, u32 ticks) {
+        engine.pending_rewind = std::make_pair(tick, ticks);
+    });
+    engine_namespace.set_function("set_frame_budget", [&](double secs) {
+        engine.frame_budget_secs = secs;
+    });
+    // "throughput" or "latency", see PacingMode
+    engine_namespace.set_function("set_pacing_mode", [&](std::string mode_name) {
+        if (mode_name == "throughput") {
+            engine.pacing_mode = PacingMode::Throughput;
+        } else if (mode_name == "latency") {
+            engine.pacing_mode = PacingMode::Latency;
+        } else {
+            throw std::runtime_error(std::format("unknown pacing mode '{}', expected throughput or latency.", mode_name));
+        }
+    });
+    // "incremental" or "generational", and how long the collector gets after each frame
+    engine_namespace.set_function("set_gc_mode", [&](std::string mode_name) {
+        auto mode = LuaGc::mode_from_string(mode_name);
+        if (!mode.has_value()) {
+            throw std::runtime_error(std::format("unknown gc mode '{}', expected incremental or generational.", mode_name));
+        }
+        gc.set_mode(mode.value());
+    });
+    engine_namespace.set_function("set_gc_budget", [&](double secs) {
+        gc.budget_secs = secs;
+    });
+    // who's been allocating lua memory since the last reset, most bytes first:
+    // { { name = "stages/init.lua:12", allocations = 1200, bytes = 96000 }, ... }
+    // systems go by where they were registered, scripts by their path
+    engine_namespace.set_function("memory_report", [&]() {
+        sol::table ret = lua.create_table();
+        for (auto& owner : allocator.report()) {
+            ret.add(lua.create_table_with(
+                "name", owner.name,
+                "allocations", owner.allocations,
+                "bytes", owner.bytes
+            ));
+        }
+        return ret;
+    });
+    engine_namespace.set_function("reset_memory_report", [&]() {
+        allocator.reset_report();
+    });
+    // samples lua's stack every `sample_every` instructions (1000 by default)
+    // and times every system, until stop_profiler. starting again clears it
+    engine_namespace.set_function("start_profiler", [&](sol::optional<u32> sample_every) {
+        profiler.start(sample_every.value_or(1000));
+    });
+    engine_namespace.set_function("stop_profiler", [&]() {
+        profiler.stop();
+    });
+    // {
+    //   running = true, samples = 5000,
+    //   systems = { { where = "stages/init.lua:12", script = "stages/init.lua", frame_calls = 1, frame_secs = 0.0004,
+    //                 calls = 600, secs = 0.2, samples = 1200 }, ... }, -- most time last frame first
+    //   lines = { { line = "stages/init.lua:20", samples = 300 }, ... },    -- the 20 lines with the most samples
+    // }
+    engine_namespace.set_function("profile", [&]() {
+        sol::table systems = lua.create_table();
+        for (auto& system : profiler.system_report()) {
+            sol::table t = lua.create_table();
+            t["where"] = system.where;
+            t["script"] = system.script;
+            t["frame_calls"] = system.frame_calls;
+            t["frame_secs"] = system.frame_secs;
+            t["calls"] = system.calls;
+            t["secs"] = system.secs;
+            t["samples"] = system.samples;
+            systems.add(t);
+        }
+
+        sol::table lines = lua.create_table();
+        for (auto& line : profiler.line_report(20)) {
+            lines.add(lua.create_table_with("line", line.line, "samples", line.samples));
+        }
+
+        return lua.create_table_with(
+            "running", profiler.is_running(),
+            "samples", profiler.sample_count(),
+            "systems", systems,
+            "lines", lines
+        );
+    });
+    // the budget systems registered without one of their own get, see watchdog.h.
+    // nil for none
+    engine_namespace.set_function("set_system_budget", [&](sol::object budget) {
+        watchdog.default_budget = budget.valid() ? system_budget_from_lua(budget) : SystemBudget {};
+    });
+    // lets throttled and disabled systems run again
+    engine_namespace.set_function("reset_system_budgets", [&]() {
+        watchdog.reset();
+    });
+    // { { where = "stages/init.lua:12", state = "ok" | "throttled" | "disabled", trips = 0, skipped = 0,
+    //     last_instructions = 12000, last_secs = 0.0001 }, ... }
+    engine_namespace.set_function("system_budgets", [&]() {
+        sol::table ret = lua.create_table();
+        for (auto& system : watchdog.report()) {
+            sol::table t = lua.create_table();
+            t["where"] = system.where;
+            t["state"] = SystemWatchdog::state_name(system.state);
+            t["trips"] = system.trips;
+            t["skipped"] = system.skipped;
+            t["last_instructions"] = system.last_instructions;
+            t["last_secs"] = system.last_secs;
+            ret.add(t);
+        }
+        return ret;
+    });
+    // collapsed stacks, for flamegraph.pl, inferno, speedscope and so on
+    engine_namespace.set_function("dump_profile", [&](std::string path) {
+        if (!profiler.write_collapsed_stacks(path)) {
+            throw std::runtime_error(std::format("couldn't write the profile to {}, see the log.", path));
+        }
+    });
+    engine_namespace.set_function("stats", [&]() {
+        sol::table t = sol::table(lua, sol::create);
+        t["snapshot_capture_secs"] = engine.stats.snapshot_capture_secs;
+        t["snapshot_capture_bytes"] = engine.stats.snapshot_capture_bytes;
+        t["snapshot_bytes"] = engine.stats.snapshot_bytes;
+        t["snapshot_ticks"] = engine.stats.snapshot_ticks;
+        t["deferred_systems"] = engine.stats.deferred_systems;
+        t["timers"] = engine.stats.timers;
+        t["timers_fired"] = engine.stats.timers_fired;
+        t["scripts_cached"] = engine.stats.scripts_cached;
+        t["script_parse_secs_saved"] = engine.stats.script_parse_secs_saved;
+        t["gc_step_secs"] = engine.stats.gc_step_secs;
+        t["gc_steps"] = engine.stats.gc_steps;
+        t["gc_heap_bytes"] = engine.stats.gc_heap_bytes;
+        t["gc_collections"] = engine.stats.gc_collections;
+        t["lua_arena_bytes"] = engine.stats.lua_arena_bytes;
+        t["budget_trips"] = engine.stats.budget_trips;
+        t["systems_throttled"] = engine.stats.systems_throttled;
+        t["systems_disabled"] = engine.stats.systems_disabled;
+        t["log_messages_dropped"] = engine.stats.log_messages_dropped;
+        t["input_latency_secs"] = engine.stats.input_latency_secs;
+        return t;
+    });
+
+
+    // timers run on simulated time. `action` is either a function, called with the
+    // timer's id, or the name of an event to fire with `payload`. timers made while
+    // a stage is running are cancelled when it's changed.
+    auto make_timer_callback = [&](sol::object action, sol::object payload) -> TimerCallback {
+        if (action.is<sol::protected_function>()) {
+            sol::protected_function callback = action.as<sol::protected_function>();
+            return [=](TimerId id) { pcall(callback, id); };
+        } else if (action.is<std::string>() || action.get_type() == sol::type::number) {
+            EventId event = action.get_type() == sol::type::number ? action.as<EventId>() : event_id(action.as<std::string>());
+            ECSWorld* ecs = engine.ecs.get();
+            return [=](TimerId) { ecs->fire_event(event, payload); };
+        }
+
+        throw std::runtime_error("timer action should be a function, an event name or an Events.id.");
+    };
+
+    sol::table timers_namespace = lua["Timers"].force();
+    timers_namespace.set_function("after", [&, make_timer_callback](f64 secs, sol::object action, sol::object payload) {
+        return engine.timers->after(secs, make_timer_callback(action, payload), engine.stage.value_or(""));
+    });
+    timers_namespace.set_function("every", [&, make_timer_callback](f64 secs, sol::object action, sol::object payload) {
+        return engine.timers->every(secs, make_timer_callback(action, payload), engine.stage.value_or(""));
+    });
+    timers_namespace.set_function("cancel", [&](TimerId id) {
+        return engine.timers->cancel(id);
+    });
+    timers_namespace.set_function("now", [&]() {
+        return engine.timers->now_secs();
+    });
+
+
+    sol::table tasks_namespace = lua["Tasks"].force();
+    tasks_namespace.set_function("spawn", [&](sol::protected_function fn, sol::variadic_args args) {
+        auto call_info = get_debug_info(lua);
+        return tasks.spawn(fn, std::vector<sol::object>(args.begin(), args.end()), call_info.has_value() ? call_info->filename : "");
+    });
+    // false if the task already finished. errors if `task` is some other entity
+    tasks_namespace.set_function("cancel", [&](Entity task) {
+        if (!engine.ecs->entity_has_native_component<Task>(task)) {
+            bool exists = false;
+            engine.ecs->for_each_storage([&](ComponentStorage& storage) { exists = exists || storage.has_component(task); });
+            if (exists) throw std::runtime_error(std::format("Tasks.cancel got entity {}, which isn't a task.", task));
+            return false;
+        }
+
+        engine.ecs->delete_entity(task);
+        return true;
+    });
+    tasks_namespace.set_function("wait", sol::yielding([&](sol::this_state s, f64 secs) {
+        tasks.wait_secs(s, secs);
+    }));
+    tasks_namespace.set_function("wait_ticks", sol::yielding([&](sol::this_state s, u64 ticks) {
+        tasks.wait_ticks(s, ticks);
+    }));
+    // takes an event name or an Events.id. returns the event's payload
+    tasks_namespace.set_function("wait_for_event", sol::yielding([&](sol::this_state s, sol::stack_object event) {
+        tasks.wait_for_event(s, event.get_type() == sol::type::number ? event.as<EventId>() : event_id(event.as<std::string>()));
+    }));
+    engine.ecs->on_event = [&](EventId event, sol::object payload) {
+        tasks.notify_event(event, payload);
+    };
+
+    sol::table events_namespace = lua["Events"].force();
+    events_namespace.set_function("id", [](std::string event_name) {
+        return event_id(event_name);
+    });
+    events_namespace.set_function("name", [](EventId event) {
+        return event_name(event);
+    });
 
 
     sol::table ecs_namespace = lua["ECS"].force();
@@ -311,35 +695,73 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
     ecs_namespace.set_function("delete_entity", [&](Entity e) {
         engine.ecs->delete_entity(e);
     });
-    ecs_namespace.set_function("get_component", [&](Entity e, std::string component) {
-        return engine.ecs->get_native_component_as_lua_object(e, component, lua);
+    ecs_namespace.set_function("component_id", [&](std::string component) {
+        return engine.ecs->component_id(component);
+    });
+    ecs_namespace.set_function("get_component", sol::overload(
+        [&](Entity e, u32 component_id) {
+            return engine.ecs->get_component_as_lua_object(e, component_id, lua);
+        },
+        [&](Entity e, std::string component) {
+            return engine.ecs->get_native_component_as_lua_object(e, component, lua);
+        }
+    ));
+    // an entity with the component (a name or an ECS.component_id), or nil. a
+    // baked stage's entities come back with new ids, so scripts find the ones
+    // they need later by a tag component instead of keeping what ECS.new_entity gave them
+    ecs_namespace.set_function("find_entity", [&](sol::stack_object name_or_id) -> sol::object {
+        u32 id = name_or_id.get_type() == sol::type::number ? name_or_id.as<u32>() : engine.ecs->component_id(name_or_id.as<std::string>());
+        auto e = engine.ecs->find_entity(id);
+        return e.has_value() ? sol::make_object(lua, e.value()) : sol::make_object(lua, sol::lua_nil);
     });
     ecs_namespace.set_function("get_ecs", [&]() {
             return engine.ecs->lua_storage;
     });
-    ecs_namespace.set_function("remove_component_from_entity", [&](Entity e, std::string component) {
-        bool is_native_component = engine.ecs->native_component_exists(component);
-        bool is_lua_component = engine.ecs->lua_storage[component].valid();
-
-        if (is_native_component) {
-            engine.ecs->remove_native_component_from_entity(e, component);
-        } else if (is_lua_component) {
-            ECSWorld* ecs = engine.ecs.get();
-            engine.ecs->command_queue.push_command([=]() {
-                ecs->lua_storage[component][e] = sol::nil;
-            });
+    ecs_namespace.set_function("remove_component_from_entity", sol::overload(
+        [&](Entity e, u32 component_id) {
+            engine.ecs->remove_component_from_lua(e, component_id);
+        },
+        [&](Entity e, std::string component) {
+            bool is_native_component = engine.ecs->native_component_exists(component);
+            bool is_lua_component = engine.ecs->lua_storage[component].valid();
+
+            if (is_native_component) {
+                engine.ecs->remove_native_component_from_entity(e, component);
+            } else if (is_lua_component) {
+                ECSWorld* ecs = engine.ecs.get();
+                engine.ecs->command_queue.push_command([=]() {
+                    ecs->lua_storage[component][e] = sol::nil;
+                });
+            }
         }
-    });
+    ));
     ecs_namespace.set_function("register_component", [&](std::string component) {
         if (engine.ecs->native_component_exists(component)) {
             throw std::runtime_error(std::format("trying to register native component {}", component));
         }
 
-        if (!engine.ecs->lua_storage[component].valid()) {
-            engine.ecs->lua_storage[component] = sol::table(lua, sol::new_table());
+        engine.ecs->register_lua_component(component);
+    });
+    // stores the component natively instead of in a lua table, e.g.
+    //   ECS.define_component("enemy", { direction = "vec3", wants = "string", speed = "f32" })
+    // types: f32, f64, i32, i64, bool, entity, string, vec2, vec3, quat.
+    // insert_component then takes a table of (some of) the fields, the rest start zeroed.
+    ecs_namespace.set_function("define_component", [&](std::string component, sol::table fields) {
+        if (!fields.valid()) {
+            throw std::runtime_error("schema not specified.");
         }
+
+        engine.ecs->define_component(component, fields);
     });
-    ecs_namespace.set_function("insert_component", [&](Entity e, std::string component_name, sol::object component) {
+    // component_name can be an ECS.component_id. stack_object, since a sol::object
+    // would take a registry reference per call
+    ecs_namespace.set_function("insert_component", [&](Entity e, sol::stack_object name_or_id, sol::object component) {
+        if (name_or_id.get_type() == sol::type::number) {
+            engine.ecs->insert_component_from_lua(e, name_or_id.as<u32>(), component);
+            return;
+        }
+
+        std::string component_name = name_or_id.as<std::string>();
         if (engine.ecs->native_component_exists(component_name)) {
             engine.ecs->insert_native_component_from_lua(e, component_name, component);
             return;
@@ -347,7 +769,7 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
 
         if (!engine.ecs->lua_storage[component_name].valid()) {
             SPDLOG_DEBUG("Registering new lua component {}.", component_name);
-            engine.ecs->lua_storage[component_name] = sol::table(lua, sol::new_table());
+            engine.ecs->register_lua_component(component_name);
         }
 
         if (component == sol::nil) {
@@ -356,16 +778,58 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
 
         engine.ecs->lua_storage[component_name][e] = component;
     });
-    ecs_namespace.set_function("for_each", [&](sol::table components, sol::protected_function callback) {
+    // compiled once, for queries that run a lot outside of systems:
+    //   local enemies = ECS.query({ "enemy", "transform" })
+    //   enemies:for_each(function(e) ... end)
+    lua.new_usertype<LuaQuery>("Query", sol::no_constructor,
+        "for_each", [&](LuaQuery& query, sol::protected_function callback) {
+            query.for_each(lua, *engine.ecs, false, [&](sol::table& argument) {
+                pcall(callback, argument);
+            });
+        },
+        "count", [&](LuaQuery& query) {
+            return query.count(lua, *engine.ecs);
+        }
+    );
+    ecs_namespace.set_function("query", [&](sol::table components) {
+        return LuaQuery(components);
+    });
+    ecs_namespace.set_function("for_each", [&](sol::object components, sol::protected_function callback) {
         if (!callback.valid()) {
             throw std::runtime_error("callback not specified.");
         }
 
-        for (sol::table argument : query(lua, *engine.ecs, components)) {
+        auto visit = [&](sol::table& argument) {
             pcall(callback, argument);
+        };
+
+        if (components.is<LuaQuery>()) {
+            components.as<LuaQuery&>().for_each(lua, *engine.ecs, false, visit);
+        } else if (components.is<sol::table>()) {
+            LuaQuery query(components.as<sol::table>());
+            query.for_each(lua, *engine.ecs, false, visit);
+        } else {
+            throw std::runtime_error("components should be a list of component names or an ECS.query.");
         }
     });
-    ecs_namespace.set_function("register_system", [&](sol::table queries, sol::protected_function callback, sol::object lifecycle) {
+    // options is an optional table:
+    //   every = n           run every n ticks (frames for render systems)
+    //   hz = f              run at most f times a second
+    //   amortize = k        each run only sees 1/k of the entities, and Engine.delta
+    //                       covers the k runs since it last saw them
+    //   priority = p        lower runs first
+    //   low_priority = b    render systems that can be put off when the frame is late
+    //   reuse_arguments = b the callback gets the same table for every entity, rebound,
+    //                       instead of a new one each. saves garbage, but only for
+    //                       callbacks that don't hold on to their arguments
+    //   batch = "columns"   the callback runs once a tick with every match, as
+    //                       { n = count, <component> = { row 1, row 2, ... } }
+    //   batch = "iterator"  the callback runs once a tick with a function that
+    //                       returns the next match, or nil: for e in iter do ... end
+    //   join = predicate    for 2d queries, only pass combinations that satisfy it (or a list of them):
+    //                       { within = d, a = 1, b = 2 } or { equal = { "enemy.wants", "food.kind" } }
+    //   pure = b            runs on worker threads, in their own lua states. see pure_systems.h
+    ecs_namespace.set_function("register_system", [&](sol::table queries, sol::protected_function callback, sol::object lifecycle, sol::object options) {
         if (!callback.valid()) {
             throw std::runtime_error("callback not specified.");
         }
@@ -373,6 +837,41 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
             throw std::runtime_error("queries not specified.");
         }
 
+        SystemSchedule schedule;
+        size_t priority = 0;
+        bool reuse_arguments = false;
+        std::optional<LuaQuery::Batch> batch;
+        sol::object join_predicates;
+        std::optional<SystemBudget> budget;
+        bool pure = false;
+        if (options.is<sol::table>()) {
+            sol::table t = options.as<sol::table>();
+            schedule.every_n_ticks = t.get_or<u32>("every", 1);
+            schedule.target_hz = t.get_or<f32>("hz", 0);
+            schedule.amortize_over = t.get_or<u32>("amortize", 1);
+            schedule.low_priority = t.get_or("low_priority", false);
+            priority = t.get_or<size_t>("priority", 0);
+            reuse_arguments = t.get_or("reuse_arguments", false);
+            join_predicates = t["join"];
+            if (t["budget"].valid()) budget = system_budget_from_lua(t["budget"]);
+            pure = t.get_or("pure", false);
+
+            std::string batch_mode = t.get_or<std::string>("batch", "");
+            if (batch_mode == "columns") {
+                batch = LuaQuery::Batch::Columns;
+            } else if (batch_mode == "iterator") {
+                batch = LuaQuery::Batch::Iterator;
+            } else if (!batch_mode.empty()) {
+                throw std::runtime_error("batch needs to be 'columns' or 'iterator'.");
+            }
+
+            if (schedule.every_n_ticks == 0 || schedule.amortize_over == 0) {
+                throw std::runtime_error("'every' and 'amortize' need to be at least 1.");
+            }
+        } else if (options.valid()) {
+            throw std::runtime_error("system options should be a table.");
+        }
+
         Entity e = engine.ecs->new_entity();
         if (engine.stage.has_value()) {
             engine.ecs->emplace_native_component<BoundToStage>(e, engine.stage.value());
@@ -380,6 +879,32 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
 
         auto call_info = get_debug_info(lua).value();
         engine.ecs->emplace_native_component<BoundToScript>(e, call_info.filename);
+        std::string where = std::format("{}:{}", call_info.filename, call_info.lineno);
+        // every run of the system goes through the watchdog, see watchdog.h
+        SystemWatchdog* watchdog_ptr = &watchdog;
+        u32 watchdog_system = watchdog.system(where, budget);
+
+        SystemOrigin origin {
+            .where = where,
+            .allocator = &allocator,
+            .allocation_owner = allocator.owner(where),
+            .profiler = &profiler,
+            .profiler_system = profiler.system(where, call_info.filename),
+            .watchdog = &watchdog,
+            .watchdog_system = watchdog_system,
+        };
+        auto emplace_system = [&](std::function<void()> callback) {
+            engine.ecs->emplace_native_component<System>(e, [=]() {
+                SystemWatchdog::Scope scope(*watchdog_ptr, watchdog_system);
+                if (scope.is_allowed()) callback();
+            }, priority, schedule);
+        };
+        auto emplace_event_handler = [&](std::function<void(sol::object)> callback) {
+            engine.ecs->emplace_native_component<EventHandler>(e, [=](sol::object event_payload) {
+                SystemWatchdog::Scope scope(*watchdog_ptr, watchdog_system);
+                if (scope.is_allowed()) callback(event_payload);
+            }, lifecycle.as<Event>().name);
+        };
 
 #define STRCMP(object, s) (object.is<std::string>() && object.as<std::string>() == s)
         if (!lifecycle.valid() || STRCMP(lifecycle, "physics")) {
@@ -393,16 +918,45 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
         }
 #undef STRCMP
 
+        if (pure) {
+            if (lifecycle.is<Event>()) {
+                throw std::runtime_error("pure systems can't be event handlers.");
+            }
+            if (batch.has_value() || join_predicates.valid()) {
+                throw std::runtime_error("pure systems can't be batched or joined.");
+            }
+            if (queries.empty()) {
+                throw std::runtime_error("pure systems need a query.");
+            }
+            for (int idx = 1; idx <= (int)queries.size(); idx++) {
+                if (!queries[idx].is<std::string>()) {
+                    throw std::runtime_error("pure systems take a single query, an array of strings.");
+                }
+            }
+
+            if (!pure_systems) {
+                size_t workers = std::clamp<size_t>(std::thread::hardware_concurrency(), 2, 9) - 1;
+                pure_systems = std::make_unique<PureSystemPool>(engine, lua, workers);
+            }
+
+            PureSystemPool* pool = pure_systems.get();
+            auto system = pool->make_system(callback, std::make_shared<LuaQuery>(queries), where);
+            emplace_system([=]() {
+                pool->run(*system);
+            });
+            return;
+        }
+
         int queries_length = queries.size();
         if (queries.empty()) {
             if (lifecycle.is<Event>()) {
-                engine.ecs->emplace_native_component<EventHandler>(e, [=](sol::object event_payload) {
-                    pcall(callback, event_payload);
-                }, lifecycle.as<Event>().name);
+                emplace_event_handler([=](sol::object event_payload) {
+                    pcall_system(origin, callback, event_payload);
+                });
             } else {
-                engine.ecs->emplace_native_component<System>(e, [=]() {
-                    pcall(callback);
-                }, 0); // TODO: priority
+                emplace_system([=]() {
+                    pcall_system(origin, callback);
+                });
             }
         }
 
@@ -423,52 +977,94 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
 
         if (!is_strings && !is_tables) {
             throw std::runtime_error("queries should be an array of strings or a 2d array of strings.");
+        } else if (is_tables && !queries.empty() && batch.has_value()) {
+            throw std::runtime_error("batched systems only take a single query.");
+        } else if (is_strings && join_predicates.valid()) {
+            throw std::runtime_error("join only makes sense between several queries.");
         } else if (is_strings) {
             sol::state* state = &lua;
             ECSWorld* ecs = &*engine.ecs;
-            if (lifecycle.is<Event>()) {
-                engine.ecs->emplace_native_component<EventHandler>(e, [=](sol::object event_payload) {
-                    for (sol::table argument : query(*state, *ecs, queries)) {
-                        pcall(callback, argument, event_payload);
-                    }
-                }, lifecycle.as<Event>().name);
+            auto query = std::make_shared<LuaQuery>(queries);
+            query->reuse_arguments = reuse_arguments;
+
+            if (batch.has_value() && !queries.empty()) {
+                // one call into lua per run, lua does the looping
+                LuaQuery::Batch mode = batch.value();
+                if (lifecycle.is<Event>()) {
+                    emplace_event_handler([=](sol::object event_payload) {
+                        query->for_each_batch(*state, *ecs, false, mode, [&](sol::object matches) {
+                            pcall_system(origin, callback, matches, event_payload);
+                        });
+                    });
+                } else {
+                    emplace_system([=]() {
+                        query->for_each_batch(*state, *ecs, true, mode, [&](sol::object matches) {
+                            pcall_system(origin, callback, matches);
+                        });
+                    });
+                }
+            } else if (lifecycle.is<Event>()) {
+                emplace_event_handler([=](sol::object event_payload) {
+                    query->for_each(*state, *ecs, false, [&](sol::table& argument) {
+                        pcall_system(origin, callback, argument, event_payload);
+                    });
+                });
             } else {
-                engine.ecs->emplace_native_component<System>(e, [=]() {
-                    for (sol::table argument : query(*state, *ecs, queries)) {
-                        pcall(callback, argument);
-                    }
-                }, 0); // TODO: priority
+                emplace_system([=]() {
+                    query->for_each(*state, *ecs, true, [&](sol::table& argument) {
+                        pcall_system(origin, callback, argument);
+                    });
+                });
             }
         } else { // is_tables
             sol::state* state = &lua;
             ECSWorld* ecs = &*engine.ecs;
+            auto join = std::make_shared<LuaJoin>(queries, join_predicates);
+            join->reuse_arguments = reuse_arguments;
+
             if (lifecycle.is<Event>()) {
-                engine.ecs->emplace_native_component<EventHandler>(e, [=](sol::object event_payload) {
-                    // arguments squared?
-                    std::vector<Tables> arguments2;
-                    for (int idx = 1; idx <= queries_length; idx++) {
-                        arguments2.push_back(query(*state, *ecs, queries[idx]));
-                    }
-                    f(arguments2.begin(), arguments2.end(), Tables(), [&](Tables& args) {
-                        pcall(callback, sol::as_args(args), event_payload);
+                emplace_event_handler([=](sol::object event_payload) {
+                    join->for_each(*state, *ecs, false, [&](std::vector<sol::table>& arguments) {
+                        pcall_system(origin, callback, sol::as_args(arguments), event_payload);
                     });
-                }, lifecycle.as<Event>().name);
+                });
             } else {
-                engine.ecs->emplace_native_component<System>(e, [=]() {
-                    // arguments squared?
-                    std::vector<Tables> arguments2;
-                    for (int idx = 1; idx <= queries_length; idx++) {
-                        arguments2.push_back(query(*state, *ecs, queries[idx]));
-                    }
-                    f(arguments2.begin(), arguments2.end(), Tables(), [&](Tables& args) {
-                        pcall(callback, sol::as_args(args));
-                    }); 
-                }, 0); // TODO: priority
+                emplace_system([=]() {
+                    join->for_each(*state, *ecs, true, [&](std::vector<sol::table>& arguments) {
+                        pcall_system(origin, callback, sol::as_args(arguments));
+                    });
+                });
             }
         }
     });
-    ecs_namespace.set_function("fire_event", [&](std::string event_name, sol::object event_payload) {
-        engine.ecs->fire_event(event_name, event_payload);
+    ecs_namespace.set_function("fire_event", [&](sol::stack_object name_or_id, sol::object event_payload) {
+        if (name_or_id.get_type() == sol::type::number) {
+            engine.ecs->fire_event(name_or_id.as<EventId>(), event_payload);
+        } else {
+            engine.ecs->fire_event(name_or_id.as<std::string>(), event_payload);
+        }
+    });
+    // puts a native behaviour kernel (see kernels.h) on every entity with all of
+    // params.on, now and as they show up. those need to be native components or
+    // ones from define_component. the rest of params parameterize the kernel.
+    // returns an entity, deleting it stops putting the kernel on new entities
+    ecs_namespace.set_function("use_kernel", [&](std::string kernel, sol::table params) {
+        sol::optional<std::vector<std::string>> on = params["on"];
+        if (!on.has_value() || on.value().empty()) {
+            throw std::runtime_error("use_kernel needs `on`, a list of component names.");
+        }
+
+        auto attach = engine.kernels->attacher(kernel, params);
+
+        Entity e = engine.ecs->new_entity();
+        if (engine.stage.has_value()) {
+            engine.ecs->emplace_native_component<BoundToStage>(e, engine.stage.value());
+        }
+        if (auto call_info = get_debug_info(lua)) {
+            engine.ecs->emplace_native_component<BoundToScript>(e, call_info->filename);
+        }
+        engine.ecs->emplace_native_component<KernelBinding>(e, on.value(), kernel, attach);
+        return e;
     });
 
 
@@ -506,9 +1102,15 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
     });
 
 
-    lua.new_usertype<Event>("Event", sol::constructors<Event(std::string)>());
+    lua.new_usertype<Event>("Event", sol::constructors<Event(EventId), Event(std::string)>());
+
+    register_math_to_lua(lua);
+
+    engine.resources->register_resource_loader(std::make_unique<ScriptLoader>(lua, bytecode));
+}
 
-    lua.new_usertype<vec2>("vec2",
+void motorcar::register_math_to_lua(sol::state& lua) {
+    auto v2 = lua.new_usertype<vec2>("vec2",
         sol::constructors<vec2(), vec2(float), vec2(float, float)>(),
         "x", &vec2::x,
         "y", &vec2::y,
@@ -539,11 +1141,57 @@ ScriptManager::ScriptManager(Engine& engine) : engine(engine) {
     v3.set_function("normalized", [](vec3 v) { return glm::normalize(v); });
     v3.set_function("distance_to", [](vec3 v1, vec3 v2) { return glm::distance(v1, v2); });
 
+    // every operator above makes a new userdata, which is garbage by the next frame.
+    // these change the vector in place and return nothing, so they don't allocate:
+    //   dir:set(0, 0, 1)
+    //   pos:add_scaled_mut(velocity, Engine.delta())
+    //   local x, y, z = pos:unpack()
+    v2.set_function("unpack", [](const vec2& v) { return std::make_tuple(v.x, v.y); });
+    v2.set_function("set", [](vec2& v, f32 x, f32 y) { v = vec2(x, y); });
+    v2.set_function("copy_from", [](vec2& v, const vec2& other) { v = other; });
+    v2.set_function("add_mut", sol::overload(
+        [](vec2& v, const vec2& other) { v += other; },
+        [](vec2& v, f32 x, f32 y) { v += vec2(x, y); }
+    ));
+    v2.set_function("sub_mut", sol::overload(
+        [](vec2& v, const vec2& other) { v -= other; },
+        [](vec2& v, f32 x, f32 y) { v -= vec2(x, y); }
+    ));
+    v2.set_function("add_scaled_mut", [](vec2& v, const vec2& other, f32 f) { v += other * f; });
+    v2.set_function("scale_mut", [](vec2& v, f32 f) { v *= f; });
+    v2.set_function("normalize_mut", [](vec2& v) { v = glm::normalize(v); });
+
+    v3.set_function("unpack", [](const vec3& v) { return std::make_tuple(v.x, v.y, v.z); });
+    v3.set_function("set", [](vec3& v, f32 x, f32 y, f32 z) { v = vec3(x, y, z); });
+    v3.set_function("copy_from", [](vec3& v, const vec3& other) { v = other; });
+    v3.set_function("add_mut", sol::overload(
+        [](vec3& v, const vec3& other) { v += other; },
+        [](vec3& v, f32 x, f32 y, f32 z) { v += vec3(x, y, z); }
+    ));
+    v3.set_function("sub_mut", sol::overload(
+        [](vec3& v, const vec3& other) { v -= other; },
+        [](vec3& v, f32 x, f32 y, f32 z) { v -= vec3(x, y, z); }
+    ));
+    v3.set_function("add_scaled_mut", [](vec3& v, const vec3& other, f32 f) { v += other * f; });
+    v3.set_function("mul_mut", [](vec3& v, const vec3& other) { v *= other; });
+    v3.set_function("scale_mut", [](vec3& v, f32 f) { v *= f; });
+    v3.set_function("normalize_mut", [](vec3& v) { v = glm::normalize(v); });
+    v3.set_function("cross_mut", [](vec3& v, const vec3& other) { v = glm::cross(v, other); });
+    v3.set_function("dot", [](const vec3& v1, const vec3& v2) { return glm::dot(v1, v2); });
+    v3.set_function("length", [](const vec3& v) { return glm::length(v); });
+
     auto q = lua.new_usertype<quat>("quat", sol::constructors<quat(), quat(vec3, vec3)>());
     q.set_function("axis", [](quat q) { return glm::axis(q); });
     q.set_function("angle", [](quat q) { return glm::angle(q); });
+    q.set_function("unpack", [](const quat& q) { return std::make_tuple(q.w, q.x, q.y, q.z); });
+    q.set_function("set", [](quat& q, f32 w, f32 x, f32 y, f32 z) { q = quat(w, x, y, z); });
+    q.set_function("mul_mut", [](quat& q, const quat& other) { q = other * q; });
+}
 
-    engine.resources->register_resource_loader(std::make_unique<ScriptLoader>(lua));
+void ScriptManager::update_stats() {
+    auto& cache_stats = bytecode.get_stats();
+    engine.stats.scripts_cached = cache_stats.hits;
+    engine.stats.script_parse_secs_saved = cache_stats.parse_secs_saved;
 }
 
 void ScriptManager::load_plugins() {
@@ -551,40 +1199,80 @@ void ScriptManager::load_plugins() {
     auto cwd = std::filesystem::current_path();
     auto plugins_path = cwd / "plugins";
 
-    if (std::filesystem::exists(plugins_path)) {
-        for (auto& entry : std::filesystem::recursive_directory_iterator(plugins_path)) {
-            if (entry.is_regular_file() and entry.path().extension() == ".lua") {
-                load_and_execute_script(engine, entry.path());
-            }
-        }
+    for (auto& script : scripts_under(*this, plugins_path)) {
+        load_and_execute_script(engine, script, "");
     }
+    update_stats();
 }
 
 void ScriptManager::load_stage(std::string_view stage_name) {
     // TODO: hot reload
-    auto cwd = std::filesystem::current_path();
-    auto stages_path = cwd / "stages";
-    
-    auto first_script = stages_path / std::format("{}.lua", stage_name);
-    auto stage_path = stages_path / stage_name;
+    // whatever Stages.preload got done ahead of time
+    auto preloaded = preloader.take(stage_name);
+    if (preloaded.has_value()) {
+        for (auto& script : preloaded->scripts) {
+            bytecode.prime(std::move(script));
+        }
+    }
 
-    bool ran_a_script = false;
+    // a baked stage gets its entities from the snapshot. the scripts still run
+    // to register their systems and tasks, and skip spawning when Stages.from_snapshot
+    // is set. the snapshot's entities come back with new ids, see ECS.find_entity
+    auto baked_snapshot = baked_snapshot_of(stage_name);
+    std::error_code error;
+    auto baked_time = std::filesystem::last_write_time(baked_snapshot, error);
+    if (error) baked_time = std::filesystem::file_time_type::min();
+
+    std::optional<WorldSnapshot> snapshot;
+    if (preloaded.has_value() && preloaded->snapshot_time == baked_time) {
+        snapshot = std::move(preloaded->snapshot);
+    } else if (baked_time != std::filesystem::file_time_type::min()) {
+        // not preloaded, or baked again since
+        auto start = std::chrono::steady_clock::now();
+        snapshot = WorldSnapshot::read_from_file(baked_snapshot);
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        SPDLOG_DEBUG("read baked stage {} in {}us.", stage_name, elapsed.count());
+    }
 
-    if (std::filesystem::exists(first_script)) {
-        ran_a_script = true;
-        load_and_execute_script(engine, first_script);
+    bool from_snapshot = snapshot.has_value();
+    if (from_snapshot) {
+        // the old stage's entities go first, then the snapshot's are in before
+        // any script runs, so ECS.find_entity works at the top of a script too
+        engine.ecs->flush_command_queue();
+        snapshot->restore(*engine.ecs, WorldSnapshot::RestoreMode::Append, engine.timers->now_secs());
     }
+    lua["Stages"]["from_snapshot"] = from_snapshot;
 
-    if (std::filesystem::exists(stage_path)) {
-        for (auto& entry : std::filesystem::recursive_directory_iterator(stage_path)) {
-            if (entry.is_regular_file() and entry.path().extension() == ".lua") {
-                ran_a_script = true;
-                load_and_execute_script(engine, entry.path());
-            }
-        }
+    Entity first_spawned = engine.ecs->peek_next_entity();
+    auto scripts = scripts_of_stage(*this, stage_name);
+    for (auto& script : scripts) {
+        load_and_execute_script(engine, script, stage_name);
     }
+    update_stats();
 
-    if (!ran_a_script) {
+    lua["Stages"]["from_snapshot"] = false;
+
+    if (from_snapshot) {
+        // after the scripts' components are in
+        ECSWorld* ecs = engine.ecs.get();
+        Entity last_spawned = engine.ecs->peek_next_entity();
+        std::string name(stage_name);
+        engine.ecs->command_queue.push_command([=]() {
+            check_baked_stage(*ecs, name, first_spawned, last_spawned);
+        });
+    }
+
+    if (scripts.empty()) {
         SPDLOG_ERROR("changed stage to {}, but no scripts were run to change the stage.", stage_name);
     }
 }
+
+void ScriptManager::preload_stage(std::string_view stage_name) {
+    std::vector<std::pair<std::filesystem::path, std::string>> scripts;
+    for (auto& script : scripts_of_stage(*this, stage_name)) {
+        scripts.emplace_back(script, script_name_of(script));
+    }
+
+    preloader.preload(std::string(stage_name), bytecode, std::move(scripts), baked_snapshot_of(stage_name));
+}
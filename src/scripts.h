@@ -1,18 +1,43 @@
 #include <sol/sol.hpp>
 
+#include "tasks.h"
+#include "bytecode.h"
+#include "lua_gc.h"
+#include "lua_alloc.h"
+#include "lua_hooks.h"
+#include "profiler.h"
+#include "watchdog.h"
+#include "pure_systems.h"
+#include "stage_preloader.h"
+
 namespace motorcar {
     struct Engine;
 
+    // vec2, vec3 and quat
+    void register_math_to_lua(sol::state& lua);
+
     class ScriptManager {
         Engine& engine;
 
+        void update_stats();
+
         public:
+            LuaAllocator allocator; // before lua, it has to outlive it
             sol::state lua;
+            TaskScheduler tasks;
+            BytecodeCache bytecode;
+            LuaGc gc;
+            LuaHooks hooks;
+            LuaProfiler profiler;
+            SystemWatchdog watchdog;
+            std::unique_ptr<PureSystemPool> pure_systems; // started with the first pure system
+            StagePreloader preloader;
 
             ScriptManager(Engine& engine);
 
             void load_plugins();
             void load_stage(std::string_view stage_name);
+            void preload_stage(std::string_view stage_name);
 
             // script manager's memory address should never change
             ScriptManager(ScriptManager&) = delete;
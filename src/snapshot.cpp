@@ -0,0 +1,753 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <sol/sol.hpp>
+#include <spdlog/spdlog.h>
+
+#include "snapshot.h"
+#include "ecs.h"
+#include "components.h"
+#include "kernels.h"
+
+using namespace motorcar;
+
+static_assert(sizeof(Entity) == sizeof(u64), "snapshots store entities as u64");
+
+namespace {
+    const char MAGIC[8] = { 'M', 'C', 'S', 'N', 'A', 'P', 0, 0 };
+
+    // anything nested deeper than this is probably a cycle
+    const int MAX_LUA_DEPTH = 16;
+
+    enum class LuaTag : u8 {
+        Nil,
+        False,
+        True,
+        Integer,
+        Number,
+        String,
+        Table,  // u64 count, then count tagged key/value pairs
+        Record, // one tagged value per field of the column's schema
+        Vec2,
+        Vec3,
+        Vec4,
+        Quat,
+    };
+
+    Entity map_entity(const EntityRemap* remap, Entity e) {
+        return remap == nullptr ? e : remap->at(e);
+    }
+
+    void write_lua_value(SnapshotWriter& writer, const sol::object& object, int depth = 0) {
+        if (depth > MAX_LUA_DEPTH) {
+            SPDLOG_WARN("lua value is nested too deeply to snapshot. writing nil instead.");
+            writer.write(LuaTag::Nil);
+            return;
+        }
+
+        switch (object.get_type()) {
+            case sol::type::boolean:
+                writer.write(object.as<bool>() ? LuaTag::True : LuaTag::False);
+                break;
+            case sol::type::number: {
+                lua_State* L = object.lua_state();
+                object.push();
+                bool is_integer = lua_isinteger(L, -1);
+                lua_pop(L, 1);
+
+                if (is_integer) {
+                    writer.write(LuaTag::Integer);
+                    writer.write(object.as<i64>());
+                } else {
+                    writer.write(LuaTag::Number);
+                    writer.write(object.as<f64>());
+                }
+                break;
+            }
+            case sol::type::string:
+                writer.write(LuaTag::String);
+                writer.write_string(object.as<std::string_view>());
+                break;
+            case sol::type::table: {
+                sol::table table = object.as<sol::table>();
+                u64 count = 0;
+                table.for_each([&](sol::object, sol::object) { count++; });
+
+                writer.write(LuaTag::Table);
+                writer.write(count);
+                table.for_each([&](sol::object key, sol::object value) {
+                    write_lua_value(writer, key, depth + 1);
+                    write_lua_value(writer, value, depth + 1);
+                });
+                break;
+            }
+            case sol::type::userdata:
+                if (object.is<vec2>()) {
+                    writer.write(LuaTag::Vec2);
+                    writer.write(object.as<vec2>());
+                } else if (object.is<vec3>()) {
+                    writer.write(LuaTag::Vec3);
+                    writer.write(object.as<vec3>());
+                } else if (object.is<vec4>()) {
+                    writer.write(LuaTag::Vec4);
+                    writer.write(object.as<vec4>());
+                } else if (object.is<quat>()) {
+                    writer.write(LuaTag::Quat);
+                    writer.write(object.as<quat>());
+                } else {
+                    SPDLOG_WARN("can't snapshot this userdata. writing nil instead.");
+                    writer.write(LuaTag::Nil);
+                }
+                break;
+            default:
+                // functions, threads and friends don't survive a snapshot
+                writer.write(LuaTag::Nil);
+                break;
+        }
+    }
+
+    sol::object read_lua_value(SnapshotReader& reader, sol::state_view& lua, const std::vector<std::string>& schema) {
+        switch (reader.read<LuaTag>()) {
+            case LuaTag::False: return sol::make_object(lua, false);
+            case LuaTag::True: return sol::make_object(lua, true);
+            case LuaTag::Integer: return sol::make_object(lua, reader.read<i64>());
+            case LuaTag::Number: return sol::make_object(lua, reader.read<f64>());
+            case LuaTag::String: return sol::make_object(lua, reader.read_string());
+            case LuaTag::Vec2: return sol::make_object(lua, reader.read<vec2>());
+            case LuaTag::Vec3: return sol::make_object(lua, reader.read<vec3>());
+            case LuaTag::Vec4: return sol::make_object(lua, reader.read<vec4>());
+            case LuaTag::Quat: return sol::make_object(lua, reader.read<quat>());
+            case LuaTag::Table: {
+                sol::table table = lua.create_table();
+                u64 count = reader.read<u64>();
+                for (u64 idx = 0; idx < count && reader.ok(); idx++) {
+                    sol::object key = read_lua_value(reader, lua, schema);
+                    sol::object value = read_lua_value(reader, lua, schema);
+                    if (key.valid()) table[key] = value;
+                }
+                return table;
+            }
+            case LuaTag::Record: {
+                sol::table table = lua.create_table();
+                for (const std::string& field : schema) {
+                    sol::object value = read_lua_value(reader, lua, schema);
+                    if (value.valid()) table[field] = value;
+                }
+                return table;
+            }
+            case LuaTag::Nil:
+            default:
+                return sol::make_object(lua, sol::nil);
+        }
+    }
+
+    // a record is a table with only string keys. that's what almost every lua
+    // component looks like, so those get their keys written once per column.
+    bool is_record(const sol::object& object) {
+        if (object.get_type() != sol::type::table) return false;
+
+        bool ret = true;
+        object.as<sol::table>().for_each([&](sol::object key, sol::object) {
+            if (key.get_type() != sol::type::string) ret = false;
+        });
+        return ret;
+    }
+
+    // straight from the storages, a query would count as a write to them
+    template <typename ...T>
+    std::unordered_set<Entity> find_system_entities(ECSWorld& world) {
+        std::unordered_set<Entity> ret;
+        for (ComponentStorage* storage : { world.get_native_storage(std::string(ComponentTypeTrait<T>::component_name))... }) {
+            if (storage != nullptr) ret.insert(storage->entities.begin(), storage->entities.end());
+        }
+        return ret;
+    }
+
+    // moves whenever an entity gains or loses one of them. running a system
+    // writes to its System, so this goes by the rows alone
+    template <typename ...T>
+    u64 systems_version(ECSWorld& world) {
+        u64 ret = 0;
+        for (ComponentStorage* storage : { world.get_native_storage(std::string(ComponentTypeTrait<T>::component_name))... }) {
+            if (storage != nullptr) ret = std::max(ret, storage->rows_version);
+        }
+        return ret;
+    }
+
+    std::unordered_set<Entity> find_system_entities(ECSWorld& world) {
+        return find_system_entities<System, EventHandler, Task, KernelBinding>(world);
+    }
+
+    std::shared_ptr<const ColumnSnapshot> finish_column(ColumnSnapshot&& column, SnapshotWriter& writer) {
+        auto bytes = std::make_shared<std::vector<u8>>(writer.take());
+        column.data = std::span<const u8>(bytes->data(), bytes->size());
+        column.backing = bytes;
+        return std::make_shared<const ColumnSnapshot>(std::move(column));
+    }
+
+    bool map_file(const std::filesystem::path& path, std::shared_ptr<const void>& backing, std::span<const u8>& bytes) {
+#ifdef __linux__
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            SPDLOG_ERROR("couldn't open snapshot {}. errno: {}, strerror: {}", path.string(), errno, strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0) {
+            SPDLOG_ERROR("couldn't stat snapshot {}, or it's empty.", path.string());
+            close(fd);
+            return false;
+        }
+
+        size_t size = st.st_size;
+        void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (ptr == MAP_FAILED) {
+            SPDLOG_ERROR("mmap failed for snapshot {}. errno: {}, strerror: {}", path.string(), errno, strerror(errno));
+            return false;
+        }
+
+        backing = std::shared_ptr<const void>(ptr, [size](const void* p) { munmap((void*)p, size); });
+        bytes = std::span<const u8>((const u8*)ptr, size);
+        return true;
+#else
+        std::ifstream file_stream(path, std::ios::binary);
+        if (file_stream.fail()) {
+            SPDLOG_ERROR("couldn't open snapshot {}.", path.string());
+            return false;
+        }
+
+        auto data = std::make_shared<std::vector<u8>>(
+            std::istreambuf_iterator<char>(file_stream), std::istreambuf_iterator<char>()
+        );
+        bytes = std::span<const u8>(data->data(), data->size());
+        backing = data;
+        return true;
+#endif
+    }
+}
+
+WorldSnapshot WorldSnapshot::capture(ECSWorld& world, std::function<bool(Entity)> include, const WorldSnapshot* previous) {
+    WorldSnapshot snapshot;
+    snapshot.next_entity = world.next_entity;
+    snapshot.systems_version = systems_version<System, EventHandler, Task, KernelBinding>(world);
+
+    std::unordered_set<Entity> system_entities = find_system_entities(world);
+    auto captured = [&](Entity e) {
+        return !system_entities.contains(e) && (!include || include(e));
+    };
+
+    std::unordered_map<std::string_view, std::shared_ptr<const ColumnSnapshot>> previous_columns;
+    if (previous != nullptr) {
+        for (auto& column : previous->columns) previous_columns.emplace(column->component_name, column);
+    }
+
+    // with the same entities left out as last time, a column whose version
+    // hasn't moved is the same as last time. it isn't looked at at all
+    bool same_rows = previous != nullptr && !include && previous->systems_version == snapshot.systems_version;
+    auto unchanged = [&](std::string_view name, u64 version) -> std::shared_ptr<const ColumnSnapshot> {
+        if (!same_rows) return nullptr;
+
+        auto it = previous_columns.find(name);
+        if (it == previous_columns.end() || it->second->storage_version != version) return nullptr;
+        return it->second;
+    };
+
+    // hands back the previous tick's column instead if nothing changed
+    auto share_or_finish = [&](ColumnSnapshot&& column, SnapshotWriter& writer) {
+        auto it = previous_columns.find(column.component_name);
+        if (it == previous_columns.end()) return finish_column(std::move(column), writer);
+
+        const ColumnSnapshot& old = *it->second;
+        std::span<const u8> bytes = writer.view();
+        if (old.kind == column.kind && old.entities == column.entities &&
+                old.data.size() == bytes.size() && memcmp(old.data.data(), bytes.data(), bytes.size()) == 0) {
+            // handed out but not written to. next time it's shared without looking
+            old.storage_version = std::max(old.storage_version, column.storage_version);
+            return it->second;
+        }
+
+        return finish_column(std::move(column), writer);
+    };
+
+    std::vector<size_t> rows;
+    world.for_each_storage([&](ComponentStorage& storage) {
+        // no way to write it down, so it's transient (e.g. colliding_with)
+        if (!storage.can_write_to_snapshot()) return;
+
+        if (auto old = unchanged(storage.component_name, storage.version)) {
+            snapshot.columns.push_back(old);
+            return;
+        }
+
+        rows.clear();
+        for (size_t idx = 0; idx < storage.len; idx++) {
+            if (captured(storage.entities[idx])) rows.push_back(idx);
+        }
+        if (rows.empty()) return;
+
+        ColumnSnapshot column;
+        column.component_name = std::string(storage.component_name);
+        column.stride = storage.stride;
+        column.storage_version = storage.version;
+        column.entities.reserve(rows.size());
+
+        SnapshotWriter writer;
+        if (storage.trivially_copyable) {
+            column.kind = ColumnSnapshot::Kind::Raw;
+
+            if (rows.size() == storage.len) {
+                // every row is wanted, so take the whole blob in one go
+                writer.write_bytes(storage.blob, storage.len * storage.stride);
+                column.entities = storage.entities;
+            } else {
+                for (size_t idx : rows) {
+                    writer.write_bytes(storage.compute_pointer(idx), storage.stride);
+                    column.entities.push_back(storage.entities[idx]);
+                }
+            }
+        } else {
+            column.kind = ColumnSnapshot::Kind::Serialized;
+
+            for (size_t idx : rows) {
+                storage.write_row(storage.compute_pointer(idx), writer);
+                column.entities.push_back(storage.entities[idx]);
+            }
+        }
+
+        snapshot.columns.push_back(share_or_finish(std::move(column), writer));
+    });
+
+    if (!world.lua_storage.valid()) return snapshot;
+
+    // lua components are plain tables, which lua can keep and write to whenever
+    // it likes. there's no telling whether one changed, so they're always written
+    // out, and only shared when the bytes come out the same
+    world.lua_storage.for_each([&](sol::object name, sol::object components) {
+        if (!components.is<sol::table>()) return;
+
+        ColumnSnapshot column;
+        column.kind = ColumnSnapshot::Kind::Lua;
+        column.component_name = name.as<std::string>();
+
+        std::vector<std::pair<Entity, sol::object>> values;
+        components.as<sol::table>().for_each([&](sol::object key, sol::object value) {
+            if (!key.is<Entity>() || !captured(key.as<Entity>())) return;
+
+            values.emplace_back(key.as<Entity>(), value);
+        });
+        // lua hands them over in hash order, which moves around as the table
+        // changes. sorted, an unchanged column comes out the same bytes
+        std::sort(values.begin(), values.end(), [](auto& l, auto& r) { return l.first < r.first; });
+
+        // the schema is every field name used by any record in this column, sorted
+        std::vector<std::string> schema;
+        std::unordered_set<std::string> seen;
+        for (auto& [e, value] : values) {
+            column.entities.push_back(e);
+            if (!is_record(value)) continue;
+
+            value.as<sol::table>().for_each([&](sol::object key, sol::object) {
+                std::string field = key.as<std::string>();
+                if (seen.insert(field).second) schema.push_back(field);
+            });
+        }
+        std::sort(schema.begin(), schema.end());
+
+        SnapshotWriter writer;
+        writer.write<u64>(schema.size());
+        for (const std::string& field : schema) writer.write_string(field);
+
+        for (auto& [e, value] : values) {
+            if (is_record(value)) {
+                sol::table table = value.as<sol::table>();
+                writer.write(LuaTag::Record);
+                for (const std::string& field : schema) {
+                    write_lua_value(writer, table.get<sol::object>(field), 1);
+                }
+            } else {
+                write_lua_value(writer, value);
+            }
+        }
+
+        // empty lua columns are kept around so the component stays registered
+        snapshot.columns.push_back(share_or_finish(std::move(column), writer));
+    });
+
+    return snapshot;
+}
+
+void WorldSnapshot::restore(ECSWorld& world, RestoreMode mode, f64 now_secs) const {
+    EntityRemap remap;
+    const EntityRemap* remap_ptr = nullptr;
+
+    if (mode == RestoreMode::Append) {
+        for (auto& column : columns) {
+            for (Entity e : column->entities) {
+                if (!remap.contains(e)) remap.emplace(e, world.new_entity());
+            }
+        }
+        remap_ptr = &remap;
+    } else {
+        // get rid of every component of every entity that isn't a system
+        std::unordered_set<Entity> system_entities = find_system_entities(world);
+        std::vector<Entity> to_remove;
+
+        world.for_each_storage([&](ComponentStorage& storage) {
+            to_remove.clear();
+            for (Entity e : storage.entities) {
+                if (!system_entities.contains(e)) to_remove.push_back(e);
+            }
+
+            if (to_remove.size() == storage.len) {
+                storage.clear();
+            } else {
+                for (Entity e : to_remove) storage.remove_component(e);
+            }
+        });
+
+        if (world.lua_storage.valid()) {
+            world.lua_storage.for_each([&](sol::object, sol::object components) {
+                if (!components.is<sol::table>()) return;
+
+                sol::table table = components.as<sol::table>();
+                to_remove.clear();
+                table.for_each([&](sol::object key, sol::object) {
+                    if (key.is<Entity>() && !system_entities.contains(key.as<Entity>())) {
+                        to_remove.push_back(key.as<Entity>());
+                    }
+                });
+
+                for (Entity e : to_remove) table[e] = sol::nil;
+            });
+        }
+
+        world.next_entity = std::max(world.next_entity, next_entity);
+    }
+
+    for (auto& column_ptr : columns) {
+        const ColumnSnapshot& column = *column_ptr;
+        const std::string& name = column.component_name;
+
+        if (column.kind == ColumnSnapshot::Kind::Lua) {
+            if (!world.lua_storage.valid()) {
+                SPDLOG_WARN("snapshot has lua component {}, but this world has no lua storage.", name);
+                continue;
+            }
+
+            sol::state_view lua(world.lua_storage.lua_state());
+            sol::table components = world.register_lua_component(name);
+
+            SnapshotReader reader(column.data);
+            std::vector<std::string> schema(reader.read<u64>());
+            for (std::string& field : schema) field = reader.read_string();
+
+            for (Entity e : column.entities) {
+                if (!reader.ok()) break;
+                components[map_entity(remap_ptr, e)] = read_lua_value(reader, lua, schema);
+            }
+
+            if (!reader.ok()) {
+                SPDLOG_ERROR("lua column {} in snapshot is truncated.", name);
+            }
+            continue;
+        }
+
+        ComponentStorage* found = world.get_native_storage(name);
+        if (found == nullptr) {
+            SPDLOG_WARN("snapshot has unknown component {}. skipping it.", name);
+            continue;
+        }
+
+        ComponentStorage& storage = *found;
+        size_t first_row = storage.len;
+        size_t rows = column.entities.size();
+
+        if (column.kind == ColumnSnapshot::Kind::Raw) {
+            if (!storage.trivially_copyable || storage.stride != column.stride || column.data.size() != rows * column.stride) {
+                SPDLOG_ERROR("layout of component {} changed since the snapshot was taken. skipping it.", name);
+                continue;
+            }
+
+            // the whole point of the format: one memcpy per column
+            storage.reserve(storage.len + rows);
+            memcpy(storage.compute_pointer(storage.len), column.data.data(), column.data.size());
+            for (size_t idx = 0; idx < rows; idx++) {
+                Entity e = map_entity(remap_ptr, column.entities[idx]);
+                storage.indices.emplace(e, storage.len + idx);
+                storage.entities.push_back(e);
+            }
+            storage.len += rows;
+            storage.touch_rows();
+        } else {
+            if (!storage.can_read_from_snapshot()) {
+                SPDLOG_ERROR("component {} can't be read from snapshots anymore. skipping it.", name);
+                continue;
+            }
+
+            SnapshotReader reader(column.data);
+            storage.reserve(storage.len + rows);
+            for (Entity e : column.entities) {
+                try {
+                    storage.read_row(storage.compute_pointer(storage.len), reader);
+                } catch (const std::exception& err) {
+                    SPDLOG_ERROR("caught exception reading component {} from snapshot. what(): {}", name, err.what());
+                    continue;
+                }
+
+                e = map_entity(remap_ptr, e);
+                storage.indices.emplace(e, storage.len);
+                storage.entities.push_back(e);
+                storage.len++;
+            }
+            storage.touch_rows();
+
+            if (!reader.ok()) {
+                SPDLOG_ERROR("column {} in snapshot is truncated.", name);
+            }
+        }
+
+        if (remap_ptr != nullptr && storage.has_entities()) {
+            for (size_t idx = first_row; idx < storage.len; idx++) {
+                storage.remap_row(storage.compute_pointer(idx), remap);
+            }
+        }
+
+        if (storage.shift_time != nullptr && now_secs != time_secs) {
+            for (size_t idx = first_row; idx < storage.len; idx++) {
+                storage.shift_time(storage.compute_pointer(idx), now_secs - time_secs);
+            }
+        }
+
+        if (storage.on_insert) {
+            for (size_t idx = first_row; idx < storage.len; idx++) {
+                storage.on_insert(storage.entities[idx], storage.compute_pointer(idx));
+            }
+        }
+    }
+}
+
+bool WorldSnapshot::write_to_file(const std::filesystem::path& path) const {
+    std::ofstream file_stream(path, std::ios::binary | std::ios::trunc);
+    if (file_stream.fail()) {
+        SPDLOG_ERROR("couldn't open {} to write a snapshot.", path.string());
+        return false;
+    }
+
+    SnapshotWriter header;
+    header.write_bytes(MAGIC, sizeof(MAGIC));
+    header.write<u32>(VERSION);
+    header.write<u32>(columns.size());
+    header.write<u64>(next_entity);
+    header.write<f64>(time_secs);
+
+    std::vector<u8> bytes = header.take();
+    file_stream.write((const char*)bytes.data(), bytes.size());
+
+    for (auto& column : columns) {
+        SnapshotWriter writer;
+        writer.write(column->kind);
+        writer.write_string(column->component_name);
+        writer.write<u64>(column->stride);
+        writer.write<u64>(column->entities.size());
+        writer.write<u64>(column->data.size());
+        writer.write_bytes(column->entities.data(), column->entities.size() * sizeof(Entity));
+
+        bytes = writer.take();
+        file_stream.write((const char*)bytes.data(), bytes.size());
+        file_stream.write((const char*)column->data.data(), column->data.size());
+    }
+
+    return file_stream.good();
+}
+
+std::optional<WorldSnapshot> WorldSnapshot::read_from_file(const std::filesystem::path& path) {
+    std::shared_ptr<const void> backing;
+    std::span<const u8> bytes;
+    if (!map_file(path, backing, bytes)) return {};
+
+    SnapshotReader reader(bytes);
+
+    char magic[sizeof(MAGIC)];
+    reader.read_bytes(magic, sizeof(magic));
+    if (memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+        SPDLOG_ERROR("{} is not a snapshot.", path.string());
+        return {};
+    }
+
+    u32 version = reader.read<u32>();
+    if (version != VERSION) {
+        SPDLOG_ERROR("snapshot {} has version {}, but we can only read version {}.", path.string(), version, VERSION);
+        return {};
+    }
+
+    WorldSnapshot snapshot;
+    u32 column_count = reader.read<u32>();
+    snapshot.next_entity = reader.read<u64>();
+    snapshot.time_secs = reader.read<f64>();
+
+    for (u32 idx = 0; idx < column_count && reader.ok(); idx++) {
+        ColumnSnapshot column;
+        column.kind = reader.read<ColumnSnapshot::Kind>();
+        column.component_name = reader.read_string();
+        column.stride = reader.read<u64>();
+        u64 rows = reader.read<u64>();
+        u64 data_size = reader.read<u64>();
+
+        if (column.kind > ColumnSnapshot::Kind::Lua || rows > bytes.size()) {
+            SPDLOG_ERROR("snapshot {} is corrupt.", path.string());
+            return {};
+        }
+
+        std::span<const u8> entities = reader.view_bytes(rows * sizeof(Entity));
+        column.entities.resize(entities.size() / sizeof(Entity));
+        memcpy(column.entities.data(), entities.data(), entities.size());
+
+        // no copy here. the column points straight into the mapped file
+        column.data = reader.view_bytes(data_size);
+        column.backing = backing;
+
+        snapshot.columns.push_back(std::make_shared<const ColumnSnapshot>(std::move(column)));
+    }
+
+    if (!reader.ok()) {
+        SPDLOG_ERROR("snapshot {} is truncated.", path.string());
+        return {};
+    }
+
+    return snapshot;
+}
+
+size_t WorldSnapshot::size_in_bytes() const {
+    size_t ret = 0;
+    for (auto& column : columns) ret += column->size_in_bytes();
+    return ret;
+}
+
+void SnapshotRing::forget(const WorldSnapshot& snapshot) {
+    // columns still shared with another tick stay accounted for
+    for (auto& column : snapshot.columns) {
+        if (column.use_count() == 1) stats.bytes -= column->size_in_bytes();
+    }
+}
+
+void SnapshotRing::pop_oldest() {
+    forget(entries[head].snapshot);
+    entries[head].snapshot = WorldSnapshot();
+    head = (head + 1) % capacity;
+    count--;
+}
+
+void SnapshotRing::pop_newest() {
+    size_t idx = (head + count - 1) % capacity;
+    forget(entries[idx].snapshot);
+    entries[idx].snapshot = WorldSnapshot();
+    count--;
+}
+
+void SnapshotRing::capture(ECSWorld& world, u64 tick, f64 time_simulated_secs, f64 now_secs) {
+    if (capacity == 0) return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    const WorldSnapshot* previous = count > 0 ? &entries[(head + count - 1) % capacity].snapshot : nullptr;
+    WorldSnapshot snapshot = WorldSnapshot::capture(world, nullptr, previous);
+    snapshot.time_secs = now_secs;
+
+    // the next capture trusts the versions, so views lua was handed before
+    // now mustn't be able to write anymore
+    world.invalidate_lua_views();
+
+    std::unordered_set<const ColumnSnapshot*> previous_columns;
+    if (previous != nullptr) {
+        for (auto& column : previous->columns) previous_columns.insert(column.get());
+    }
+
+    stats.shared_columns = 0;
+    stats.copied_columns = 0;
+    stats.last_capture_bytes = 0;
+    for (auto& column : snapshot.columns) {
+        if (previous_columns.contains(column.get())) {
+            stats.shared_columns++;
+        } else {
+            stats.copied_columns++;
+            stats.last_capture_bytes += column->size_in_bytes();
+        }
+    }
+
+    // the new snapshot already holds on to anything it shares, so this only
+    // releases what's unique to the oldest tick
+    if (count == capacity) pop_oldest();
+
+    size_t idx = (head + count) % capacity;
+    if (idx == entries.size()) {
+        entries.push_back(Entry { .tick = tick, .time_simulated_secs = time_simulated_secs, .snapshot = std::move(snapshot) });
+    } else {
+        entries[idx] = Entry { .tick = tick, .time_simulated_secs = time_simulated_secs, .snapshot = std::move(snapshot) };
+    }
+    count++;
+
+    stats.bytes += stats.last_capture_bytes;
+    stats.last_capture_secs = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::optional<f64> SnapshotRing::restore(ECSWorld& world, u64 tick, f64 now_secs) {
+    auto oldest = oldest_tick();
+    auto newest = newest_tick();
+    if (!oldest.has_value() || tick < *oldest || tick > *newest) {
+        SPDLOG_WARN("can't rewind to tick {}. only ticks {} to {} are kept.", tick, oldest.value_or(0), newest.value_or(0));
+        return {};
+    }
+
+    while (*newest_tick() > tick) pop_newest();
+
+    Entry& entry = entries[(head + count - 1) % capacity];
+    entry.snapshot.restore(world, WorldSnapshot::RestoreMode::Replace, now_secs);
+    return entry.time_simulated_secs;
+}
+
+std::optional<f64> SnapshotRing::time_secs_at(u64 tick) const {
+    for (size_t idx = 0; idx < count; idx++) {
+        const Entry& entry = entries[(head + idx) % capacity];
+        if (entry.tick == tick) return entry.snapshot.time_secs;
+    }
+    return {};
+}
+
+void SnapshotRing::clear() {
+    while (count > 0) pop_newest();
+    head = 0;
+}
+
+std::optional<u64> SnapshotRing::oldest_tick() const {
+    if (count == 0) return {};
+    return entries[head].tick;
+}
+
+std::optional<u64> SnapshotRing::newest_tick() const {
+    if (count == 0) return {};
+    return entries[(head + count - 1) % capacity].tick;
+}
+
+void motorcar::encode_lua_value(SnapshotWriter& writer, const sol::object& object) {
+    write_lua_value(writer, object);
+}
+
+sol::object motorcar::decode_lua_value(SnapshotReader& reader, sol::state_view& lua) {
+    static const std::vector<std::string> no_schema;
+    return read_lua_value(reader, lua, no_schema);
+}
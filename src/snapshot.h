@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include "types.h"
+
+// world snapshots are a compact binary copy of everything in an ECSWorld that
+// isn't a system. native components are stored column by column, lua
+// components are stored as tagged values with a per-component field schema.
+//
+// file layout (all integers little endian, no padding):
+//   "MCSNAP\0\0" | u32 version | u32 column count | u64 next entity | f64 time
+//   per column: u8 kind | string name | u64 stride | u64 rows | u64 data size
+//               | rows * u64 entity | data
+
+namespace motorcar {
+    class ECSWorld;
+
+    using EntityRemap = std::unordered_map<Entity, Entity>;
+
+    class SnapshotWriter {
+        std::vector<u8> bytes;
+
+        public:
+            template <typename T>
+            void write(const T& t) {
+                static_assert(std::is_trivially_copyable_v<T>);
+                write_bytes(&t, sizeof(T));
+            }
+
+            void write_bytes(const void* data, size_t size) {
+                const u8* ptr = (const u8*)data;
+                bytes.insert(bytes.end(), ptr, ptr + size);
+            }
+
+            void write_string(std::string_view s) {
+                write<u64>(s.size());
+                write_bytes(s.data(), s.size());
+            }
+
+            size_t size() const { return bytes.size(); }
+            std::span<const u8> view() const { return bytes; }
+            std::vector<u8> take() { return std::move(bytes); }
+    };
+
+    // reading past the end doesn't throw. it marks the reader as failed and
+    // hands back zeroes, so callers only need to check ok() once they're done.
+    class SnapshotReader {
+        const u8* cursor;
+        const u8* end;
+        bool failed = false;
+
+        public:
+            SnapshotReader(std::span<const u8> data) : cursor(data.data()), end(data.data() + data.size()) {}
+
+            template <typename T>
+            T read() {
+                static_assert(std::is_trivially_copyable_v<T>);
+                T t;
+                read_bytes(&t, sizeof(T));
+                return t;
+            }
+
+            void read_bytes(void* dest, size_t size) {
+                if ((size_t)(end - cursor) < size) {
+                    failed = true;
+                    cursor = end;
+                    memset(dest, 0, size);
+                    return;
+                }
+
+                memcpy(dest, cursor, size);
+                cursor += size;
+            }
+
+            // borrow the next `size` bytes without copying them
+            std::span<const u8> view_bytes(size_t size) {
+                if ((size_t)(end - cursor) < size) {
+                    failed = true;
+                    cursor = end;
+                    return {};
+                }
+
+                std::span<const u8> ret(cursor, size);
+                cursor += size;
+                return ret;
+            }
+
+            std::string read_string() {
+                std::span<const u8> s = view_bytes(read<u64>());
+                return std::string((const char*)s.data(), s.size());
+            }
+
+            bool ok() const { return !failed; }
+    };
+
+    // a lua value (nil, booleans, numbers, strings, vectors, quats and tables of
+    // those) in the same encoding snapshots use, for copying values between lua states.
+    // anything else comes back as nil
+    void encode_lua_value(SnapshotWriter& writer, const sol::object& object);
+    sol::object decode_lua_value(SnapshotReader& reader, sol::state_view& lua);
+
+    struct ColumnSnapshot {
+        enum class Kind : u8 {
+            Raw,        // trivially copyable native component, the storage's blob as is
+            Serialized, // native component written through its ComponentSerializer
+            Lua,        // lua component, schema followed by one tagged value per row
+        };
+
+        Kind kind;
+        std::string component_name;
+        u64 stride = 0;
+        std::vector<Entity> entities;
+
+        // a ComponentStorage::version the storage held exactly these rows at, 0
+        // for lua columns. a later capture that finds the same bytes moves it up,
+        // which is still true of every snapshot sharing the column. not written to files.
+        mutable u64 storage_version = 0;
+
+        // the bytes live in `backing`, which is either a vector or a mapped file
+        std::span<const u8> data;
+        std::shared_ptr<const void> backing;
+
+        size_t size_in_bytes() const { return data.size() + entities.size() * sizeof(Entity); }
+    };
+
+    struct WorldSnapshot {
+        static const u32 VERSION = 2;
+
+        enum class RestoreMode {
+            // the snapshot's entities replace every non-system entity in the world
+            Replace,
+            // the snapshot's entities are spawned as new entities next to the existing ones
+            Append,
+        };
+
+        Entity next_entity = 0;
+        std::vector<std::shared_ptr<const ColumnSnapshot>> columns;
+
+        // the timer wheel's simulated time when it was captured, set by whoever
+        // captured it. components holding an absolute time (like Lifetime's
+        // expires_at) are moved by the difference when it's restored
+        f64 time_secs = 0.;
+
+        // the newest version of the System, EventHandler, Task and KernelBinding storages at
+        // capture time, so the next capture knows the same entities are left out.
+        // not written to files.
+        u64 systems_version = 0;
+
+        // entities that own a System, EventHandler, Task or KernelBinding are never
+        // captured. they belong to the script that made them, not to the world's data.
+        //
+        // columns that are byte for byte the same as in `previous` are shared
+        // with it instead of stored twice. `previous` has to come from the same
+        // world: without `include`, columns whose version hasn't moved since
+        // `previous` are shared without being looked at.
+        static WorldSnapshot capture(
+                ECSWorld& world,
+                std::function<bool(Entity)> include = nullptr,
+                const WorldSnapshot* previous = nullptr
+        );
+        static std::optional<WorldSnapshot> read_from_file(const std::filesystem::path& path);
+
+        bool write_to_file(const std::filesystem::path& path) const;
+
+        // runs immediately, so only call this between systems (e.g. from the command queue).
+        // `now_secs` is the timer wheel's time now, see time_secs
+        void restore(ECSWorld& world, RestoreMode mode, f64 now_secs) const;
+
+        size_t size_in_bytes() const;
+    };
+
+    // the last few ticks of world state, for rewinding and replaying
+    class SnapshotRing {
+        struct Entry {
+            u64 tick;
+            f64 time_simulated_secs; // when the tick after it runs
+            WorldSnapshot snapshot;
+        };
+
+        std::vector<Entry> entries;
+        size_t capacity;
+        size_t head = 0; // index of the oldest entry
+        size_t count = 0;
+
+        void pop_newest();
+        void pop_oldest();
+        void forget(const WorldSnapshot& snapshot);
+
+        public:
+            struct Stats {
+                f64 last_capture_secs = 0.;
+                size_t last_capture_bytes = 0; // bytes the last capture actually copied
+                size_t shared_columns = 0;     // columns the last capture shared with the tick before
+                size_t copied_columns = 0;
+                size_t bytes = 0;              // bytes held by the whole ring, shared columns counted once
+            };
+
+            SnapshotRing(size_t capacity) : capacity(capacity) { entries.reserve(capacity); }
+
+            // `now_secs` is the timer wheel's time, see WorldSnapshot::time_secs
+            void capture(ECSWorld& world, u64 tick, f64 time_simulated_secs, f64 now_secs);
+            // puts the world back how it was at the end of `tick` and forgets every
+            // later tick. returns the simulated time captured with it, empty if
+            // `tick` isn't kept
+            std::optional<f64> restore(ECSWorld& world, u64 tick, f64 now_secs);
+            // the timer wheel's time captured with `tick`, empty if `tick` isn't kept
+            std::optional<f64> time_secs_at(u64 tick) const;
+            void clear();
+
+            std::optional<u64> oldest_tick() const;
+            std::optional<u64> newest_tick() const;
+            size_t size() const { return count; }
+            const Stats& get_stats() const { return stats; }
+
+        private:
+            Stats stats;
+    };
+}
@@ -67,6 +67,24 @@ void SoundManager::play_music(std::string_view path) {
     }
 }
 
+void SoundManager::play_sound(ResourceHandle handle) {
+    auto sound = engine.resources->get_resource<SoLoud::Wav>(handle);
+    if (sound.has_value()) {
+        soloud.play(**sound);
+    } else {
+        spdlog::error("Could not load sound '{}'", engine.resources->path_of(handle));
+    }
+}
+
+void SoundManager::play_music(ResourceHandle handle) {
+    auto sound = engine.resources->get_resource<SoLoud::Wav>(handle);
+    if (sound.has_value()) {
+        (**sound).setLooping(true);
+        soloud.play(**sound);
+    } else {
+        spdlog::error("Could not load sound '{}'", engine.resources->path_of(handle));
+    }
+}
 
 SoundManager::~SoundManager() {
     soloud.deinit();
@@ -2,6 +2,9 @@
 
 #include <soloud.h>
 #include <string_view>
+
+#include "resources.h"
+
 namespace motorcar {
     struct Engine;
     class SoundManager {
@@ -14,5 +17,7 @@ namespace motorcar {
 
             void play_sound(std::string_view path);
             void play_music(std::string_view path);
+            void play_sound(ResourceHandle handle);
+            void play_music(ResourceHandle handle);
     };
 }
@@ -0,0 +1,132 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include <chrono>
+#include <fstream>
+#include <unordered_set>
+
+#include <spdlog/spdlog.h>
+
+#include "stage_preloader.h"
+#include "resources.h"
+
+using namespace motorcar;
+
+namespace {
+    f64 secs_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // string literals in `code` that name a file under assets/. escapes aren't
+    // handled, asset paths don't have any
+    void find_assets(const std::string& code, std::unordered_set<std::string>& assets) {
+        for (size_t idx = 0; idx < code.size(); idx++) {
+            char quote = code[idx];
+            if (quote != '"' && quote != '\'') continue;
+
+            size_t end = idx + 1;
+            while (end < code.size() && code[end] != quote && code[end] != '\n') end++;
+            if (end >= code.size() || code[end] != quote) {
+                idx = end;
+                continue;
+            }
+
+            std::string_view literal(code.data() + idx + 1, end - idx - 1);
+            idx = end;
+            if (literal.empty() || literal.starts_with("::") || literal.find('.') == std::string_view::npos) continue;
+
+            std::error_code error;
+            if (std::filesystem::is_regular_file(ResourceManager::convert_path(literal), error)) {
+                assets.emplace(literal);
+            }
+        }
+    }
+
+    // reads the whole file and throws it away, so loading it for real finds it in the page cache
+    void warm(const std::filesystem::path& path) {
+        std::ifstream file_stream(path, std::ios::binary);
+        std::vector<char> buffer(64 * 1024);
+        while (file_stream.read(buffer.data(), buffer.size())) {}
+    }
+}
+
+void StagePreloader::work(Job& job, const BytecodeCache& bytecode,
+        std::vector<std::pair<std::filesystem::path, std::string>> scripts, std::filesystem::path snapshot_path) {
+    auto start = std::chrono::steady_clock::now();
+    std::unordered_set<std::string> assets;
+
+    for (auto& [path, chunk_name] : scripts) {
+        std::ifstream file_stream(path, std::ios::binary);
+        // only in the bundle, which is already compiled
+        if (file_stream.fail()) continue;
+
+        std::string code { std::istreambuf_iterator<char>(file_stream), std::istreambuf_iterator<char>() };
+        if (auto precompiled = bytecode.precompile(code, chunk_name)) {
+            job.stage.scripts.push_back(std::move(*precompiled));
+        }
+        find_assets(code, assets);
+    }
+
+    std::error_code error;
+    auto snapshot_time = std::filesystem::last_write_time(snapshot_path, error);
+    if (!error) {
+        job.stage.snapshot_time = snapshot_time;
+        job.stage.snapshot = WorldSnapshot::read_from_file(snapshot_path);
+    }
+
+    for (const std::string& asset : assets) {
+        warm(ResourceManager::convert_path(asset));
+        job.stage.assets.push_back(asset);
+    }
+
+    job.stage.secs = secs_since(start);
+    job.finished.store(true, std::memory_order_release);
+}
+
+void StagePreloader::wait() {
+    if (job != nullptr && job->thread.joinable()) {
+        job->thread.join();
+    }
+}
+
+void StagePreloader::preload(std::string stage_name, const BytecodeCache& bytecode,
+        std::vector<std::pair<std::filesystem::path, std::string>> scripts, std::filesystem::path snapshot_path) {
+    if (job != nullptr && job->stage.name == stage_name) return;
+
+    wait();
+    job = std::make_unique<Job>();
+    job->stage.name = stage_name;
+    job->thread = std::thread(work, std::ref(*job), std::cref(bytecode), std::move(scripts), std::move(snapshot_path));
+
+    SPDLOG_DEBUG("preloading stage {}.", stage_name);
+}
+
+void StagePreloader::step(ResourceManager& resources) {
+    if (job == nullptr || !job->finished.load(std::memory_order_acquire)) return;
+
+    auto& assets = job->stage.assets;
+    if (job->assets_loaded == assets.size()) return;
+
+    auto start = std::chrono::steady_clock::now();
+    while (job->assets_loaded < assets.size() && secs_since(start) < budget_secs) {
+        resources.load_resource(assets[job->assets_loaded++]);
+    }
+
+    if (job->assets_loaded == assets.size()) {
+        SPDLOG_DEBUG("preloaded stage {}: {} scripts, {} assets, {:.2f}ms on its thread.",
+            job->stage.name, job->stage.scripts.size(), assets.size(), job->stage.secs * 1000.);
+    }
+}
+
+bool StagePreloader::is_ready(std::string_view stage_name) const {
+    return job != nullptr && job->stage.name == stage_name
+        && job->finished.load(std::memory_order_acquire)
+        && job->assets_loaded == job->stage.assets.size();
+}
+
+std::optional<StagePreloader::Stage> StagePreloader::take(std::string_view stage_name) {
+    if (job == nullptr || job->stage.name != stage_name) return {};
+
+    wait();
+    Stage ret = std::move(job->stage);
+    job = nullptr;
+    return ret;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+#include "bytecode.h"
+#include "snapshot.h"
+
+// changing stages parses the stage's scripts, reads its baked snapshot and
+// loads whatever assets its scripts ask for, all in the frame the stage
+// changes. Stages.preload(name) gets that done ahead of time:
+//   - a thread compiles the stage's scripts (see BytecodeCache::precompile),
+//     reads its baked snapshot, and reads every file under assets/ that the
+//     scripts name in a string literal
+//   - once it's done, the main thread loads those assets into the resource
+//     manager, spending at most `budget_secs` of each frame on them. loaders
+//     can touch the gpu, so they stay on the main thread
+//
+// changing to a preloaded stage loads its scripts from the compiled bytecode
+// and appends the snapshot as is. the snapshot is the only thing staged ahead
+// of time: the stage's scripts share the one lua state and world with
+// everything else, so they still run in the frame the stage changes, and
+// whatever they spawn or register (systems, tasks, timers) happens then too.
+// a baked stage's scripts skip spawning (see Stages.from_snapshot), which
+// leaves them registering systems and not much else. bake a stage to get the
+// most out of preloading it.
+
+namespace motorcar {
+    class ResourceManager;
+
+    class StagePreloader {
+        public:
+            struct Stage {
+                std::string name;
+                std::vector<BytecodeCache::Precompiled> scripts;
+                std::optional<WorldSnapshot> snapshot;
+                // the baked snapshot's last write when it was read, to tell
+                // whether it's been baked again since
+                std::filesystem::file_time_type snapshot_time = std::filesystem::file_time_type::min();
+                std::vector<std::string> assets; // resource paths the scripts mention
+                f64 secs = 0.;                   // spent on the thread
+            };
+
+        private:
+            struct Job {
+                Stage stage;
+                std::thread thread;
+                std::atomic<bool> finished = false;
+                size_t assets_loaded = 0;
+            };
+
+            // one at a time
+            std::unique_ptr<Job> job;
+
+            static void work(Job& job, const BytecodeCache& bytecode,
+                std::vector<std::pair<std::filesystem::path, std::string>> scripts, std::filesystem::path snapshot_path);
+            void wait();
+
+        public:
+            f64 budget_secs = 0.002;
+
+            StagePreloader() = default;
+            ~StagePreloader() { wait(); }
+
+            // `scripts` are (path, chunk name). preloading another stage first
+            // waits for the one that's going, and forgets it
+            void preload(std::string stage_name, const BytecodeCache& bytecode,
+                std::vector<std::pair<std::filesystem::path, std::string>> scripts, std::filesystem::path snapshot_path);
+
+            // once a frame, loads some of the finished preload's assets
+            void step(ResourceManager& resources);
+
+            // its thread is done and its assets are loaded
+            bool is_ready(std::string_view stage_name) const;
+
+            // hands over what was preloaded for `stage_name`, waiting for the
+            // thread if it's still going. empty if it wasn't preloaded
+            std::optional<Stage> take(std::string_view stage_name);
+
+            StagePreloader(StagePreloader&) = delete;
+            StagePreloader& operator=(StagePreloader&) = delete;
+    };
+}
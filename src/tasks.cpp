@@ -0,0 +1,110 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include <spdlog/spdlog.h>
+
+#include "tasks.h"
+#include "engine.h"
+#include "ecs.h"
+#include "components.h"
+#include "timers.h"
+#include "lua_alloc.h"
+
+using namespace motorcar;
+
+Entity TaskScheduler::spawn(sol::protected_function fn, const std::vector<sol::object>& args, std::string script) {
+    // tasks spawned by tasks belong to the same script
+    if (running.has_value()) script = running->task->script;
+
+    Entity e = engine.ecs->new_entity();
+
+    sol::thread thread = sol::thread::create(lua.lua_state());
+    sol::coroutine coroutine(thread.thread_state(), fn);
+    auto task = std::make_shared<TaskState>(e, thread, coroutine, script, engine.stage.value_or(""));
+
+    if (engine.stage.has_value()) {
+        engine.ecs->emplace_native_component<BoundToStage>(e, engine.stage.value());
+    }
+    engine.ecs->emplace_native_component<BoundToScript>(e, script);
+    engine.ecs->emplace_native_component<Task>(e, task);
+
+    resume(task, args);
+    return e;
+}
+
+void TaskScheduler::resume(std::shared_ptr<TaskState> task, const std::vector<sol::object>& args) {
+    // tasks can wake other tasks (by firing events), so this nests
+    std::optional<Running> outer = std::exchange(running, Running { .task = task.get(), .wait = {} });
+    LuaAllocator* allocator = LuaAllocator::of(lua.lua_state());
+    LuaAllocator::Scope allocation_scope(allocator, allocator ? allocator->owner(task->script) : 0);
+    sol::protected_function_result result = task->coroutine(sol::as_args(args));
+    std::optional<Wait> wait = running->wait;
+    running = outer;
+
+    if (!result.valid()) {
+        sol::error error = result;
+        SPDLOG_ERROR("task from {} died. what(): {}", task->script, error.what());
+        engine.ecs->delete_entity(task->entity);
+    } else if (result.status() == sol::call_status::yielded) {
+        // a plain coroutine.yield() waits for the next tick
+        suspend(task, wait.value_or(Wait { .kind = Wait::Kind::Ticks, .amount = 1 }));
+    } else {
+        engine.ecs->delete_entity(task->entity);
+    }
+}
+
+void TaskScheduler::suspend(std::shared_ptr<TaskState> task, Wait wait) {
+    // only the Task component keeps a task alive
+    std::weak_ptr<TaskState> weak = task;
+    auto wake = [this, weak](TimerId) {
+        if (auto task = weak.lock()) resume(task, {});
+    };
+
+    switch (wait.kind) {
+        case Wait::Kind::Seconds:
+            engine.timers->after(wait.amount, wake, task->owner);
+            break;
+        case Wait::Kind::Ticks:
+            engine.timers->after_ticks((u64)wait.amount, wake, task->owner);
+            break;
+        case Wait::Kind::Event: {
+            // cancelled tasks (and ones whose stage is gone) are left behind until
+            // the event fires, which might be never
+            auto& waiters = event_waiters[wait.event];
+            std::erase_if(waiters, [](const std::weak_ptr<TaskState>& waiter) { return waiter.expired(); });
+            waiters.push_back(weak);
+            break;
+        }
+    }
+}
+
+void TaskScheduler::wait(lua_State* L, Wait wait) {
+    if (!running.has_value() || running->task->thread.thread_state() != L) {
+        throw std::runtime_error("tasks can only wait from inside a task. start one with Tasks.spawn.");
+    }
+
+    running->wait = wait;
+}
+
+void TaskScheduler::wait_secs(lua_State* L, f64 secs) {
+    wait(L, Wait { .kind = Wait::Kind::Seconds, .amount = secs });
+}
+
+void TaskScheduler::wait_ticks(lua_State* L, u64 ticks) {
+    wait(L, Wait { .kind = Wait::Kind::Ticks, .amount = (f64)ticks });
+}
+
+void TaskScheduler::wait_for_event(lua_State* L, EventId event) {
+    wait(L, Wait { .kind = Wait::Kind::Event, .event = event });
+}
+
+void TaskScheduler::notify_event(EventId event, sol::object payload) {
+    auto it = event_waiters.find(event);
+    if (it == event_waiters.end()) return;
+
+    // tasks that wait for the same event again wait for the next one
+    std::vector<std::weak_ptr<TaskState>> waiters = std::move(it->second);
+    event_waiters.erase(it);
+
+    for (auto& weak : waiters) {
+        if (auto task = weak.lock()) resume(task, { payload });
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include "types.h"
+
+// tasks are lua functions run as coroutines. Tasks.wait and friends yield back
+// to the scheduler, which parks the task on the timer wheel or on an event and
+// only resumes it once it's ready. a task nobody is waking up costs nothing.
+//
+// every task is an entity with a Task component, bound to its stage and script
+// like a system is. the Task component holds the only strong reference to the
+// coroutine, so deleting the entity is all it takes to kill a task.
+
+namespace motorcar {
+    struct Engine;
+
+    struct TaskState {
+        Entity entity;
+        sol::thread thread;
+        sol::coroutine coroutine;
+        std::string script;
+        std::string owner; // the stage that spawned it, for the timers it waits on
+
+        TaskState(Entity entity, sol::thread thread, sol::coroutine coroutine, std::string script, std::string owner) :
+            entity(entity), thread(thread), coroutine(coroutine), script(script), owner(owner) {}
+    };
+
+    class TaskScheduler {
+        struct Wait {
+            enum class Kind { Ticks, Seconds, Event };
+
+            Kind kind;
+            f64 amount = 0;
+            EventId event = 0;
+        };
+
+        struct Running {
+            TaskState* task;
+            std::optional<Wait> wait;
+        };
+
+        Engine& engine;
+        sol::state& lua;
+
+        // the task being resumed right now, if any
+        std::optional<Running> running;
+        std::unordered_map<EventId, std::vector<std::weak_ptr<TaskState>>> event_waiters;
+
+        void resume(std::shared_ptr<TaskState> task, const std::vector<sol::object>& args);
+        void suspend(std::shared_ptr<TaskState> task, Wait wait);
+        void wait(lua_State* L, Wait wait);
+
+        public:
+            TaskScheduler(Engine& engine, sol::state& lua) : engine(engine), lua(lua) {}
+
+            // runs `fn` until its first wait before returning
+            Entity spawn(sol::protected_function fn, const std::vector<sol::object>& args, std::string script);
+
+            // these are called from inside a task, right before it yields
+            void wait_secs(lua_State* L, f64 secs);
+            void wait_ticks(lua_State* L, u64 ticks);
+            void wait_for_event(lua_State* L, EventId event);
+
+            void notify_event(EventId event, sol::object payload);
+    };
+}
@@ -0,0 +1,167 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include <cmath>
+#include <spdlog/spdlog.h>
+
+#include "timers.h"
+
+using namespace motorcar;
+
+u64 TimerWheel::ticks_from_secs(f64 secs) const {
+    if (!(secs > 0)) return 0;
+
+    // a little slack so 2 seconds at 60hz is 120 ticks and not 121
+    return (u64)std::ceil(secs / resolution_secs - 1e-6);
+}
+
+TimerId TimerWheel::add(u64 deadline, u64 period, TimerCallback callback, std::string owner) {
+    // nothing fires on the tick it was made on, that tick is already being worked through
+    deadline = std::max(deadline, now + 1);
+
+    TimerId id = next_id++;
+    timers.emplace(id, Timer {
+        .deadline = deadline,
+        .period = period,
+        .callback = std::move(callback),
+        .owner = std::move(owner)
+    });
+    place(id, deadline);
+
+    return id;
+}
+
+void TimerWheel::place(TimerId id, u64 deadline) {
+    deadline = std::max(deadline, now);
+    u64 delta = deadline - now;
+
+    // the coarsest level that still tells this deadline apart from now.
+    // anything further out than the top level can see goes in the top level,
+    // and gets looked at again every time its slot comes around.
+    u32 level = 0;
+    while (level < LEVELS - 1 && delta >= (1ull << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    u64 slot = (deadline >> (SLOT_BITS * level)) & (SLOTS - 1);
+    wheel[level][slot].push_back(id);
+}
+
+void TimerWheel::cascade(u32 level) {
+    u64 slot = (now >> (SLOT_BITS * level)) & (SLOTS - 1);
+
+    std::vector<TimerId> ids;
+    std::swap(ids, wheel[level][slot]);
+
+    for (TimerId id : ids) {
+        auto it = timers.find(id);
+        if (it == timers.end()) continue;
+
+        place(id, it->second.deadline);
+    }
+}
+
+size_t TimerWheel::step() {
+    now++;
+
+    // whenever a level wraps around, the slot of the level above it that just
+    // came up gets spread out over the levels below
+    for (u32 level = 1; level < LEVELS; level++) {
+        if ((now & ((1ull << (SLOT_BITS * level)) - 1)) != 0) break;
+        cascade(level);
+    }
+
+    std::vector<TimerId> ids;
+    std::swap(ids, wheel[0][now & (SLOTS - 1)]);
+
+    size_t fired = 0;
+    for (TimerId id : ids) {
+        auto it = timers.find(id);
+        if (it == timers.end()) continue;
+
+        Timer& timer = it->second;
+        if (timer.deadline > now) {
+            place(id, timer.deadline);
+            continue;
+        }
+
+        // reschedule before calling back, so the callback can cancel it
+        TimerCallback callback;
+        if (timer.period > 0) {
+            timer.deadline += timer.period;
+            place(id, timer.deadline);
+            callback = timer.callback;
+        } else {
+            callback = std::move(timer.callback);
+            timers.erase(it);
+        }
+
+        fired++;
+        try {
+            if (callback) callback(id);
+        } catch (const std::exception& e) {
+            SPDLOG_ERROR("caught exception in timer callback. what(): {}", e.what());
+        }
+    }
+
+    return fired;
+}
+
+TimerId TimerWheel::after(f64 delay_secs, TimerCallback callback, std::string owner) {
+    return add(now + ticks_from_secs(delay_secs), 0, std::move(callback), std::move(owner));
+}
+
+TimerId TimerWheel::after_ticks(u64 ticks, TimerCallback callback, std::string owner) {
+    return add(now + ticks, 0, std::move(callback), std::move(owner));
+}
+
+TimerId TimerWheel::every(f64 period_secs, TimerCallback callback, std::string owner) {
+    u64 period = std::max(ticks_from_secs(period_secs), (u64)1);
+    return add(now + period, period, std::move(callback), std::move(owner));
+}
+
+TimerId TimerWheel::at(f64 time_secs, TimerCallback callback, std::string owner) {
+    return add(ticks_from_secs(time_secs), 0, std::move(callback), std::move(owner));
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    return timers.erase(id) > 0;
+}
+
+void TimerWheel::cancel_owned_by(std::string_view owner) {
+    std::erase_if(timers, [&](auto& pair) { return pair.second.owner == owner; });
+}
+
+u64 TimerWheel::ticks_at(f64 time_secs) const {
+    if (!(time_secs > 0)) return 0;
+    return (u64)std::floor(time_secs / resolution_secs + 1e-6);
+}
+
+size_t TimerWheel::advance_to(f64 time_secs) {
+    if (!(time_secs > 0)) return 0;
+
+    u64 target = ticks_at(time_secs);
+
+    size_t fired = 0;
+    while (now < target) {
+        fired += step();
+    }
+    return fired;
+}
+
+void TimerWheel::rebase_to(f64 time_secs) {
+    u64 target = ticks_at(time_secs);
+    if (target == now) return;
+
+    // every timer is still in the future, so none of them can end up behind the new now
+    for (auto& [_, timer] : timers) {
+        timer.deadline = timer.deadline - now + target;
+    }
+    now = target;
+
+    // slots are picked relative to now, so everything gets placed again
+    for (auto& level : wheel) {
+        for (auto& slot : level) slot.clear();
+    }
+    for (auto& [id, timer] : timers) {
+        place(id, timer.deadline);
+    }
+}
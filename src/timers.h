@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+
+// a hierarchical timing wheel. time is counted in ticks of `resolution_secs`,
+// and the engine drives it with the simulated clock once per physics step.
+//
+// level 0 has one slot per tick, level 1 one slot per 64 ticks and so on. a
+// timer sits in the coarsest slot that still tells it apart from now, and gets
+// moved down a level whenever the level below wraps around. so advancing a tick
+// only ever touches the timers that are due (and the odd cascade), never every
+// live timer.
+//
+// the wheel isn't part of world snapshots. rewinding the world moves its clock
+// back (see rebase_to), and every pending timer keeps the time it had left.
+
+namespace motorcar {
+    using TimerId = u64;
+    using TimerCallback = std::function<void(TimerId)>;
+
+    class TimerWheel {
+        static const u32 LEVELS = 4;
+        static const u32 SLOT_BITS = 6;
+        static const u32 SLOTS = 1 << SLOT_BITS;
+
+        struct Timer {
+            u64 deadline; // in ticks
+            u64 period;   // in ticks, 0 for one shot timers
+            TimerCallback callback;
+            std::string owner;
+        };
+
+        f64 resolution_secs;
+        u64 now = 0;
+        TimerId next_id = 1;
+
+        // cancelling only erases from here. the id left behind in the wheel is
+        // skipped when its slot comes up.
+        std::unordered_map<TimerId, Timer> timers;
+        std::array<std::array<std::vector<TimerId>, SLOTS>, LEVELS> wheel;
+
+        u64 ticks_from_secs(f64 secs) const;
+        u64 ticks_at(f64 time_secs) const;
+        TimerId add(u64 deadline, u64 period, TimerCallback callback, std::string owner);
+        void place(TimerId id, u64 deadline);
+        void cascade(u32 level);
+        size_t step();
+
+        public:
+            TimerWheel(f64 resolution_secs) : resolution_secs(resolution_secs) {}
+
+            // `owner` is used to cancel a group of timers at once, e.g. a stage's
+            TimerId after(f64 delay_secs, TimerCallback callback, std::string owner = "");
+            TimerId after_ticks(u64 ticks, TimerCallback callback, std::string owner = "");
+            TimerId every(f64 period_secs, TimerCallback callback, std::string owner = "");
+            TimerId at(f64 time_secs, TimerCallback callback, std::string owner = "");
+
+            bool cancel(TimerId id);
+            void cancel_owned_by(std::string_view owner);
+
+            // fires every timer due by `time_secs`. returns how many fired.
+            // going backwards in time does nothing.
+            size_t advance_to(f64 time_secs);
+            // sets the clock to `time_secs` without firing anything, either way.
+            // pending timers move with it, so they're as far off as they were
+            void rebase_to(f64 time_secs);
+
+            f64 now_secs() const { return now * resolution_secs; }
+            size_t size() const { return timers.size(); }
+    };
+}
@@ -1,11 +1,51 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <string>
 #include <string_view>
+#include <type_traits>
+
+#include "types.h"
 
 namespace motorcar {
+    // the types a component field can have when lua reads and writes it
+    // straight from the component's memory. see ComponentSchema and bind_native_fields
+    enum class FieldType { F32, F64, I32, I64, Bool, Entity, String, Vec2, Vec3, Quat };
+
+    struct ComponentField {
+        std::string_view name;
+        FieldType type;
+        size_t offset;
+    };
+
+    template <typename T>
+    constexpr FieldType field_type() {
+        if constexpr (std::is_same_v<T, f32>) return FieldType::F32;
+        else if constexpr (std::is_same_v<T, f64>) return FieldType::F64;
+        else if constexpr (std::is_same_v<T, i32>) return FieldType::I32;
+        else if constexpr (std::is_same_v<T, i64>) return FieldType::I64;
+        else if constexpr (std::is_same_v<T, bool>) return FieldType::Bool;
+        else if constexpr (std::is_same_v<T, Entity>) return FieldType::Entity;
+        else if constexpr (std::is_same_v<T, std::string>) return FieldType::String;
+        else if constexpr (std::is_same_v<T, vec2>) return FieldType::Vec2;
+        else if constexpr (std::is_same_v<T, vec3>) return FieldType::Vec3;
+        else if constexpr (std::is_same_v<T, quat>) return FieldType::Quat;
+        else static_assert(!sizeof(T), "this type can't be a component field");
+    }
+
     template <typename T>
     struct ComponentTypeTrait {
         constexpr static bool value = false;
         constexpr static std::string_view component_name = "";
+        // the fields lua can get at directly, see COMPONENT_FIELDS
+        constexpr static std::array<ComponentField, 0> fields = {};
+    };
+
+    // components that aren't trivially copyable need one of these to show up
+    // in world snapshots. see snapshot.h
+    template <typename T>
+    struct ComponentSerializer {
+        constexpr static bool value = false;
     };
 }
@@ -28,6 +28,7 @@ namespace motorcar {
     typedef glm::mat4 mat4;
 
     typedef size_t Entity;
+    typedef u32 EventId;
 
     struct AABB {
         vec3 center;
@@ -0,0 +1,154 @@
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+#include "watchdog.h"
+
+using namespace motorcar;
+
+void SystemWatchdog::on_hook(void* self, lua_State* L) {
+    auto& watchdog = *(SystemWatchdog*)self;
+    if (!watchdog.watching.has_value()) return;
+
+    Watch& watch = watchdog.watching.value();
+    watch.instructions += CHECK_EVERY;
+
+    if (!watch.tripped) {
+        bool over_instructions = watch.budget.instructions > 0 && watch.instructions > watch.budget.instructions;
+        bool over_time = watch.budget.secs > 0. &&
+            std::chrono::duration<f64>(std::chrono::steady_clock::now() - watch.start).count() > watch.budget.secs;
+        watch.tripped = over_instructions || over_time;
+    }
+
+    // keeps raising until the run is over, in case the script pcalls around it.
+    // nothing with a destructor can be alive here, luaL_error longjmps
+    if (watch.tripped) {
+        // named, since it might be an event handler the owner fired that's running
+        luaL_error(L, "the system registered at %s went over its budget (%I instructions, %fms)",
+            watchdog.entries[watch.system].where.c_str(),
+            (lua_Integer)watch.budget.instructions, (lua_Number)(watch.budget.secs * 1000.));
+    }
+}
+
+SystemWatchdog::Scope::Scope(SystemWatchdog& watchdog, u32 system) : watchdog(watchdog) {
+    Entry& entry = watchdog.entries[system];
+
+    if (entry.state == State::Disabled) {
+        entry.skipped++;
+        allowed = false;
+        return;
+    }
+    if (entry.state == State::Throttled && entry.due++ % THROTTLE_EVERY != 0) {
+        entry.skipped++;
+        allowed = false;
+        return;
+    }
+
+    SystemBudget budget = entry.budget.value_or(watchdog.default_budget);
+    if (budget.is_unlimited()) return;
+
+    watched = true;
+    outer = std::exchange(watchdog.watching, Watch {
+        .system = system,
+        .budget = budget,
+        .start = std::chrono::steady_clock::now(),
+    });
+    watchdog.hooks.set(LuaHooks::Watchdog, CHECK_EVERY, on_hook, &watchdog);
+}
+
+SystemWatchdog::Scope::~Scope() {
+    if (!watched) return;
+
+    watchdog.finish(watchdog.watching.value());
+    watchdog.watching = outer;
+    if (!outer.has_value()) {
+        watchdog.hooks.clear(LuaHooks::Watchdog);
+    }
+}
+
+void SystemWatchdog::finish(Watch& watch) {
+    Entry& entry = entries[watch.system];
+    entry.last_instructions = watch.instructions;
+    entry.last_secs = std::chrono::duration<f64>(std::chrono::steady_clock::now() - watch.start).count();
+
+    if (!watch.tripped) {
+        entry.consecutive_trips = 0;
+        if (entry.state == State::Throttled && ++entry.clean_runs >= UNTHROTTLE_AFTER) {
+            entry.state = State::Ok;
+            SPDLOG_INFO("system registered at {} stayed in budget, it's not throttled anymore.", entry.where);
+        }
+        return;
+    }
+
+    stats.trips++;
+    entry.trips++;
+    entry.clean_runs = 0;
+    entry.consecutive_trips++;
+
+    if (entry.consecutive_trips >= DISABLE_AFTER) {
+        entry.state = State::Disabled;
+        SPDLOG_ERROR("system registered at {} went over its budget {} runs in a row, disabling it.", entry.where, entry.consecutive_trips);
+    } else if (entry.consecutive_trips >= THROTTLE_AFTER && entry.state == State::Ok) {
+        entry.state = State::Throttled;
+        entry.due = 1;
+        SPDLOG_WARN("system registered at {} went over its budget {} runs in a row, only running it one run in {}.",
+            entry.where, entry.consecutive_trips, THROTTLE_EVERY);
+    }
+}
+
+u32 SystemWatchdog::system(std::string_view where, std::optional<SystemBudget> budget) {
+    std::string key { where };
+    auto it = entry_ids.find(key);
+    if (it != entry_ids.end()) {
+        entries[it->second] = Entry { .where = std::move(key), .budget = budget };
+        return it->second;
+    }
+
+    u32 ret = entries.size();
+    entries.push_back(Entry { .where = key, .budget = budget });
+    entry_ids.emplace(std::move(key), ret);
+    return ret;
+}
+
+void SystemWatchdog::reset() {
+    for (auto& entry : entries) {
+        entry.state = State::Ok;
+        entry.consecutive_trips = 0;
+        entry.clean_runs = 0;
+    }
+}
+
+SystemWatchdog::Stats SystemWatchdog::end_frame() {
+    Stats ret = stats;
+    for (auto& entry : entries) {
+        if (entry.state == State::Throttled) ret.throttled++;
+        if (entry.state == State::Disabled) ret.disabled++;
+    }
+    stats = {};
+    return ret;
+}
+
+std::vector<SystemWatchdog::SystemReport> SystemWatchdog::report() const {
+    std::vector<SystemReport> ret;
+    for (auto& entry : entries) {
+        ret.push_back(SystemReport {
+            .where = entry.where,
+            .state = entry.state,
+            .trips = entry.trips,
+            .skipped = entry.skipped,
+            .last_instructions = entry.last_instructions,
+            .last_secs = entry.last_secs,
+        });
+    }
+    return ret;
+}
+
+std::string_view SystemWatchdog::state_name(State state) {
+    switch (state) {
+        case State::Ok: return "ok";
+        case State::Throttled: return "throttled";
+        case State::Disabled: return "disabled";
+    }
+    return "";
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+#include "lua_hooks.h"
+
+// keeps lua systems from stalling the frame.
+//
+// a system with a budget (its own, or the default one) gets a count hook (see
+// lua_hooks.h) while it runs. once a run goes over its instructions or its
+// time, the hook raises a lua error in it, which gets logged like any other
+// error from that system. the rest of that run is skipped.
+//
+// runs nest: a system can fire an event, whose handlers run inside its run.
+// a handler without a budget of its own runs on the outer one's, and if that
+// runs out in the handler, the handler is stopped, but the error goes on up to
+// the system that owns the budget and is blamed on it (see tripped_by).
+//
+// a system that goes over THROTTLE_AFTER runs in a row only gets one run in
+// THROTTLE_EVERY after that, until it stays in budget for UNTHROTTLE_AFTER
+// runs. one that goes over DISABLE_AFTER runs in a row doesn't run anymore,
+// until its script is reloaded or Engine.reset_system_budgets is called.
+
+namespace motorcar {
+    struct SystemBudget {
+        u64 instructions = 0; // 0 for no limit
+        f64 secs = 0.;        // 0 for no limit
+
+        bool is_unlimited() const { return instructions == 0 && secs == 0.; }
+    };
+
+    class SystemWatchdog {
+        static const u32 CHECK_EVERY = 1000; // instructions
+        static const u32 THROTTLE_AFTER = 3;
+        static const u32 THROTTLE_EVERY = 8;
+        static const u32 UNTHROTTLE_AFTER = 8;
+        static const u32 DISABLE_AFTER = 10;
+
+        public:
+            enum class State { Ok, Throttled, Disabled };
+
+            struct Stats {
+                size_t trips = 0; // runs that went over budget this frame
+                size_t throttled = 0;
+                size_t disabled = 0;
+            };
+
+            struct SystemReport {
+                std::string_view where;
+                State state;
+                u64 trips;   // since it was registered
+                u64 skipped; // runs skipped for being throttled or disabled
+                u64 last_instructions; // roughly, in CHECK_EVERY steps
+                f64 last_secs;
+            };
+
+        private:
+            struct Entry {
+                std::string where;
+                std::optional<SystemBudget> budget; // the default budget if empty
+                State state = State::Ok;
+                u32 consecutive_trips = 0;
+                u32 clean_runs = 0;
+                u64 due = 0; // runs it was due for while throttled
+                u64 trips = 0;
+                u64 skipped = 0;
+                u64 last_instructions = 0;
+                f64 last_secs = 0.;
+            };
+
+            struct Watch {
+                u32 system;
+                SystemBudget budget;
+                u64 instructions = 0;
+                std::chrono::steady_clock::time_point start;
+                bool tripped = false;
+            };
+
+            LuaHooks& hooks;
+            std::vector<Entry> entries;
+            std::unordered_map<std::string, u32> entry_ids;
+            std::optional<Watch> watching;
+            Stats stats;
+
+            static void on_hook(void* self, lua_State* L);
+            void finish(Watch& watch);
+
+        public:
+            // for systems that don't have their own
+            SystemBudget default_budget;
+
+            // watches one run of a system, if it's allowed to run at all
+            class Scope {
+                SystemWatchdog& watchdog;
+                std::optional<Watch> outer;
+                bool watched = false;
+                bool allowed = true;
+
+                public:
+                    Scope(SystemWatchdog& watchdog, u32 system);
+                    ~Scope();
+                    bool is_allowed() const { return allowed; }
+
+                    Scope(Scope&) = delete;
+                    Scope& operator=(Scope&) = delete;
+            };
+
+            SystemWatchdog(LuaHooks& hooks) : hooks(hooks) {}
+
+            // the id to hand to Scope for the system registered at `where`.
+            // registering it again (e.g. reloading its script) starts it over
+            u32 system(std::string_view where, std::optional<SystemBudget> budget);
+
+            // whether the run being watched went over, and shouldn't keep calling into lua
+            bool tripped() const { return watching.has_value() && watching->tripped; }
+            // whether it was `system`'s own budget that ran out. when it's some
+            // outer run's, `system` should stop and let the error through to it
+            bool tripped_by(u32 system) const { return tripped() && watching->system == system; }
+            // where the system whose budget ran out was registered
+            std::string_view tripped_where() const { return tripped() ? entries[watching->system].where : ""; }
+
+            // lets every throttled and disabled system run again
+            void reset();
+
+            // once a frame
+            Stats end_frame();
+
+            std::vector<SystemReport> report() const;
+            static std::string_view state_name(State state);
+    };
+}
@@ -1,3 +1,6 @@
+-- a baked stage already has all of these
+if Stages.from_snapshot then return end
+
 --Spawn Pan
 local pan = ECS.new_entity()
 ECS.insert_component(pan, "transform", Transform.new()
@@ -1,40 +1,24 @@
--- enemy walks to the very left (z = -20) and then walks to the very right (z = 20) forever
-local speed = 3.0
-ECS.register_system({ "global_transform", "transform", "enemy" },
-function(enemy)
-    local gt = enemy.global_transform
-    local pos = gt:position()
-
-    if not enemy.enemy.direction then
-        enemy.enemy.direction = vec3.new(0, 0, 1) -- start by going right
-        enemy.transform:set_rotation_euler(vec3.new(0, -3.14 / 2, 0)) -- face right
-    end
-
-    -- change direction if at bounds
-    if pos.z >= 20 then
-        enemy.enemy.direction = vec3.new(0, 0, -1) -- go left
-        enemy.transform:set_rotation_euler(vec3.new(0, 3.14 / 2, 0)) -- face left
-    elseif pos.z <= -20 then
-        enemy.enemy.direction = vec3.new(0, 0, 1) -- go right
-        enemy.transform:set_rotation_euler(vec3.new(0, -3.14 / 2, 0)) -- face right
-    end
-
-    enemy.transform:translate_by(
-        enemy.enemy.direction * 
-        Engine.delta() * 
-        speed
-    )
-end)
+-- enemy walks to the very left (z = -20) and then walks to the very right (z = 20) forever,
+-- facing the way it walks. the enemy model looks down +x
+ECS.use_kernel("patrol", {
+    on = { "enemy" },
+    axis = "z", min = -20, max = 20,
+    speed = 3.0,
+    face = vec3.new(1, 0, 0),
+})
 
 -- when enemy collides with slop trigger, delete enemy
+local SLOP = ECS.component_id("slop")
+local FOOD_TYPE = ECS.component_id("food_type")
+local ENEMY_SERVED = Events.id("enemy_served")
 ECS.register_system({ "enemy", "colliding_with", "entity" }, function(enemy)
     for idx, e in pairs(enemy.colliding_with.entities) do
-        if ECS.get_component(e, "slop") ~= nil then
-            if(enemy.enemy.wants == ECS.get_component(e, "food_type")) then
+        if ECS.get_component(e, SLOP) ~= nil then
+            if(enemy.enemy.wants == ECS.get_component(e, FOOD_TYPE)) then
                 Log.debug("Enemy wants: " .. enemy.enemy.wants)
-                Log.debug("Food fired: " .. ECS.get_component(e, "food_type"))
+                Log.debug("Food fired: " .. ECS.get_component(e, FOOD_TYPE))
                 ECS.delete_entity(enemy.entity)
-                ECS.fire_event("enemy_served")
+                ECS.fire_event(ENEMY_SERVED)
             end
             
         end
@@ -1,5 +1,7 @@
 local foods = { "chili", "mashed_potatoes", "hot_dog" }
 
+ECS.define_component("enemy", { wants = "string" })
+
 local MAX_ENEMIES = 30
 function spawn_enemy() 
     -- enforce MAX_ENEMIES
@@ -32,16 +34,17 @@ function spawn_enemy()
     )
 end
 
-local start_timer = 5.
-local timer = start_timer
-ECS.register_system({}, function()
-    timer = timer - Engine.delta()
-    if timer <= 0. then
+Tasks.spawn(function()
+    local start_timer = 5.
+    while true do
+        Tasks.wait(start_timer)
         spawn_enemy()
-        timer = start_timer
         start_timer = math.max(start_timer * .95, 1.65)
     end
-end, "render")
+end)
 
-spawn_enemy()
-spawn_enemy()
+-- a baked stage already has its first two
+if not Stages.from_snapshot then
+    spawn_enemy()
+    spawn_enemy()
+end
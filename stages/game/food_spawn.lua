@@ -1,3 +1,6 @@
+-- a baked stage already has all of these
+if Stages.from_snapshot then return end
+
 --Spawn Sausages
 local sausage = ECS.new_entity()
 ECS.insert_component(sausage, "transform", Transform.new()
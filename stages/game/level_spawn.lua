@@ -15,6 +15,9 @@ function has_prefix(s)
     return false
 end
 
+-- a baked stage already has the level and its walls
+if Stages.from_snapshot then return end
+
 local gltf = Resources.get_gltf("level.glb")
 
 local level = ECS.new_entity()
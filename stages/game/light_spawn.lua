@@ -4,6 +4,9 @@ function spawn_light(position, color)
     ECS.insert_component(light, "transform", Transform.new():with_position(position))
 end
 
+-- a baked stage already has its lights
+if Stages.from_snapshot then return end
+
 local power = .6
 local spread = 12
 spawn_light(vec3.new(13, 4, spread), vec3.new(.8, .8, .15) * power)
@@ -1,25 +1,32 @@
 ECS.register_component("gun")
 
+local KEY_A, KEY_D, KEY_W, KEY_S = Input.key("a"), Input.key("d"), Input.key("w"), Input.key("s")
+
 -- move player
 ECS.register_system({ "global_transform", "transform", "player" },
 function(player)
     local speed = 7.5
+    local step = Engine.delta() * speed
 
     local gt = player.global_transform
-    if Input.is_key_held_down("a") then
-        player.transform:translate_by(gt:left() * Engine.delta() * speed)
+    if Input.is_key_held_down(KEY_A) then
+        local x, y, z = gt:left_xyz()
+        player.transform:translate_xyz(x * step, y * step, z * step)
     end
 
-    if Input.is_key_held_down("d") then
-        player.transform:translate_by(gt:right() * Engine.delta() * speed)
+    if Input.is_key_held_down(KEY_D) then
+        local x, y, z = gt:right_xyz()
+        player.transform:translate_xyz(x * step, y * step, z * step)
     end
 
-    if Input.is_key_held_down("w") then
-        player.transform:translate_by(gt:forward() * Engine.delta() * speed)
+    if Input.is_key_held_down(KEY_W) then
+        local x, y, z = gt:forward_xyz()
+        player.transform:translate_xyz(x * step, y * step, z * step)
     end
 
-    if Input.is_key_held_down("s") then
-        player.transform:translate_by(gt:backward() * Engine.delta() * speed)
+    if Input.is_key_held_down(KEY_S) then
+        local x, y, z = gt:backward_xyz()
+        player.transform:translate_xyz(x * step, y * step, z * step)
     end
 end)
 
@@ -1,3 +1,8 @@
+Input.lock_mouse()
+
+-- a baked stage already has the player, its camera and the crosshair
+if Stages.from_snapshot then return end
+
 local camera_holder = ECS.new_entity()
 ECS.insert_component(camera_holder, "camera_holder", {})
 ECS.insert_component(camera_holder, "transform", Transform.new())
@@ -18,5 +23,3 @@ ECS.insert_component(crosshair, "sprite", "crosshair.png")
 -- local label = ECS.new_entity()
 -- ECS.insert_component(label, "transform", Transform.new():with_scale(vec3.new(1)):with_position(vec3.new(0, 0, 0)))
 -- ECS.insert_component(label, "text", Text.new("ae\niou"))
-
-Input.lock_mouse()
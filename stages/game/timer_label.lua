@@ -1,16 +1,22 @@
-local label = ECS.new_entity()
-ECS.insert_component(label, "clock", { clock = 180 }) -- three minutes
-ECS.insert_component(label, "text", Text.new("3:00"))
-ECS.insert_component(label, "transform", Transform.new():with_position(vec3.new(-640, -320, 0)))
+if not Stages.from_snapshot then
+    local label = ECS.new_entity()
+    ECS.insert_component(label, "timer_label", {})
+    ECS.insert_component(label, "text", Text.new("3:00"))
+    ECS.insert_component(label, "transform", Transform.new():with_position(vec3.new(-640, -320, 0)))
+end
 
-ECS.register_system({ "text", "clock" }, function(label)
-    label.clock.clock = label.clock.clock - Engine.delta()
-    local c = label.clock.clock
-    label.text.text = ("%d:%02d"):format(math.floor(c / 60), math.floor(c % 60))
-
-    if c <= 0 then
-        local score = 0
-        ECS.for_each({ "score" }, function(s) score = s.score.score end)
-        Stages.change_to("init", { score = score })
+-- looked up rather than kept, a baked stage's label comes back with a new id
+local TIMER_LABEL = ECS.component_id("timer_label")
+Tasks.spawn(function()
+    for c = 179, 0, -1 do -- three minutes
+        Tasks.wait(1)
+        local label = ECS.find_entity(TIMER_LABEL)
+        if label ~= nil then
+            ECS.get_component(label, "text").text = ("%d:%02d"):format(math.floor(c / 60), math.floor(c % 60))
+        end
     end
-end, "render")
\ No newline at end of file
+
+    local score = 0
+    ECS.for_each({ "score" }, function(s) score = s.score.score end)
+    Stages.change_to("init", { score = score })
+end)